@@ -57,6 +57,10 @@ class MicrobitFirmataClient {
 		this.firmwareVersion = '';
 		this.firmwareVersionNumber = 257; //1.1
 
+		// Set to true before connecting to use the packed (7-in-8) string encoding
+		// for scrollString() and the firmware version. Requires firmware support.
+		this.usePackedStrings = false;
+
 		this.buttonAPressed = false;
 		this.buttonBPressed = false;
 		this.isScrolling = false;
@@ -65,6 +69,50 @@ class MicrobitFirmataClient {
 		this.analogChannel = new Array(16).fill(0);
 		this.eventListeners = new Array();
 		this.updateListeners = new Array();
+		this.radioListeners = new Array();
+		this.audioListeners = new Array();
+		this.accelerometerListeners = new Array();
+
+		// board times in microseconds; see requestBoardTime() and enableSampleTimestamps()
+		this.boardTime = 0;
+		this.sampleTimestamp = 0;
+
+		// reply to saveConfiguration() or eraseConfiguration(): 1 done, 0 failed, -1 no reply yet
+		this.configurationSaved = -1;
+
+		// updated by requestRadioStats()
+		this.radioStats = { received: 0, sent: 0, sendsDropped: 0, lost: 0 };
+
+		// updated by requestLoopStats()
+		this.loopStats = { iterations: 0, sleeps: 0, microsAsleep: 0, microsElapsed: 0,
+			latencyMax: 0, latencyMean: 0 };
+
+		// replies to queryAllTasks() and queryTask(), and the count of task errors
+		this.taskIDs = [];
+		this.taskInfo = null;
+		this.taskErrors = 0;
+
+		// bulk transfer: 'idle', 'sending', 'done', or 'failed', and chunks resent in the
+		// current or last transfer; see sendBulkTransfer()
+		this.bulkState = 'idle';
+		this.bulkChunksResent = 0;
+		this.bulkID = Date.now() & 0x7F; // unlikely to match a transfer left by another client
+		this.bulkTimer = null;
+
+		// accelerometer range (g) and sample period (msecs); see setAccelerometerConfig()
+		this.accelerometerRange = 0;
+		this.accelerometerPeriod = 0;
+		this.accelerometerSamplesMissed = 0;
+
+		// true from playWaveform() until the board reports that the waveform is done
+		this.waveformPlaying = false;
+
+		// microphone: reply to the last start/stop (MIC_OFF if the board has no microphone),
+		// the RMS level of the last window, and audio blocks lost
+		this.microphoneMode = -1;
+		this.soundLevel = 0;
+		this.audioBlocksLost = 0;
+		this.lastAudioSequence = -1;
 
 		// statistics:
 		this.analogUpdateCount = 0;
@@ -93,8 +141,24 @@ class MicrobitFirmataClient {
 		// Firamata Sysex Messages
 
 		this.EXTENDED_ANALOG_WRITE		= 0x6F; // analog write (PWM, Servo, etc) to any pin
+		this.SERVO_CONFIG				= 0x70; // set a servo pin's pulse width range
 		this.REPORT_FIRMWARE			= 0x79; // request/report firmware version and name
 		this.SAMPLING_INTERVAL			= 0x7A; // set msecs between streamed analog samples
+		this.SCHEDULER_DATA				= 0x7B; // create, schedule, and query stored tasks
+
+		// Scheduler Subcommands
+
+		this.CREATE_FIRMATA_TASK		= 0x00;
+		this.DELETE_FIRMATA_TASK		= 0x01;
+		this.ADD_TO_FIRMATA_TASK		= 0x02;
+		this.DELAY_FIRMATA_TASK			= 0x03;
+		this.SCHEDULE_FIRMATA_TASK		= 0x04;
+		this.QUERY_ALL_FIRMATA_TASKS	= 0x05;
+		this.QUERY_FIRMATA_TASK			= 0x06;
+		this.RESET_FIRMATA_TASKS		= 0x07;
+		this.ERROR_TASK_REPLY			= 0x08;
+		this.QUERY_ALL_TASKS_REPLY		= 0x09;
+		this.QUERY_TASK_REPLY			= 0x0A;
 
 		// BBC micro:bit Sysex Messages (0x01-0x0F)
 
@@ -113,12 +177,69 @@ class MicrobitFirmataClient {
 		this.MB_DEBUG_STRING			= 0x0E
 		this.MB_EXTENDED_SYSEX			= 0x0F; // allow for 128 additional micro:bit messages
 
+		// Extended micro:bit Sysex Messages (sent after MB_EXTENDED_SYSEX)
+
+		this.MB_EXT_RADIO_ENABLE			= 0x01; // turn the radio on (1) or off (0)
+		this.MB_EXT_RADIO_GROUP				= 0x02; // set the radio group (0-255)
+		this.MB_EXT_RADIO_POWER				= 0x03; // set the transmit power (0-7)
+		this.MB_EXT_RADIO_CHANNEL			= 0x04; // set the frequency band (0-83)
+		this.MB_EXT_RADIO_SEND_STRING		= 0x05; // send a MakeCode string packet
+		this.MB_EXT_RADIO_SEND_INTEGER		= 0x06; // send a MakeCode number packet
+		this.MB_EXT_RADIO_SEND_FLOAT		= 0x07; // send a MakeCode number packet (double)
+		this.MB_EXT_RADIO_SEND_PAIR_INTEGER	= 0x08; // send a MakeCode name-value packet
+		this.MB_EXT_RADIO_SEND_PAIR_FLOAT	= 0x09; // send a MakeCode name-value packet (double)
+		this.MB_EXT_RADIO_SEND_PACKET		= 0x0A; // send a raw packet (packed)
+		this.MB_EXT_RADIO_PACKETS			= 0x0B; // batch of received packets (packed)
+		this.MB_EXT_RADIO_BATCH_INTERVAL	= 0x0C; // set the max msecs to hold received packets
+		this.MB_EXT_RADIO_STATS				= 0x0D; // request/report radio statistics
+		this.MB_EXT_SCROLL_STRING_PACKED	= 0x10; // MB_SCROLL_STRING with packed UTF-8 data
+		this.MB_EXT_REPORT_FIRMWARE_PACKED	= 0x11; // REPORT_FIRMWARE with packed UTF-8 data
+		this.MB_EXT_BOARD_TIME				= 0x12; // board microsecond clock (for clock offset estimation)
+		this.MB_EXT_SAMPLE_TIMESTAMPS		= 0x13; // board time before each batch of samples
+		this.MB_EXT_SAVE_CONFIG				= 0x14; // save (1) or erase (0) the startup configuration
+		this.MB_EXT_HEADING_MODE			= 0x15; // channel 13 reports heading (1) or compass x (0)
+		this.MB_EXT_MICROPHONE				= 0x16; // start/stop microphone capture
+		this.MB_EXT_AUDIO_BLOCK				= 0x17; // sequence number, packed IMA-ADPCM block
+		this.MB_EXT_SOUND_LEVEL				= 0x18; // RMS sound level of the last window
+		this.MB_EXT_ACCEL_CONFIG			= 0x19; // set/report accelerometer range and sample period
+		this.MB_EXT_ACCEL_STREAM			= 0x1A; // stream every accelerometer sample in bursts
+		this.MB_EXT_ACCEL_BURST				= 0x1B; // packed burst of accelerometer samples
+		this.MB_EXT_LOOP_STATS				= 0x1C; // request/report main loop sleep statistics
+		this.MB_EXT_WAVEFORM_DATA			= 0x1D; // table offset, packed 16-bit PWM values
+		this.MB_EXT_WAVEFORM_PLAY			= 0x1E; // pin, samples/sec (0 stops), loops (0 forever)
+		this.MB_EXT_ANALOG_WRITE_BATCH		= 0x1F; // set several PWM/servo outputs at once
+		this.MB_EXT_BULK_START				= 0x20; // transfer id, packed length and CRC-16
+		this.MB_EXT_BULK_CHUNK				= 0x21; // transfer id, chunk number, packed data and CRC-16
+		this.MB_EXT_BULK_ACK				= 0x22; // transfer id, next chunk, held chunks, status, CRC-16
+
+		// Bulk Transfer
+
+		this.BULK_STATUS_RECEIVING		= 0x00;
+		this.BULK_STATUS_COMPLETE		= 0x01; // all commands received and run
+		this.BULK_STATUS_UNKNOWN		= 0x02; // no transfer with that id (e.g. the board was reset)
+		this.BULK_CHUNK_SIZE			= 32;
+		this.BULK_WINDOW				= 4;
+		this.BULK_RESEND_MSECS			= 250; // resend a chunk not acknowledged by then
+		this.BULK_GIVE_UP_MSECS			= 5000; // fail after this long without progress
+
+		// Waveform Playback Event
+
+		this.MB_WAVEFORM_EVENT_ID		= 3100;
+		this.MB_WAVEFORM_EVT_DONE		= 1;
+
+		// Microphone Modes
+
+		this.MIC_OFF					= 0x00;
+		this.MIC_AUDIO					= 0x01; // IMA-ADPCM audio blocks
+		this.MIC_LEVEL					= 0x02; // RMS sound level per window
+
 		// Firmata Pin Modes
 
 		this.DIGITAL_INPUT				= 0x00
 		this.DIGITAL_OUTPUT				= 0x01
 		this.ANALOG_INPUT				= 0x02
 		this.PWM						= 0x03
+		this.SERVO						= 0x04
 		this.INPUT_PULLUP				= 0x0B
 		this.INPUT_PULLDOWN				= 0x0F; // micro:bit extension; not defined by Firmata
 	}
@@ -219,6 +340,7 @@ class MicrobitFirmataClient {
 	disconnect() {
 		// Close and discard the serial port.
 
+		this.cancelBulkTransfer();
 		if (this.myPort) {
 			console.log("Closing", this.myPort.path);
 			this.myPort.close();
@@ -248,7 +370,56 @@ class MicrobitFirmataClient {
 	}
 
 	requestFirmwareVersion() {
-		this.myPort.write([this.SYSEX_START, this.REPORT_FIRMWARE, this.SYSEX_END]);
+		if (this.usePackedStrings) {
+			this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX,
+				this.MB_EXT_REPORT_FIRMWARE_PACKED, this.SYSEX_END]);
+		} else {
+			this.myPort.write([this.SYSEX_START, this.REPORT_FIRMWARE, this.SYSEX_END]);
+		}
+	}
+
+	// Internal: 8-to-7 Bit Packing
+
+	packData(bytes) {
+		// Return an Array of 7-bit data bytes encoding the given 8-bit bytes using the
+		// Firmata 7-bit encoding. Every seven bytes of input take eight data bytes.
+
+		var result = [];
+		var shift = 0;
+		var previous = 0;
+		for (var i = 0; i < bytes.length; i++) {
+			var b = bytes[i] & 0xFF;
+			if (0 == shift) {
+				result.push(b & 0x7F);
+				shift = 1;
+				previous = b >> 7;
+			} else {
+				result.push(((b << shift) & 0x7F) | previous);
+				if (6 == shift) {
+					result.push(b >> 1);
+					shift = 0;
+				} else {
+					shift++;
+					previous = b >> (8 - shift);
+				}
+			}
+		}
+		if (shift > 0) result.push(previous);
+		return result;
+	}
+
+	unpackData(start, count) {
+		// Decode count bytes of packed 7-bit data starting at the given index in inbuf.
+		// Return a Uint8Array of the decoded 8-bit bytes.
+
+		var result = new Uint8Array((7 * count) >> 3);
+		for (var i = 0; i < result.length; i++) {
+			var bitIndex = 8 * i;
+			var pos = start + Math.floor(bitIndex / 7);
+			var shift = bitIndex % 7;
+			result[i] = (this.inbuf[pos] >> shift) | ((this.inbuf[pos + 1] << (7 - shift)) & 0xFF);
+		}
+		return result;
 	}
 
 	// Internal: Parse Incoming Firmata Messages
@@ -337,6 +508,74 @@ class MicrobitFirmataClient {
 		case this.REPORT_FIRMWARE:
 			this.receivedFirmwareVersion(sysexStart, argBytes);
 			break;
+		case this.SCHEDULER_DATA:
+			this.receivedSchedulerReply(sysexStart, argBytes);
+			break;
+		case this.MB_EXTENDED_SYSEX:
+			this.dispatchExtendedSysexCommand(sysexStart + 1, argBytes - 1);
+			break;
+		}
+	}
+
+	dispatchExtendedSysexCommand(sysexStart, argBytes) {
+		var extendedCmd = this.inbuf[sysexStart];
+		switch (extendedCmd) {
+		case this.MB_EXT_REPORT_FIRMWARE_PACKED:
+			this.receivedFirmwareVersionPacked(sysexStart, argBytes);
+			break;
+		case this.MB_EXT_BOARD_TIME:
+			if (argBytes >= 6) this.boardTime = this.timeAt(sysexStart + 2);
+			break;
+		case this.MB_EXT_SAMPLE_TIMESTAMPS:
+			if (argBytes >= 5) this.sampleTimestamp = this.timeAt(sysexStart + 1);
+			break;
+		case this.MB_EXT_SAVE_CONFIG:
+			if (argBytes >= 1) this.configurationSaved = this.inbuf[sysexStart + 1];
+			break;
+		case this.MB_EXT_RADIO_PACKETS:
+			this.receivedRadioPackets(sysexStart, argBytes);
+			break;
+		case this.MB_EXT_LOOP_STATS:
+			if (argBytes >= 30) {
+				this.loopStats = {
+					iterations: this.timeAt(sysexStart + 1),
+					sleeps: this.timeAt(sysexStart + 6),
+					microsAsleep: this.timeAt(sysexStart + 11),
+					microsElapsed: this.timeAt(sysexStart + 16),
+					latencyMax: this.timeAt(sysexStart + 21),
+					latencyMean: this.timeAt(sysexStart + 26) };
+			}
+			break;
+		case this.MB_EXT_MICROPHONE:
+			if (argBytes >= 1) this.microphoneMode = this.inbuf[sysexStart + 1];
+			break;
+		case this.MB_EXT_AUDIO_BLOCK:
+			this.receivedAudioBlock(sysexStart, argBytes);
+			break;
+		case this.MB_EXT_ACCEL_CONFIG:
+			if (argBytes >= 3) {
+				this.accelerometerRange = this.inbuf[sysexStart + 1];
+				this.accelerometerPeriod = this.inbuf[sysexStart + 2] | (this.inbuf[sysexStart + 3] << 7);
+			}
+			break;
+		case this.MB_EXT_ACCEL_BURST:
+			this.receivedAccelerometerBurst(sysexStart, argBytes);
+			break;
+		case this.MB_EXT_SOUND_LEVEL:
+			if (argBytes >= 5) this.soundLevel = this.timeAt(sysexStart + 1);
+			break;
+		case this.MB_EXT_BULK_ACK:
+			this.receivedBulkAck(sysexStart, argBytes);
+			break;
+		case this.MB_EXT_RADIO_STATS:
+			if (argBytes >= 20) {
+				this.radioStats = {
+					received: this.timeAt(sysexStart + 1),
+					sent: this.timeAt(sysexStart + 6),
+					sendsDropped: this.timeAt(sysexStart + 11),
+					lost: this.timeAt(sysexStart + 16) };
+			}
+			break;
 		}
 	}
 
@@ -346,6 +585,77 @@ class MicrobitFirmataClient {
 		this.firmataVersion = 'Firmata Protocol ' + major + '.' + minor;
 	}
 
+	receivedSchedulerReply(sysexStart, argBytes) {
+		// Task replies are a task id followed by the packed task state (run time, length,
+		// and position, little-endian) and its commands.
+
+		if (argBytes < 1) return;
+		var reply = this.inbuf[sysexStart + 1];
+		if (this.QUERY_ALL_TASKS_REPLY == reply) {
+			this.taskIDs = Array.from(this.inbuf.slice(sysexStart + 2, sysexStart + 1 + argBytes));
+			return;
+		}
+		if ((this.QUERY_TASK_REPLY != reply) && (this.ERROR_TASK_REPLY != reply)) return;
+		if (this.ERROR_TASK_REPLY == reply) this.taskErrors++;
+		if (argBytes < 2) return;
+		var state = this.unpackData(sysexStart + 3, argBytes - 2);
+		var exists = (state.length >= 8);
+		this.taskInfo = {
+			id: this.inbuf[sysexStart + 2],
+			exists: exists,
+			runTime: exists ? ((state[0] | (state[1] << 8) | (state[2] << 16) | (state[3] << 24)) >>> 0) : 0,
+			length: exists ? (state[4] | (state[5] << 8)) : 0,
+			position: exists ? (state[6] | (state[7] << 8)) : 0,
+			commands: exists ? Array.from(state.slice(8)) : [] };
+	}
+
+	receivedBulkAck(sysexStart, argBytes) {
+		// The acknowledgement gives the next chunk the board needs and a bit for each chunk
+		// from there on that it holds. A chunk that is missing when a chunk sent after it has
+		// arrived was lost or corrupted, so it is resent at once.
+
+		if ((argBytes < 8) || ('sending' != this.bulkState)) return;
+		var ack = Array.from(this.inbuf.slice(sysexStart + 1, sysexStart + 9));
+		if (ack[0] != this.bulkID) return;
+		if (this.crc16(0xFFFF, ack.slice(0, 5)) != (ack[5] | (ack[6] << 7) | (ack[7] << 14))) return;
+		if (this.BULK_STATUS_COMPLETE == ack[4]) {
+			this.bulkAcked = this.bulkChunkCount;
+			this.bulkState = 'done';
+			this.cancelBulkTransfer();
+			return;
+		}
+		if (this.BULK_STATUS_RECEIVING != ack[4]) { // the board no longer has the transfer
+			this.bulkState = 'failed';
+			this.cancelBulkTransfer();
+			return;
+		}
+
+		this.bulkStarted = true;
+		var advance = ((ack[1] | (ack[2] << 7)) - this.bulkAcked) & 0x3FFF;
+		if (advance > (this.bulkNextChunk - this.bulkAcked)) return; // acknowledges chunks not yet sent
+		var latestArrived = 0; // send order of the latest chunk sent that the board has
+		for (var i = this.bulkAcked; i < this.bulkAcked + advance; i++) {
+			latestArrived = Math.max(latestArrived, this.bulkSendOrder[i]);
+		}
+		if (advance > 0) this.bulkProgressTime = Date.now();
+		this.bulkAcked += advance;
+		for (var i = 0; (i < this.BULK_WINDOW) && ((this.bulkAcked + i) < this.bulkNextChunk); i++) {
+			if (ack[3] & (1 << i)) {
+				this.bulkHeld[this.bulkAcked + i] = true;
+				latestArrived = Math.max(latestArrived, this.bulkSendOrder[this.bulkAcked + i]);
+			}
+		}
+		for (var i = this.bulkAcked; i < this.bulkNextChunk; i++) {
+			if (!this.bulkHeld[i] && (this.bulkSendOrder[i] < latestArrived)) {
+				this.sendBulkChunk(i);
+				this.bulkChunksResent++;
+			}
+		}
+		while ((this.bulkNextChunk < this.bulkChunkCount) && (this.bulkNextChunk < this.bulkAcked + this.BULK_WINDOW)) {
+			this.sendBulkChunk(this.bulkNextChunk++);
+		}
+	}
+
 	receivedFirmwareVersion(sysexStart, argBytes) {
 		var major = this.inbuf[sysexStart + 1];
 		var minor = this.inbuf[sysexStart + 2];
@@ -354,10 +664,159 @@ class MicrobitFirmataClient {
 			utf8Bytes.push(this.inbuf[i] | (this.inbuf[i + 1] << 7));
 		}
 		var firmwareName = new TextDecoder().decode(Buffer.from(utf8Bytes));
+		this.setFirmwareVersion(firmwareName, major, minor);
+	}
+
+	receivedFirmwareVersionPacked(sysexStart, argBytes) {
+		var major = this.inbuf[sysexStart + 1];
+		var minor = this.inbuf[sysexStart + 2];
+		var utf8Bytes = this.unpackData(sysexStart + 3, argBytes - 2);
+		var firmwareName = new TextDecoder().decode(utf8Bytes);
+		this.setFirmwareVersion(firmwareName, major, minor);
+	}
+
+	timeAt(i) {
+		// Return the 32-bit board time sent as five 7-bit data bytes starting at inbuf[i].
+
+		var b = this.inbuf;
+		return (b[i] | (b[i + 1] << 7) | (b[i + 2] << 14) | (b[i + 3] << 21)) + (b[i + 4] * 0x10000000);
+	}
+
+	receivedRadioPackets(sysexStart, argBytes) {
+		// Decode a batch of received radio packets and pass each one to the radio listeners.
+		// See mbFirmataFirmware.md for the batch format.
+
+		var batch = this.unpackData(sysexStart + 1, argBytes);
+		if (batch.length < 5) return;
+		var view = new DataView(batch.buffer);
+		var batchTime = view.getUint32(0, true);
+		var i = 5;
+		while ((i + 4) <= batch.length) {
+			var len = batch[i];
+			if ((i + 4 + len) > batch.length) break;
+			var packet = {
+				boardTime: batchTime + view.getUint16(i + 2, true),
+				rssi: -batch[i + 1],
+				data: batch.slice(i + 4, i + 4 + len),
+				type: -1 };
+			this.decodeMakeCodePacket(packet, new DataView(batch.buffer, i + 4, len));
+			i += 4 + len;
+			for (var f of this.radioListeners) f.call(null, packet);
+		}
+	}
+
+	receivedAccelerometerBurst(sysexStart, argBytes) {
+		// Decode a burst of accelerometer samples and pass each one to the accelerometer
+		// listeners. See mbFirmataFirmware.md for the burst format.
+
+		var b = this.unpackData(sysexStart + 1, argBytes);
+		if (b.length < 8) return;
+		var view = new DataView(b.buffer, b.byteOffset, b.length);
+		var t = view.getUint32(0, true);
+		var periodMicros = 1000 * view.getUint16(4, true);
+		var sampleCount = b[6];
+		this.accelerometerSamplesMissed += b[7];
+		if (b.length < 8 + (6 * sampleCount)) return;
+		for (var i = 0; i < sampleCount; i++) {
+			var p = 8 + (6 * i);
+			var x = view.getInt16(p, true);
+			var y = view.getInt16(p + 2, true);
+			var z = view.getInt16(p + 4, true);
+			for (var f of this.accelerometerListeners) f.call(null, t, x, y, z);
+			t = (t + periodMicros) >>> 0;
+		}
+	}
+
+	receivedAudioBlock(sysexStart, argBytes) {
+		// Decode an audio block (a sequence number and a packed IMA-ADPCM block) and pass
+		// the samples to the audio listeners.
+
+		if (argBytes < 2) return;
+		var seq = this.inbuf[sysexStart + 1];
+		if (this.lastAudioSequence >= 0) this.audioBlocksLost += (seq - this.lastAudioSequence - 1) & 0x7F;
+		this.lastAudioSequence = seq;
+		var block = this.unpackData(sysexStart + 2, argBytes - 1);
+		if ((block.length > 2) && (block[2] & 0x80)) this.audioBlocksLost++; // board dropped samples
+		var samples = this.decodeADPCM(block);
+		for (var f of this.audioListeners) f.call(null, samples);
+	}
+
+	decodeADPCM(block) {
+		// Decode an IMA-ADPCM block: the predictor (16-bit, little-endian) and step index,
+		// then two 4-bit samples per byte, low nibble first. Return an Int16Array.
+
+		const stepTable = [
+			7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21,
+			23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66,
+			73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209,
+			230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+			724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+			2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484,
+			7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350,
+			22385, 24623, 27086, 29794, 32767
+		];
+		const indexTable = [-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8];
+
+		if (block.length < 3) return new Int16Array(0);
+		var samples = new Int16Array(2 * (block.length - 3));
+		var predictor = ((block[1] << 8) | block[0]) << 16 >> 16; // sign-extend
+		var index = Math.min(block[2] & 0x7F, 88);
+		for (var i = 0; i < samples.length; i++) {
+			var b = block[3 + (i >> 1)];
+			var code = (i & 1) ? (b >> 4) : (b & 0xF);
+			var step = stepTable[index];
+			var delta = step >> 3;
+			if (code & 4) delta += step;
+			if (code & 2) delta += step >> 1;
+			if (code & 1) delta += step >> 2;
+			predictor += (code & 8) ? -delta : delta;
+			predictor = Math.max(-32768, Math.min(predictor, 32767));
+			index = Math.max(0, Math.min(index + indexTable[code], 88));
+			samples[i] = predictor;
+		}
+		return samples;
+	}
+
+	decodeMakeCodePacket(packet, p) {
+		// Add the MakeCode packet fields (type, senderTime, senderSerial, value, string)
+		// to packet if it is a MakeCode packet.
+
+		if (p.byteLength < 9) return;
+		var stringStart = -1;
+		switch (p.getUint8(0)) {
+		case 0: // number
+		case 1: // name-value pair
+			if (p.byteLength < 13) return;
+			packet.value = p.getInt32(9, true);
+			stringStart = 13;
+			break;
+		case 2: // string
+			stringStart = 9;
+			break;
+		case 4: // number (double)
+		case 5: // name-value pair (double)
+			if (p.byteLength < 17) return;
+			packet.value = p.getFloat64(9, true);
+			stringStart = 17;
+			break;
+		default:
+			return;
+		}
+		packet.type = p.getUint8(0);
+		packet.senderTime = p.getUint32(1, true);
+		packet.senderSerial = p.getUint32(5, true);
+		if (stringStart < p.byteLength) {
+			var len = Math.min(p.getUint8(stringStart), p.byteLength - stringStart - 1);
+			var bytes = new Uint8Array(p.buffer, p.byteOffset + stringStart + 1, len);
+			packet.string = new TextDecoder().decode(bytes);
+		}
+	}
+
+	setFirmwareVersion(firmwareName, major, minor) {
 		this.firmwareVersion = firmwareName + ' ' + major + '.' + minor;
 		this.firmwareVersionNumber  = 256 * major + minor;
 		this.updateEventIDs();
-}
+	}
 
 	receivedDigitalUpdate(chan, pinMask) {
 		var pinNum = 8 * chan;
@@ -408,6 +867,9 @@ class MicrobitFirmataClient {
 			(eventID == MICROBIT_DISPLAY_EVT_ANIMATION_COMPLETE)) {
 				this.isScrolling = false;
 		}
+		if ((sourceID == this.MB_WAVEFORM_EVENT_ID) && (eventID == this.MB_WAVEFORM_EVT_DONE)) {
+			this.waveformPlaying = false;
+		}
 
 		 // notify event listeners
 		for (var f of this.eventListeners) f.call(null, sourceID, eventID);
@@ -470,6 +932,13 @@ class MicrobitFirmataClient {
 		if (null == delay) delay = 120;
 		if (s.length > 100) s = s.slice(0, 100);
 		var buf = new TextEncoder().encode(s);
+		if (this.usePackedStrings) {
+			this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX,
+				this.MB_EXT_SCROLL_STRING_PACKED, delay]);
+			this.myPort.write(this.packData(buf));
+			this.myPort.write([this.SYSEX_END]);
+			return;
+		}
 		this.myPort.write([this.SYSEX_START, this.MB_SCROLL_STRING, delay]);
 		for (var i = 0; i < buf.length; i++) {
 			var b = buf[i];
@@ -552,6 +1021,314 @@ class MicrobitFirmataClient {
 			this.SYSEX_END]);
 	}
 
+	requestBoardTime() {
+		// Request the board's microsecond clock. The reply updates boardTime. Comparing the
+		// board time to the round-trip time of the request gives the offset between the
+		// board clock and the computer clock.
+
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX,
+			this.MB_EXT_BOARD_TIME, 0, this.SYSEX_END]);
+	}
+
+	enableSampleTimestamps(enableFlag) {
+		// When enabled, each batch of analog channel updates is preceded by the board time
+		// at which it was sampled, which updates sampleTimestamp.
+
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX,
+			this.MB_EXT_SAMPLE_TIMESTAMPS, (enableFlag ? 1 : 0), this.SYSEX_END]);
+	}
+
+	requestLoopStats() {
+		// Request the board's main loop statistics since the last request. The reply updates
+		// loopStats: loop iterations, sleeps, usecs asleep and elapsed, and the maximum and
+		// mean wake-up latency (usecs from a sampling deadline to the loop handling it).
+
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX,
+			this.MB_EXT_LOOP_STATS, this.SYSEX_END]);
+	}
+
+	// Scheduler
+
+	createTask(taskID, commands) {
+		// Store an Array of Firmata command bytes on the board as the given task. The board
+		// runs it by itself when scheduled. A task ending with delayTaskCommand() repeats.
+
+		var length = commands.length;
+		this.myPort.write([this.SYSEX_START, this.SCHEDULER_DATA, this.CREATE_FIRMATA_TASK,
+			taskID & 0x7F, length & 0x7F, (length >> 7) & 0x7F, this.SYSEX_END]);
+		for (var i = 0; i < length; i += 56) { // 56 bytes packs into 64
+			this.myPort.write([this.SYSEX_START, this.SCHEDULER_DATA, this.ADD_TO_FIRMATA_TASK, taskID & 0x7F]);
+			this.myPort.write(this.packData(commands.slice(i, i + 56)));
+			this.myPort.write([this.SYSEX_END]);
+		}
+	}
+
+	scheduleTask(taskID, delayMSecs) {
+		this.myPort.write([this.SYSEX_START, this.SCHEDULER_DATA, this.SCHEDULE_FIRMATA_TASK, taskID & 0x7F]);
+		this.myPort.write(this.packData(this.int32Bytes(delayMSecs)));
+		this.myPort.write([this.SYSEX_END]);
+	}
+
+	deleteTask(taskID) {
+		this.myPort.write([this.SYSEX_START, this.SCHEDULER_DATA, this.DELETE_FIRMATA_TASK,
+			taskID & 0x7F, this.SYSEX_END]);
+	}
+
+	resetTasks() {
+		this.myPort.write([this.SYSEX_START, this.SCHEDULER_DATA, this.RESET_FIRMATA_TASKS, this.SYSEX_END]);
+	}
+
+	queryAllTasks() {
+		// The reply updates taskIDs.
+
+		this.myPort.write([this.SYSEX_START, this.SCHEDULER_DATA, this.QUERY_ALL_FIRMATA_TASKS, this.SYSEX_END]);
+	}
+
+	queryTask(taskID) {
+		// The reply updates taskInfo.
+
+		this.taskInfo = null;
+		this.myPort.write([this.SYSEX_START, this.SCHEDULER_DATA, this.QUERY_FIRMATA_TASK,
+			taskID & 0x7F, this.SYSEX_END]);
+	}
+
+	delayTaskCommand(msecs) {
+		// Return the command that, within a task, delays the rest of the task by msecs.
+
+		return [this.SYSEX_START, this.SCHEDULER_DATA, this.DELAY_FIRMATA_TASK]
+			.concat(this.packData(this.int32Bytes(msecs)), [this.SYSEX_END]);
+	}
+
+	int32Bytes(n) {
+		return [n & 0xFF, (n >> 8) & 0xFF, (n >> 16) & 0xFF, (n >> 24) & 0xFF];
+	}
+
+	// Bulk Transfer
+
+	sendBulkTransfer(commands) {
+		// Send an Array of Firmata command bytes (e.g. waveform, task, or display uploads)
+		// reliably over a noisy serial line. It is sent in numbered chunks with CRCs, a few
+		// at a time. The board acknowledges the chunks it has and runs the commands in order,
+		// and only lost or corrupted chunks are resent. bulkState is 'sending' until the board
+		// has run all the commands ('done') or stops responding ('failed').
+
+		this.cancelBulkTransfer();
+		this.bulkData = commands;
+		this.bulkID = (this.bulkID + 1) & 0x7F;
+		this.bulkChunkCount = Math.ceil(commands.length / this.BULK_CHUNK_SIZE);
+		this.bulkAcked = 0; // chunks before this one have been run by the board
+		this.bulkNextChunk = 0; // the next chunk not yet sent
+		this.bulkStarted = false;
+		this.bulkHeld = new Array(this.bulkChunkCount).fill(false);
+		this.bulkSendTime = new Array(this.bulkChunkCount).fill(0);
+		this.bulkSendOrder = new Array(this.bulkChunkCount).fill(0);
+		this.bulkSendCount = 0;
+		this.bulkChunksResent = 0;
+		this.bulkState = 'sending';
+		this.bulkProgressTime = Date.now();
+		this.sendBulkStart();
+		this.bulkTimer = setInterval(() => this.checkBulkTimeouts(), 20);
+	}
+
+	cancelBulkTransfer() {
+		// Stop sending. The board keeps what it has received until the next transfer starts.
+
+		if (this.bulkTimer) clearInterval(this.bulkTimer);
+		this.bulkTimer = null;
+		if ('sending' == this.bulkState) this.bulkState = 'idle';
+	}
+
+	sendBulkStart() {
+		var bytes = this.int32Bytes(this.bulkData.length);
+		var crc = this.crc16(this.crc16(0xFFFF, [this.bulkID]), bytes);
+		bytes.push(crc & 0xFF, crc >> 8);
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX, this.MB_EXT_BULK_START, this.bulkID]);
+		this.myPort.write(this.packData(bytes));
+		this.myPort.write([this.SYSEX_END]);
+		this.bulkStartTime = Date.now();
+	}
+
+	sendBulkChunk(chunk) {
+		// Send a chunk of the command stream. Its CRC covers the id and chunk number bytes,
+		// then the data.
+
+		var header = [this.bulkID, chunk & 0x7F, (chunk >> 7) & 0x7F];
+		var start = chunk * this.BULK_CHUNK_SIZE;
+		var bytes = Array.from(this.bulkData.slice(start, start + this.BULK_CHUNK_SIZE));
+		var crc = this.crc16(this.crc16(0xFFFF, header), bytes);
+		bytes.push(crc & 0xFF, crc >> 8);
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX, this.MB_EXT_BULK_CHUNK].concat(header));
+		this.myPort.write(this.packData(bytes));
+		this.myPort.write([this.SYSEX_END]);
+		this.bulkSendTime[chunk] = Date.now();
+		this.bulkSendOrder[chunk] = ++this.bulkSendCount;
+	}
+
+	checkBulkTimeouts() {
+		// Resend the start or any chunk not acknowledged in time (e.g. the last chunk sent,
+		// which has no later chunk to reveal its loss), and give up if the board stops responding.
+
+		var t = Date.now();
+		if ((t - this.bulkProgressTime) > this.BULK_GIVE_UP_MSECS) {
+			this.bulkState = 'failed';
+			this.cancelBulkTransfer();
+			return;
+		}
+		if (!this.bulkStarted) {
+			if ((t - this.bulkStartTime) > this.BULK_RESEND_MSECS) this.sendBulkStart();
+			return;
+		}
+		for (var i = this.bulkAcked; i < this.bulkNextChunk; i++) {
+			if (!this.bulkHeld[i] && ((t - this.bulkSendTime[i]) > this.BULK_RESEND_MSECS)) {
+				this.sendBulkChunk(i);
+				this.bulkChunksResent++;
+			}
+		}
+	}
+
+	crc16(crc, bytes) {
+		// Update a CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF) with the given bytes.
+
+		for (var i = 0; i < bytes.length; i++) {
+			crc ^= bytes[i] << 8;
+			for (var bit = 0; bit < 8; bit++) {
+				crc = (crc & 0x8000) ? (((crc << 1) ^ 0x1021) & 0xFFFF) : ((crc << 1) & 0xFFFF);
+			}
+		}
+		return crc;
+	}
+
+	// Saved Configuration
+
+	saveConfiguration() {
+		// Save the pin modes, streamed channels and ports, sampling interval, and display
+		// state on the board. The board restores them when it starts, so streaming begins
+		// without waiting for the client. The reply updates configurationSaved.
+
+		this.configurationSaved = -1;
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX,
+			this.MB_EXT_SAVE_CONFIG, 1, this.SYSEX_END]);
+	}
+
+	eraseConfiguration() {
+		// Erase the saved configuration, so the board starts with nothing streaming.
+
+		this.configurationSaved = -1;
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX,
+			this.MB_EXT_SAVE_CONFIG, 0, this.SYSEX_END]);
+	}
+
+	// Radio Commands
+
+	radioEnable(enableFlag) {
+		// Turn the micro:bit radio on or off. Received packets are passed to radio listeners.
+
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX,
+			this.MB_EXT_RADIO_ENABLE, (enableFlag ? 1 : 0), this.SYSEX_END]);
+	}
+
+	radioSetGroup(group) {
+		// Set the radio group (0-255). Only packets sent to this group are received.
+
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX,
+			this.MB_EXT_RADIO_GROUP, group & 0x7F, (group >> 7) & 1, this.SYSEX_END]);
+	}
+
+	radioSetPower(power) {
+		// Set the radio transmit power (0-7).
+
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX,
+			this.MB_EXT_RADIO_POWER, power & 7, this.SYSEX_END]);
+	}
+
+	radioSetChannel(channel) {
+		// Set the radio frequency band (0-83).
+
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX,
+			this.MB_EXT_RADIO_CHANNEL, channel & 0x7F, this.SYSEX_END]);
+	}
+
+	radioSetBatchInterval(msecs) {
+		// Set the maximum number of milliseconds the board holds received packets in order
+		// to send them in batches. Zero sends each packet as soon as it arrives.
+
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX,
+			this.MB_EXT_RADIO_BATCH_INTERVAL, msecs & 0x7F, (msecs >> 7) & 0x7F, this.SYSEX_END]);
+	}
+
+	radioSendString(s) {
+		// Send a string (up to 19 bytes of UTF-8) like the MakeCode "radio send string" block.
+
+		this.sendRadioCommand(this.MB_EXT_RADIO_SEND_STRING, [], s, 19);
+	}
+
+	radioSendNumber(n) {
+		// Send a number like the MakeCode "radio send number" block.
+
+		if (Number.isInteger(n)) {
+			this.sendRadioCommand(this.MB_EXT_RADIO_SEND_INTEGER, this.intBytes(n), '', 0);
+		} else {
+			this.sendRadioCommand(this.MB_EXT_RADIO_SEND_FLOAT, this.doubleBytes(n), '', 0);
+		}
+	}
+
+	radioSendValue(name, n) {
+		// Send a name (up to 8 bytes) and number like the MakeCode "radio send value" block.
+
+		if (Number.isInteger(n)) {
+			this.sendRadioCommand(this.MB_EXT_RADIO_SEND_PAIR_INTEGER, this.intBytes(n), name, 8);
+		} else {
+			this.sendRadioCommand(this.MB_EXT_RADIO_SEND_PAIR_FLOAT, this.doubleBytes(n), name, 8);
+		}
+	}
+
+	radioSendPacket(bytes) {
+		// Send a raw radio packet (an array of up to 32 bytes).
+
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX, this.MB_EXT_RADIO_SEND_PACKET]);
+		this.myPort.write(this.packData(bytes.slice(0, 32)));
+		this.myPort.write([this.SYSEX_END]);
+	}
+
+	requestRadioStats() {
+		// Request the radio statistics. The reply updates radioStats, which has the fields
+		// received, sent, sendsDropped, and lost.
+
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX,
+			this.MB_EXT_RADIO_STATS, this.SYSEX_END]);
+	}
+
+	// Internal: Radio Support
+
+	sendRadioCommand(cmd, valueBytes, s, maxLen) {
+		var msg = [this.SYSEX_START, this.MB_EXTENDED_SYSEX, cmd].concat(valueBytes);
+		var utf8 = new TextEncoder().encode(s).slice(0, maxLen);
+		for (var b of utf8) msg.push(b & 0x7F, (b >> 7) & 1);
+		msg.push(this.SYSEX_END);
+		this.myPort.write(msg);
+	}
+
+	intBytes(n) {
+		// Return a 32-bit integer as five 7-bit data bytes, least significant first.
+
+		n = n >>> 0;
+		return [n & 0x7F, (n >>> 7) & 0x7F, (n >>> 14) & 0x7F, (n >>> 21) & 0x7F, (n >>> 28) & 0x0F];
+	}
+
+	doubleBytes(n) {
+		// Return a 64-bit double as ten 7-bit data bytes, least significant first.
+
+		var bytes = new Uint8Array(new Float64Array([n]).buffer);
+		var bits = 0n;
+		for (var i = 7; i >= 0; i--) bits = (bits << 8n) | BigInt(bytes[i]);
+		var result = [];
+		for (var i = 0; i < 10; i++) {
+			result.push(Number(bits & 0x7Fn));
+			bits >>= 7n;
+		}
+		return result;
+	}
+
 	compassCalibration() {
 		// Request that the micro:bit perform a compass calibration cycle
 		
@@ -578,6 +1355,68 @@ class MicrobitFirmataClient {
 			this.SYSEX_END]);
 	}
 
+	setHeadingMode(headingFlag) {
+		// When on, analog channel 13 reports the tilt-compensated compass heading (0-359 degrees)
+		// instead of the compass x value. Channels 6 and 7 always report pitch and roll.
+
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX,
+			this.MB_EXT_HEADING_MODE, (headingFlag ? 1 : 0), this.SYSEX_END]);
+	}
+
+	// Microphone Commands (V2 board only)
+
+	startMicrophone(sampleRate) {
+		// Stream microphone audio as IMA-ADPCM blocks. The decoded samples are passed to the
+		// audio listeners. A rate of 8000 samples/sec or less fits the default 57600 baud.
+
+		this.sendMicrophoneMode(this.MIC_AUDIO, sampleRate || 8000, 0);
+	}
+
+	startSoundLevel(sampleRate, windowMSecs) {
+		// Stream only the RMS sound level (updating soundLevel) once per window. Much cheaper
+		// than streaming audio.
+
+		this.sendMicrophoneMode(this.MIC_LEVEL, sampleRate || 8000, windowMSecs || 50);
+	}
+
+	stopMicrophone() {
+		this.sendMicrophoneMode(this.MIC_OFF, 0, 0);
+	}
+
+	sendMicrophoneMode(mode, sampleRate, windowMSecs) {
+		this.microphoneMode = -1;
+		this.lastAudioSequence = -1;
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX, this.MB_EXT_MICROPHONE, mode,
+			sampleRate & 0x7F, (sampleRate >> 7) & 0x7F,
+			windowMSecs & 0x7F, (windowMSecs >> 7) & 0x7F,
+			this.SYSEX_END]);
+	}
+
+	// Accelerometer Commands
+
+	setAccelerometerConfig(rangeG, periodMSecs) {
+		// Set the accelerometer range (g) and sample period (msecs). Zero leaves a setting
+		// unchanged. The reply sets accelerometerRange and accelerometerPeriod to the values
+		// the sensor actually uses.
+
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX, this.MB_EXT_ACCEL_CONFIG,
+			rangeG & 0x7F, periodMSecs & 0x7F, (periodMSecs >> 7) & 0x7F, this.SYSEX_END]);
+	}
+
+	streamAccelerometerBursts(samplesPerBurst) {
+		// Stream every accelerometer sample (one per sample period) to the accelerometer
+		// listeners. Samples are sent in bursts of the given size (1-16).
+
+		samplesPerBurst = Math.max(1, Math.min(samplesPerBurst, 16));
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX,
+			this.MB_EXT_ACCEL_STREAM, samplesPerBurst, this.SYSEX_END]);
+	}
+
+	stopAccelerometerBursts() {
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX,
+			this.MB_EXT_ACCEL_STREAM, 0, this.SYSEX_END]);
+	}
+
 	// Event/Update Listeners
 
 	addFirmataEventListener(eventListenerFunction) {
@@ -593,11 +1432,37 @@ class MicrobitFirmataClient {
 		this.updateListeners.push(updateListenerFunction);
 	}
 
+	addFirmataRadioListener(radioListenerFunction) {
+		// Add a listener function to handle received radio packets. The argument is an object
+		// with the fields boardTime (msecs), rssi, data (a Uint8Array), and type (the MakeCode
+		// packet type, or -1). MakeCode packets also have senderTime, senderSerial, and
+		// value and/or string.
+
+		this.radioListeners.push(radioListenerFunction);
+	}
+
+	addFirmataAccelerometerListener(accelerometerListenerFunction) {
+		// Add a listener function called with each accelerometer sample streamed in bursts.
+		// The arguments are the board time of the sample (usecs) and x, y, and z (milli-g).
+
+		this.accelerometerListeners.push(accelerometerListenerFunction);
+	}
+
+	addFirmataAudioListener(audioListenerFunction) {
+		// Add a listener function to handle decoded microphone audio. The argument is an
+		// Int16Array of samples.
+
+		this.audioListeners.push(audioListenerFunction);
+	}
+
 	removeAllFirmataListeners() {
-		// Remove all event and update listeners. Used by test suite.
+		// Remove all event, update, radio, audio, and accelerometer listeners. Used by test suite.
 
 		this.eventListeners = [];
 		this.updateListeners = [];
+		this.radioListeners = [];
+		this.audioListeners = [];
+		this.accelerometerListeners = [];
 	}
 
 	// Digital and Analog Outputs
@@ -635,6 +1500,70 @@ class MicrobitFirmataClient {
 		this.myPort.write([this.SET_PIN_MODE, pinNum, this.DIGITAL_INPUT]);
 	}
 
+	setServoOutput(pinNum, angle) {
+		// Make the given pin a servo output and move the servo to the given angle (0-180).
+		// Like the Arduino Servo library, values of 544 or more are pulse widths in usecs.
+
+		if ((pinNum < 0) || (pinNum > 20)) return;
+		this.myPort.write([this.SET_PIN_MODE, pinNum, this.SERVO]);
+		this.myPort.write([this.SYSEX_START, this.EXTENDED_ANALOG_WRITE,
+			pinNum, (angle & 0x7F), ((angle >> 7) & 0x7F),
+			this.SYSEX_END]);
+	}
+
+	configureServo(pinNum, minPulse, maxPulse) {
+		// Set the pulse widths (usecs) for 0 and 180 degrees (default 544 and 2400).
+
+		if ((pinNum < 0) || (pinNum > 20)) return;
+		this.myPort.write([this.SYSEX_START, this.SERVO_CONFIG, pinNum,
+			minPulse & 0x7F, (minPulse >> 7) & 0x7F, maxPulse & 0x7F, (maxPulse >> 7) & 0x7F,
+			this.SYSEX_END]);
+	}
+
+	setAnalogOutputs(pinValues) {
+		// Set several PWM or servo outputs at once from an array of [pin, value] pairs.
+		// The pins must already be in PWM or servo mode.
+
+		var msg = [this.SYSEX_START, this.MB_EXTENDED_SYSEX, this.MB_EXT_ANALOG_WRITE_BATCH];
+		for (var [pin, value] of pinValues) msg.push(pin & 0x7F, value & 0x7F, (value >> 7) & 0x7F);
+		msg.push(this.SYSEX_END);
+		this.myPort.write(msg);
+	}
+
+	uploadWaveform(samples) {
+		// Upload an array of up to 256 PWM levels (0-1023) for playWaveform(). It is sent in
+		// chunks that fit the board's input buffer; offset zero starts a new table. The board
+		// stops any playback.
+
+		this.waveformPlaying = false;
+		for (var offset = 0; (offset == 0) || (offset < samples.length); offset += 48) {
+			var bytes = [];
+			for (var v of samples.slice(offset, offset + 48)) bytes.push(v & 0xFF, (v >> 8) & 0xFF);
+			this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX, this.MB_EXT_WAVEFORM_DATA,
+				offset & 0x7F, (offset >> 7) & 0x7F]);
+			this.myPort.write(this.packData(bytes));
+			this.myPort.write([this.SYSEX_END]);
+		}
+	}
+
+	playWaveform(pinNum, samplesPerSecond, loops = 1) {
+		// Play the uploaded waveform on the given pin at the given rate (up to 10000
+		// samples/sec), timed by the board's clock. It repeats loops times (0 means until
+		// stopped), then the board sends a MB_WAVEFORM_EVENT_ID event.
+
+		if ((pinNum < 0) || (pinNum > 20)) return;
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX, this.MB_EXT_WAVEFORM_PLAY, pinNum,
+			samplesPerSecond & 0x7F, (samplesPerSecond >> 7) & 0x7F, (samplesPerSecond >> 14) & 0x7F,
+			loops & 0x7F, (loops >> 7) & 0x7F, this.SYSEX_END]);
+		this.waveformPlaying = (samplesPerSecond > 0);
+	}
+
+	stopWaveform() {
+		this.myPort.write([this.SYSEX_START, this.MB_EXTENDED_SYSEX, this.MB_EXT_WAVEFORM_PLAY,
+			0, 0, 0, 0, this.SYSEX_END]);
+		this.waveformPlaying = false;
+	}
+
 } // end class MicrobitFirmataClient
 
 module.exports = MicrobitFirmataClient;
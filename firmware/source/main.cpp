@@ -29,5 +29,6 @@ int main() {
 	initFirmata();
 	while (true) {
 		stepFirmata();
+		sleepFirmata();
 	}
 }
@@ -58,6 +58,7 @@ Accelerometer           &accelerometer  = uBit.accelerometer;
 Compass                 &compass        = uBit.compass;
 MicroBitThermometer     &thermometer    = uBit.thermometer;
 MessageBus              &messageBus     = uBit.messageBus;
+KeyValueStorage         &storage        = uBit.storage;
 
 void device_init() { }
 
@@ -98,6 +99,8 @@ Button                    buttonB(io.P11, DEVICE_ID_BUTTON_B, DEVICE_BUTTON_ALL_
 MicroBitThermometer       thermometer;
 Accelerometer&            accelerometer(MicroBitAccelerometer::autoDetect(_i2c));
 Compass&                  compass(MicroBitCompass::autoDetect(_i2c));
+NRF52FlashManager         internalFlash(MICROBIT_STORAGE_PAGE, 1, MICROBIT_CODEPAGESIZE);
+KeyValueStorage           storage(internalFlash, 0);
 
 void device_init()
 { 
@@ -124,6 +127,7 @@ void device_init()
 #if MICROBIT_CODAL
 
 static uint32_t now() { return system_timer_current_time(); }
+static uint32_t nowMicros() { return (uint32_t) system_timer_current_time_us(); }
 
 #define DAL_VERSION DEVICE_DAL_VERSION
 
@@ -156,6 +160,7 @@ MicroBitAccelerometer   &accelerometer  = uBit.accelerometer;
 MicroBitCompass         &compass        = uBit.compass;
 MicroBitThermometer     &thermometer    = uBit.thermometer;
 MicroBitMessageBus      &messageBus     = uBit.messageBus;
+MicroBitStorage         &storage        = uBit.storage;
 
 void device_init() { }
 
@@ -202,7 +207,20 @@ void device_init() { }
 
 #define DAL_VERSION microbit_dal_version()
 
-static uint32_t now() { return us_ticker_read() / 1000L; }
+static uint32_t nowMicros() { return us_ticker_read(); }
+
+static uint32_t now() {
+	// A msec clock that wraps at 2^32 like the CODAL one, so wrap-safe time comparisons work.
+	// (us_ticker_read() / 1000 would wrap at 4294967 msecs.) runTasks() calls it every pass
+	// through the main loop, well within the 71 minutes before the usec ticker wraps.
+
+	static uint32_t lastMicros = 0;
+	static uint32_t msecs = 0;
+	uint32_t elapsed = (us_ticker_read() - lastMicros) / 1000;
+	lastMicros += 1000 * elapsed;
+	msecs += elapsed;
+	return msecs;
+}
 
 void serial_setBaud(int baudrate) { serial.baud(baudrate); }
 
@@ -231,10 +249,272 @@ static void analogDisable() {
 ////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////
 
+// Radio Backend
+//
+// The radio commands use only these four functions, so the radio can be replaced by a
+// loopback (build with FIRMATA_RADIO_LOOPBACK) to test the radio bridge without radio hardware.
+
+#define RADIO_MAX_PACKET 32
+
+#ifndef FIRMATA_RADIO_LOOPBACK
+#define FIRMATA_RADIO_LOOPBACK 0
+#endif
+
+#if FIRMATA_RADIO_LOOPBACK
+
+// Packets sent are received back, and radioLoopbackInject() can add packets from other
+// (simulated) boards. Received packets are held in a small queue, like the real radio.
+
+#define LOOPBACK_QUEUE_SIZE 8
+
+static uint8_t loopbackPackets[LOOPBACK_QUEUE_SIZE][RADIO_MAX_PACKET];
+static uint8_t loopbackLengths[LOOPBACK_QUEUE_SIZE];
+static int8_t loopbackRSSI[LOOPBACK_QUEUE_SIZE];
+static int loopbackHead = 0;
+static int loopbackCount = 0;
+static int loopbackEnabled = false;
+static uint32_t loopbackDropped = 0;
+
+void radioLoopbackInject(const uint8_t *packet, int len, int rssi) {
+	if (!loopbackEnabled || (len <= 0) || (len > RADIO_MAX_PACKET)) return;
+	if (loopbackCount >= LOOPBACK_QUEUE_SIZE) { // queue full; packet is lost
+		loopbackDropped++;
+		return;
+	}
+	int i = (loopbackHead + loopbackCount) % LOOPBACK_QUEUE_SIZE;
+	memcpy(loopbackPackets[i], packet, len);
+	loopbackLengths[i] = len;
+	loopbackRSSI[i] = rssi;
+	loopbackCount++;
+}
+
+static void radioEnable(int on) {
+	loopbackEnabled = on;
+	loopbackCount = 0;
+}
+
+static void radioConfigure(int group, int power, int channel) { }
+
+static void radioSend(const uint8_t *packet, int len) {
+	radioLoopbackInject(packet, len, -30);
+}
+
+static int radioReceive(uint8_t *packet, int *rssi) {
+	// Copy the next received packet into packet and return its length, or 0 if none.
+
+	if (0 == loopbackCount) return 0;
+	int len = loopbackLengths[loopbackHead];
+	memcpy(packet, loopbackPackets[loopbackHead], len);
+	*rssi = loopbackRSSI[loopbackHead];
+	loopbackHead = (loopbackHead + 1) % LOOPBACK_QUEUE_SIZE;
+	loopbackCount--;
+	return len;
+}
+
+static uint32_t radioDropped() { return loopbackDropped; }
+
+#else
+
+#if FIRMATA_USE_UBIT
+static MicroBitRadio &radio = uBit.radio;
+#else
+static MicroBitRadio radio;
+#endif
+
+static void radioEnable(int on) {
+	if (on) {
+		radio.enable();
+	} else {
+		radio.disable();
+	}
+}
+
+static void radioConfigure(int group, int power, int channel) {
+	radio.setGroup(group);
+	radio.setTransmitPower(power);
+	radio.setFrequencyBand(channel);
+}
+
+static void radioSend(const uint8_t *packet, int len) {
+	radio.datagram.send((uint8_t *) packet, len);
+}
+
+static int radioReceive(uint8_t *packet, int *rssi) {
+	PacketBuffer p = radio.datagram.recv();
+	int len = p.length();
+	if (len <= 0) return 0;
+	if (len > RADIO_MAX_PACKET) len = RADIO_MAX_PACKET;
+	memcpy(packet, p.getBytes(), len);
+	*rssi = p.getRSSI();
+	return len;
+}
+
+static uint32_t radioDropped() { return 0; } // the runtime doesn't count lost packets
+
+#endif // FIRMATA_RADIO_LOOPBACK
+
+////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////
+
+// Microphone Backend
+//
+// Only the V2 board has a microphone. The microphone commands use these four functions.
+// micStart() returns false if there is no microphone. The host simulation supplies a
+// simulated microphone (build with FIRMATA_SIMULATED_MICROPHONE).
+
+#ifndef FIRMATA_SIMULATED_MICROPHONE
+#define FIRMATA_SIMULATED_MICROPHONE 0
+#endif
+
+#if FIRMATA_SIMULATED_MICROPHONE
+
+static int micStart(int sampleRate) {
+	simulatedMicrophoneStart(sampleRate);
+	return true;
+}
+
+static void micStop() { simulatedMicrophoneStart(0); }
+
+static int micRead(int16_t *samples, int maxCount) {
+	return simulatedMicrophoneRead(samples, maxCount);
+}
+
+static uint32_t micOverruns() { return 0; }
+
+#elif MICROBIT_CODAL
+
+// The ADC delivers microphone samples in buffers (from an interrupt). They are kept in a
+// ring buffer until micRead() is called from the main loop. The writer only changes
+// micWritten and the reader only changes micTaken, so no locking is needed.
+
+#define MIC_BUFFER_SAMPLES 1024
+
+static int16_t micBuffer[MIC_BUFFER_SAMPLES];
+static volatile uint32_t micWritten = 0;
+static volatile uint32_t micTaken = 0;
+static volatile uint32_t micLost = 0;
+static volatile int micCapturing = false;
+
+class MicrophoneSink : public DataSink {
+  public:
+	DataSource *source;
+
+	MicrophoneSink() : source(NULL) {}
+
+	virtual int pullRequest() {
+		ManagedBuffer b = source->pull();
+		if (!micCapturing) return DEVICE_OK;
+		int16_t *samples = (int16_t *) b.getBytes();
+		int count = b.length() / 2;
+		for (int i = 0; i < count; i++) {
+			if ((micWritten - micTaken) >= MIC_BUFFER_SAMPLES) {
+				micLost += count - i;
+				break;
+			}
+			micBuffer[micWritten % MIC_BUFFER_SAMPLES] = samples[i];
+			micWritten++;
+		}
+		return DEVICE_OK;
+	}
+};
+
+#if FIRMATA_USE_UBIT
+static NRF52ADC &micADC = uBit.adc;
+#else
+static NRF52ADC &micADC = adc;
+#endif
+
+static MicrophoneSink micSink;
+static NRF52ADCChannel *micChannel = NULL;
+
+static int micStart(int sampleRate) {
+	if (!micChannel) {
+		micChannel = micADC.getChannel(io.microphone);
+		micChannel->setGain(7, 0);
+		micSink.source = &micChannel->output;
+		micChannel->output.connect(micSink);
+	}
+	io.runmic.setDigitalValue(1);
+	io.runmic.setHighDrive(true);
+	micADC.setSamplePeriod(1000000 / sampleRate);
+	micTaken = micWritten;
+	micCapturing = true;
+	return true;
+}
+
+static void micStop() {
+	micCapturing = false;
+	io.runmic.setDigitalValue(0);
+}
+
+static int micRead(int16_t *samples, int maxCount) {
+	int count = 0;
+	while ((count < maxCount) && (micTaken != micWritten)) {
+		samples[count++] = micBuffer[micTaken % MIC_BUFFER_SAMPLES];
+		micTaken++;
+	}
+	return count;
+}
+
+static uint32_t micOverruns() { return micLost; }
+
+#else
+
+static int micStart(int sampleRate) { return false; } // the V1 board has no microphone
+static void micStop() { }
+static int micRead(int16_t *samples, int maxCount) { return 0; }
+static uint32_t micOverruns() { return 0; }
+
+#endif // FIRMATA_SIMULATED_MICROPHONE
+
+////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////
+
+// Waveform Timer Backend
+//
+// Waveform playback writes its samples from a periodic timer interrupt, so their timing
+// doesn't depend on the main loop. waveTimerStart() calls the handler every periodUs usecs
+// until waveTimerStop(). The host simulation supplies a Ticker.
+
+#if MICROBIT_CODAL
+
+// A timer event, handled immediately (in the timer interrupt) rather than from a fiber.
+#define WAVE_TIMER_EVENT 2 // a value of MB_WAVEFORM_EVENT_ID that isn't reported
+
+static void (*waveTimerHandler)() = NULL;
+
+static void waveTimerEvent(MicroBitEvent evt) {
+	if (waveTimerHandler) waveTimerHandler();
+}
+
+static void waveTimerStart(uint32_t periodUs, void (*handler)()) {
+	if (!waveTimerHandler) {
+		messageBus.listen(MB_WAVEFORM_EVENT_ID, WAVE_TIMER_EVENT, waveTimerEvent, MESSAGE_BUS_LISTENER_IMMEDIATE);
+	}
+	waveTimerHandler = handler;
+	system_timer_event_every_us(periodUs, MB_WAVEFORM_EVENT_ID, WAVE_TIMER_EVENT);
+}
+
+static void waveTimerStop() { system_timer_cancel_event(MB_WAVEFORM_EVENT_ID, WAVE_TIMER_EVENT); }
+
+#else
+
+static Ticker waveTicker;
+
+static void waveTimerStart(uint32_t periodUs, void (*handler)()) { waveTicker.attach_us(handler, periodUs); }
+static void waveTimerStop() { waveTicker.detach(); }
+
+#endif // MICROBIT_CODAL
+
+////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////
+
 // Variables
 
 #define IN_BUF_SIZE 250
-static uint8_t inbuf[IN_BUF_SIZE];
+#define OUT_BUF_SIZE 249 // serial transmit buffer size
+static uint8_t serialBuffer[IN_BUF_SIZE];
+static uint8_t *inbuf = serialBuffer; // commands being processed (points to a task while it runs)
 static int inbufCount = 0;
 
 #define MAX_SCROLLING_STRING 200 // room for 100 2-byte UTF-8 characters (probably overkill)
@@ -246,6 +526,13 @@ static char scrollingString[MAX_SCROLLING_STRING];
 static uint8_t firmataPinMode[PIN_COUNT];
 static uint16_t firmataPinState[PIN_COUNT];
 
+// Servo pulse width range (usecs) for angles 0-180, set by SERVO_CONFIG.
+#define SERVO_MIN_PULSE 544
+#define SERVO_MAX_PULSE 2400
+#define SERVO_PERIOD 20000 // usecs; the longest pulse width
+static uint16_t servoMinPulse[PIN_COUNT];
+static uint16_t servoMaxPulse[PIN_COUNT];
+
 static uint8_t isStreamingChannel[16];
 static uint8_t isStreamingPort[16];
 
@@ -253,7 +540,130 @@ static uint8_t displayEnabled = true;
 static uint8_t lightSensorEnabled = false;
 
 static int samplingInterval = 100;
-static int lastSampleTime = 0;
+static uint32_t lastSampleTime = 0; // usecs
+static uint8_t sendSampleTimestamps = false;
+static uint8_t headingMode = false;
+
+// Radio packets to send are queued, each prefixed by its length, and sent one per step.
+// Received packets are collected into a batch, which is sent when full or when the oldest
+// packet has waited radioBatchInterval msecs.
+#define RADIO_TX_QUEUE_SIZE 8
+#define RADIO_BATCH_BYTES 140 // fits in the serial transmit buffer after packing
+
+static uint8_t radioEnabled = false;
+static uint8_t radioGroup = 0;
+static uint8_t radioPower = 6;
+static uint8_t radioChannel = 7;
+static int radioBatchInterval = 10;
+
+static uint8_t radioTxQueue[RADIO_TX_QUEUE_SIZE][RADIO_MAX_PACKET + 1];
+static int radioTxHead = 0;
+static int radioTxCount = 0;
+
+static uint8_t radioBatch[RADIO_BATCH_BYTES];
+static int radioBatchCount = 0;
+static uint32_t radioBatchTime = 0;
+static uint32_t radioBatchDropped = 0; // value of radioDropped() when the last batch was sent
+
+static uint32_t radioPacketsReceived = 0;
+static uint32_t radioPacketsSent = 0;
+static uint32_t radioSendsDropped = 0;
+
+// Microphone samples are sent as IMA-ADPCM blocks (MIC_AUDIO) or as the RMS level of each
+// window of samples (MIC_LEVEL).
+#define MIC_BLOCK_SAMPLES 128
+
+static uint8_t micMode = MIC_OFF;
+static int micSampleRate = 8000;
+static int16_t micBlock[MIC_BLOCK_SAMPLES];
+static int micBlockCount = 0;
+static uint8_t micSequence = 0;
+static uint32_t micReportedOverruns = 0;
+static int32_t micDC = 0; // running average of the input (times 256), to remove the DC offset
+static int16_t adpcmPredictor = 0;
+static int adpcmIndex = 0;
+static uint64_t micLevelSum = 0; // sum of squares
+static int micLevelCount = 0;
+static int micLevelWindow = 400; // samples per level report
+
+// When accelerometer bursts are enabled, every accelerometer sample (one per sample period)
+// is collected and the samples are sent in bursts of accelBurstSize.
+#define ACCEL_MAX_BURST 16 // a full burst is 123 bytes, half the serial transmit buffer
+
+static int accelBurstSize = 0; // zero when not streaming bursts
+static int accelBurstCount = 0;
+static uint8_t accelBurst[8 + (6 * ACCEL_MAX_BURST)];
+static uint32_t accelPeriodMicros = 20000;
+static uint32_t accelNextSample = 0; // board time of the next sample (usecs)
+static uint32_t accelMissed = 0; // samples missed since the last burst
+
+// A waveform table is played out on a PWM pin, one value every 1/waveRate seconds, by the
+// timer interrupt (see waveTick()). The variables it changes are volatile.
+#define WAVE_MAX_SAMPLES 256
+
+static uint16_t waveTable[WAVE_MAX_SAMPLES];
+static volatile int waveLength = 0;
+static int wavePin = 0;
+static uint32_t waveRate = 0; // samples/sec; zero when not playing
+static volatile int wavePosition = 0; // index in waveTable of the next sample
+static uint8_t waveForever = false;
+static volatile uint32_t waveRemaining = 0; // samples left to play, unless waveForever
+static volatile uint8_t waveDone = false; // set by waveTick() when playback has finished
+
+// Scheduled tasks (see SCHEDULER_DATA) are stored Firmata command sequences that the board
+// runs by itself. Their commands are kept in taskMemory, one after another, in task order.
+#define MAX_TASKS 8
+#define TASK_MEMORY 512
+
+struct FirmataTask {
+	uint8_t id;
+	uint8_t scheduled;
+	uint16_t offset; // start of the task's commands in taskMemory
+	uint16_t length; // length given when the task was created
+	uint16_t filled; // bytes added so far
+	uint16_t position; // where the task resumes after a delay
+	uint32_t runTime; // board time (msecs) to run the task, if scheduled
+};
+
+static FirmataTask tasks[MAX_TASKS];
+static int taskCount = 0;
+static uint8_t taskMemory[TASK_MEMORY];
+static int taskMemoryUsed = 0;
+static FirmataTask *runningTask = NULL;
+static uint8_t runningTaskDelayed = false;
+static uint8_t tasksResetPending = false; // SYSTEM_RESET or RESET_FIRMATA_TASKS within a task
+
+// A bulk transfer (see MB_EXT_BULK_START) carries a long Firmata command stream in numbered
+// chunks. Chunks that pass their CRC check are held in window slots until all earlier chunks
+// have arrived, then appended to bulkBuf, where stepBulk() runs the complete commands.
+// A chunk message is 46 bytes, so a full window (184 bytes) fits in the serial receive
+// buffer (249 bytes) with room to spare, even if the main loop is busy while it arrives.
+#define BULK_CHUNK_SIZE 32
+#define BULK_WINDOW 4
+#define BULK_SEQ_MASK 0x3FFF // chunk numbers are 14 bits
+
+static uint8_t bulkID = 0;
+static uint8_t bulkStatus = BULK_STATUS_UNKNOWN;
+static uint32_t bulkLength = 0;
+static uint32_t bulkReceived = 0; // bytes appended to bulkBuf
+static int bulkNextSeq = 0; // next chunk to append to bulkBuf
+static uint8_t bulkSlots[BULK_WINDOW][BULK_CHUNK_SIZE]; // chunk n is held in slot n % BULK_WINDOW
+static uint8_t bulkSlotLength[BULK_WINDOW]; // zero if the slot is empty
+static uint8_t bulkBuf[IN_BUF_SIZE + BULK_CHUNK_SIZE];
+static int bulkBufCount = 0;
+static uint8_t bulkAckPending = false;
+static uint8_t bulkRunning = false; // running commands from bulkBuf
+
+// Main loop statistics (see sleepFirmata() and MB_EXT_LOOP_STATS), reset when reported.
+static uint32_t loopIterations = 0;
+static uint32_t loopSleeps = 0;
+static uint32_t loopMicrosAsleep = 0;
+static uint32_t loopStatsStart = 0;
+static uint32_t loopDeadline = 0; // board time (usecs) of the next deadline, if loopDeadlineSet
+static uint8_t loopDeadlineSet = false;
+static uint32_t loopLatencyMax = 0;
+static uint32_t loopLatencySum = 0;
+static uint32_t loopLatencyCount = 0;
 
 // Serial I/O
 
@@ -280,6 +690,10 @@ static void send3Bytes(uint8_t b1, uint8_t b2, uint8_t b3) {
 	serial.sendChar(b3, ASYNC);
 }
 
+static void sendBytes(const uint8_t *data, int count) {
+	serial.send((uint8_t *) data, count, ASYNC);
+}
+
 // Debugging
 
 static void sendStringData(const char *s) {
@@ -291,6 +705,57 @@ static void sendStringData(const char *s) {
 	}
 }
 
+// 8-to-7 Bit Packing
+
+static void sendPackedData(const uint8_t *data, int count) {
+	// Append the given 8-bit data to the output buffer using the Firmata 7-bit encoding.
+	// The bits are sent LSB first, so every seven bytes of data take eight data bytes.
+
+	int shift = 0;
+	int previous = 0;
+	for (int i = 0; i < count; i++) {
+		uint8_t b = data[i];
+		if (0 == shift) {
+			sendByte(b & 0x7F);
+			shift = 1;
+			previous = b >> 7;
+		} else {
+			sendByte(((b << shift) & 0x7F) | previous);
+			if (6 == shift) {
+				sendByte(b >> 1);
+				shift = 0;
+			} else {
+				shift++;
+				previous = b >> (8 - shift);
+			}
+		}
+	}
+	if (shift > 0) sendByte(previous);
+}
+
+static void waitForPackedRoom(int headerBytes, int count) {
+	// Sleep until a message of headerBytes plus count packed bytes fits in the serial transmit
+	// buffer. Async sends drop the bytes that don't fit, which would cut the message short.
+
+	int messageBytes = headerBytes + (((8 * count) + 6) / 7);
+	while (serial.txBufferedSize() > (OUT_BUF_SIZE - messageBytes)) __WFE();
+}
+
+static int unpackData(const uint8_t *src, int srcCount, uint8_t *dst, int dstSize) {
+	// Decode packed 7-bit data from src into dst and return the number of bytes decoded.
+	// Any incomplete trailing bits are discarded. It is safe for dst to be the same as src.
+
+	int count = (7 * srcCount) >> 3;
+	if (count > dstSize) count = dstSize;
+	for (int i = 0; i < count; i++) {
+		int bitIndex = 8 * i;
+		int pos = bitIndex / 7;
+		int shift = bitIndex % 7;
+		dst[i] = (src[pos] >> shift) | ((src[pos + 1] << (7 - shift)) & 0xFF);
+	}
+	return count;
+}
+
 static void DEBUG(const char *s) {
 	// Send a 7-bit ASCII string for use in debugging.
 
@@ -308,8 +773,8 @@ static void reportFirmataVersion() {
 	send3Bytes(FIRMATA_VERSION, 0x02, 0x06); // Firmata protocol 2.6
 }
 
-static void reportFirmwareVersion() {
-	// Send firmware version plus DAL, mbed library, and softdevice version info.
+static void getFirmwareName(char *s) {
+	// Write the firmware name plus DAL, mbed library, and softdevice version info into s.
 	// The softdevice version can be found by looking up the firmward ID (FWID) here:
 	// https://devzone.nordicsemi.com/f/nordic-q-a/1171/how-do-i-access-softdevice-version-string
 
@@ -321,7 +786,6 @@ static void reportFirmwareVersion() {
 	// MICROBIT_ID_DISPLAY/GESTURE/IO_P0/IO_P1/IO_P2
 	int major = FIRMATA_VERSION_MAJOR;
 	int minor = FIRMATA_VERSION_MINOR;
-	char s[256] = {0};
 
 	#if MICROBIT_CODAL==1
 		// Need to check both variables to support building against older versions of CODAL
@@ -347,56 +811,158 @@ static void reportFirmwareVersion() {
 		sprintf(s, "[based on DAL %s; mbed %d; softdeviceFWID %d] micro:bit Firmata %d.%d",
 			DAL_VERSION, MBED_LIBRARY_VERSION, bleInfo.subversion_number, major, minor);
 	#endif
+}
+
+static void reportFirmwareVersion() {
+	// Send firmware version plus DAL, mbed library, and softdevice version info.
+
+	char s[256] = {0};
+	getFirmwareName(s);
 
 	send2Bytes(SYSEX_START, REPORT_FIRMWARE);
-	send2Bytes(major, minor); // firmware version (vs. Firmata protocol version)
+	send2Bytes(FIRMATA_VERSION_MAJOR, FIRMATA_VERSION_MINOR); // firmware version (vs. Firmata protocol version)
 	sendStringData((const char *) s);
 	sendByte(SYSEX_END);
 }
 
+static void reportFirmwareVersionPacked() {
+	// Same as reportFirmwareVersion(), but the string data is packed 7-in-8.
+
+	char s[256] = {0};
+	getFirmwareName(s);
+
+	send3Bytes(SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_REPORT_FIRMWARE_PACKED);
+	send2Bytes(FIRMATA_VERSION_MAJOR, FIRMATA_VERSION_MINOR);
+	sendPackedData((const uint8_t *) s, strlen(s));
+	sendByte(SYSEX_END);
+}
+
+static void resetTasks() {
+	if (runningTask) { // the running task's commands can't be deleted under it
+		tasksResetPending = true;
+		return;
+	}
+	taskCount = 0;
+	taskMemoryUsed = 0;
+}
+
 static void systemReset() {
 	memset(firmataPinMode, UNKNOWN_PIN_MODE, sizeof(firmataPinMode));
 	memset(firmataPinState, UNKNOWN_PIN_STATE, sizeof(firmataPinState));
+	for (int pin = 0; pin < PIN_COUNT; pin++) {
+		servoMinPulse[pin] = SERVO_MIN_PULSE;
+		servoMaxPulse[pin] = SERVO_MAX_PULSE;
+	}
 	memset(isStreamingChannel, false, sizeof(isStreamingChannel));
 	memset(isStreamingPort, false, sizeof(isStreamingPort));
 	samplingInterval = 100;
+	sendSampleTimestamps = false;
+	headingMode = false;
+	if (micMode != MIC_OFF) micStop();
+	micMode = MIC_OFF;
+	accelBurstSize = 0;
+	if (waveRate) waveTimerStop();
+	waveRate = 0;
+	if (!bulkRunning) bulkStatus = BULK_STATUS_UNKNOWN;
+	resetTasks();
+}
+
+static void send32Bits(uint32_t t) {
+	// Send a 32-bit value (e.g. a time) as five 7-bit data bytes, least significant first.
+
+	send3Bytes(t & 0x7F, (t >> 7) & 0x7F, (t >> 14) & 0x7F);
+	send2Bytes((t >> 21) & 0x7F, (t >> 28) & 0x0F);
+}
+
+static void reportBoardTime(int sysexStart, int argBytes) {
+	// Reply with the sequence number from the request followed by the board's microsecond
+	// clock. A client can estimate the offset between its clock and the board's clock from
+	// the round-trip times of these queries.
+
+	int seq = (argBytes > 0) ? inbuf[sysexStart + 1] : 0;
+	uint32_t t = nowMicros();
+	send3Bytes(SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_BOARD_TIME);
+	sendByte(seq);
+	send32Bits(t);
+	sendByte(SYSEX_END);
+}
+
+static void setSampleTimestamps(int sysexStart, int argBytes) {
+	if (argBytes < 1) return;
+	sendSampleTimestamps = (inbuf[sysexStart + 1] != 0);
 }
 
 static void calibrateCompass() {
 	compass.calibrate();
 }
 
+// Board Description
+
+// The V1 and V2 boards have the same edge connector, so both use these tables.
+// PIN_NO_DISPLAY marks the pins that can't be used while the LED display is enabled.
+
+#define PIN_DIGITAL		0x01 // digital input and output, PWM, servo, pullup/pulldown
+#define PIN_ANALOG		0x02 // analog input
+#define PIN_NO_DISPLAY	0x04 // unavailable while the display is enabled
+
+#define DIG (PIN_DIGITAL | PIN_NO_DISPLAY)
+#define ANA (PIN_DIGITAL | PIN_ANALOG | PIN_NO_DISPLAY)
+
+static constexpr uint8_t pinFlags[PIN_COUNT] = {
+	PIN_DIGITAL | PIN_ANALOG, PIN_DIGITAL | PIN_ANALOG, PIN_DIGITAL | PIN_ANALOG, // P0-P2
+	ANA, ANA, DIG, DIG, DIG, DIG, DIG, ANA, // P3-P10
+	DIG, DIG, DIG, DIG, DIG, DIG, PIN_NO_DISPLAY, PIN_NO_DISPLAY, DIG, DIG // P11-P20 (P17-P18 are 3.3v)
+};
+
+#undef DIG
+#undef ANA
+
+// Analog channels 0-4 are pins P0-P4, channel 5 is pin P10, and the others are sensors.
+static constexpr int8_t analogChannelPin[16] = {
+	0, 1, 2, 3, 4, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+static inline int pinAvailable(int pin) {
+	return !(displayEnabled && (pinFlags[pin] & PIN_NO_DISPLAY));
+}
+
+// Replies that never change are encoded at compile time and sent with a single write.
+// The capability report lists the light sensor (P11, channel 11) as an analog pin.
+
+#define CAPS_ANALOG DIGITAL_INPUT, 1, DIGITAL_OUTPUT, 1, ANALOG_INPUT, 10, PWM, 10, SERVO, 14, INPUT_PULLUP, 1
+#define CAPS_DIGITAL DIGITAL_INPUT, 1, DIGITAL_OUTPUT, 1, PWM, 10, SERVO, 14, INPUT_PULLUP, 1
+#define NEXT_PIN 0x7F
+
+static constexpr uint8_t capabilityResponse[] = {
+	SYSEX_START, CAPABILITY_RESPONSE,
+	CAPS_ANALOG, NEXT_PIN, CAPS_ANALOG, NEXT_PIN, CAPS_ANALOG, NEXT_PIN, // P0-P2
+	CAPS_ANALOG, NEXT_PIN, CAPS_ANALOG, NEXT_PIN, CAPS_ANALOG, NEXT_PIN, // P3-P5
+	CAPS_DIGITAL, NEXT_PIN, CAPS_DIGITAL, NEXT_PIN, CAPS_DIGITAL, NEXT_PIN, // P6-P8
+	CAPS_DIGITAL, NEXT_PIN, CAPS_DIGITAL, NEXT_PIN, CAPS_ANALOG, NEXT_PIN, // P9-P11
+	CAPS_DIGITAL, NEXT_PIN, CAPS_DIGITAL, NEXT_PIN, CAPS_DIGITAL, NEXT_PIN, // P12-P14
+	CAPS_DIGITAL, NEXT_PIN, CAPS_DIGITAL, NEXT_PIN, NEXT_PIN, NEXT_PIN, // P15-P18
+	CAPS_DIGITAL, NEXT_PIN, CAPS_DIGITAL, // P19-P20
+	SYSEX_END
+};
+
+#undef CAPS_ANALOG
+#undef CAPS_DIGITAL
+#undef NEXT_PIN
+
+static constexpr uint8_t analogMappingResponse[] = {
+	SYSEX_START, ANALOG_MAPPING_RESPONSE,
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+	SYSEX_END
+};
+
 // Pin Commands
 
 static void reportAnalogMapping() {
-	// Report that the analog iput pins are P0-P4 and P10.
-
-	send2Bytes(SYSEX_START, ANALOG_MAPPING_RESPONSE);
-	for (int i = 0; i <= 15; i++) sendByte(i);
-	sendByte(SYSEX_END);
+	sendBytes(analogMappingResponse, sizeof(analogMappingResponse));
 }
 
 static void reportPinCapabilities() {
-	// Send pin capabilities report.
-
-	send2Bytes(SYSEX_START, CAPABILITY_RESPONSE);
-	for (int p = 0; p < PIN_COUNT; p++) {
-		// send a sequence of (pin mode, resolution) pairs
-		if ((p < 6) || (11 == p)) { // analog pins + light sensor channel
-			send2Bytes(DIGITAL_INPUT, 1);
-			send2Bytes(DIGITAL_OUTPUT, 1);
-			send2Bytes(ANALOG_INPUT, 10);
-			send2Bytes(PWM, 10);
-			send2Bytes(INPUT_PULLUP, 1);
-		} else if ((17 != p) && (18 != p)) { // pins 17-18 are 3.3v
-			send2Bytes(DIGITAL_INPUT, 1);
-			send2Bytes(DIGITAL_OUTPUT, 1);
-			send2Bytes(PWM, 10);
-			send2Bytes(INPUT_PULLUP, 1);
-		}
-		if (p < (PIN_COUNT - 1)) sendByte(0x7F); // send pin separator
-	}
-	sendByte(SYSEX_END);
+	sendBytes(capabilityResponse, sizeof(capabilityResponse));
 }
 
 static void reportPinState(int pin) {
@@ -411,15 +977,16 @@ static void reportPinState(int pin) {
 static void setPinMode(int pin, int mode) {
 	if ((pin < 0) || (pin >= PIN_COUNT)) return;
 	if (!((DIGITAL_INPUT == mode) || (INPUT_PULLUP == mode) || (INPUT_PULLDOWN == mode) ||
-		  (DIGITAL_OUTPUT == mode) || (ANALOG_INPUT == mode) || (PWM == mode))) {
+		  (DIGITAL_OUTPUT == mode) || (ANALOG_INPUT == mode) || (PWM == mode) || (SERVO == mode))) {
 		return;
 	}
+	if (!(pinFlags[pin] & PIN_DIGITAL)) return; // not a GPIO pin (P17-P18 are 3.3v)
 	if (ANALOG_INPUT == mode) {
 		if (11 == pin) lightSensorEnabled = true; // enable the light sensor
-		if ((pin > 4) && (pin != 10)) return; // pin is not analog capable
+		if (!(pinFlags[pin] & PIN_ANALOG)) return; // pin is not analog capable
 	}
 
-	if (displayEnabled && (pin > 2)) return; // display uses most pins except 0-2
+	if (!pinAvailable(pin)) return;
 
 	firmataPinMode[pin] = mode;
 	firmataPinState[pin] = UNKNOWN_PIN_STATE;
@@ -431,6 +998,8 @@ static void setPinMode(int pin, int mode) {
 	} else if (PWM == mode) {
 		firmataPinState[pin] = 0;
 		io.pin[pin].setAnalogValue(0);
+	} else if (SERVO == mode) {
+		// no pulses until the first write, so the servo doesn't move to an arbitrary angle
 	} else if (INPUT_PULLUP == mode) {
 		io.pin[pin].getDigitalValue();
 		io.pin[pin].setPull(PullUp);
@@ -449,7 +1018,7 @@ static void setDigitalPin(int pin, int value) {
 
 	if ((pin < 0) || (pin >= PIN_COUNT)) return;
 	if (DIGITAL_OUTPUT != firmataPinMode[pin]) return;
-	if (displayEnabled && (pin > 2)) return; // display uses most pins except 0-2
+	if (!pinAvailable(pin)) return;
 
 	firmataPinState[pin] = value ? 1 : 0;
 
@@ -457,25 +1026,100 @@ static void setDigitalPin(int pin, int value) {
 	io.pin[pin].setDigitalValue(firmataPinState[pin]);
 }
 
+static void writeDigitalOutputs(uint32_t pins, uint32_t values) {
+	// Set the given pins (a bit mask of pin numbers) to the given values with one write to
+	// the GPIO set register and one to the clear register (per GPIO port on the V2).
+
+	uint32_t set[2] = { 0, 0 };
+	uint32_t clear[2] = { 0, 0 };
+	for (int pin = 0; pin < PIN_COUNT; pin++) {
+		if (!(pins & (1UL << pin))) continue;
+		int gpio = io.pin[pin].name;
+		if (values & (1UL << pin)) {
+			set[gpio >> 5] |= 1UL << (gpio & 31);
+		} else {
+			clear[gpio >> 5] |= 1UL << (gpio & 31);
+		}
+	}
+#if MICROBIT_CODAL
+	NRF_P0->OUTSET = set[0];
+	NRF_P1->OUTSET = set[1];
+	NRF_P0->OUTCLR = clear[0];
+	NRF_P1->OUTCLR = clear[1];
+#else
+	NRF_GPIO->OUTSET = set[0];
+	NRF_GPIO->OUTCLR = clear[0];
+#endif
+}
+
 static void setDigitalPort(int port, int pinMask) {
 	// Handle an incoming digital I/O message (0x90).
-	// Only pins in digital output mode will only be changed.
+	// Only pins in digital output mode are changed, all at the same moment. They were
+	// configured as outputs by setPinMode(), so their GPIO registers can be written directly.
 
 	if (port > 2) return;
 	int basePin = 8 * port;
+	uint32_t pins = 0;
+	uint32_t values = 0;
 	for (int i = 0; i < 8; i++) {
-		int isOn = (pinMask & (1 << i)) ? 1 : 0;
-		setDigitalPin(basePin + i, isOn);
+		int pin = basePin + i;
+		if ((pin >= PIN_COUNT) || (DIGITAL_OUTPUT != firmataPinMode[pin]) || !pinAvailable(pin)) continue;
+		firmataPinState[pin] = (pinMask >> i) & 1;
+		pins |= 1UL << pin;
+		if (firmataPinState[pin]) values |= 1UL << pin;
 	}
+	if (pins) writeDigitalOutputs(pins, values);
 }
 
 static void setAnalogPin(int pin, int value) {
+	// Set a PWM pin's duty cycle (0-1023) or a servo pin's angle (0-180 degrees). Like the
+	// Arduino Servo library, servo values of 544 or more are pulse widths in usecs, limited
+	// to the pin's range (see servoConfig()).
+
 	if ((pin < 0) || (pin >= PIN_COUNT)) return;
-	if (PWM != firmataPinMode[pin]) return;
-	firmataPinState[pin] = value;
+	if ((PWM != firmataPinMode[pin]) && (SERVO != firmataPinMode[pin])) return;
 
 	// set actual pin output
-	io.pin[pin].setAnalogValue(value);
+	if (SERVO == firmataPinMode[pin]) {
+		int pulse = value;
+		if (value < SERVO_MIN_PULSE) {
+			if (value > 180) value = 180;
+			pulse = servoMinPulse[pin] + ((value * (servoMaxPulse[pin] - servoMinPulse[pin])) / 180);
+		} else {
+			if (pulse < servoMinPulse[pin]) pulse = servoMinPulse[pin];
+			if (pulse > servoMaxPulse[pin]) pulse = servoMaxPulse[pin];
+			value = pulse;
+		}
+		firmataPinState[pin] = value;
+		io.pin[pin].setServoPulseUs(pulse);
+	} else {
+		firmataPinState[pin] = value;
+		io.pin[pin].setAnalogValue(value);
+	}
+}
+
+static void servoConfig(int sysexStart, int argBytes) {
+	// Set a servo pin's pulse widths (usecs) for 0 and 180 degrees and make it a servo.
+	// Ignore the command if the range is empty or reversed, or longer than the servo period.
+
+	if (argBytes < 5) return;
+	int pin = inbuf[sysexStart + 1];
+	if ((pin < 0) || (pin >= PIN_COUNT)) return;
+	int minPulse = inbuf[sysexStart + 2] | (inbuf[sysexStart + 3] << 7);
+	int maxPulse = inbuf[sysexStart + 4] | (inbuf[sysexStart + 5] << 7);
+	if ((minPulse >= maxPulse) || (maxPulse > SERVO_PERIOD)) return;
+	servoMinPulse[pin] = minPulse;
+	servoMaxPulse[pin] = maxPulse;
+	if (SERVO != firmataPinMode[pin]) setPinMode(pin, SERVO);
+}
+
+static void analogWriteBatch(int sysexStart, int argBytes) {
+	// Set several PWM or servo outputs from one message: a pin and value (two data bytes)
+	// for each. The writes are done back to back, well within one PWM period.
+
+	for (int i = sysexStart + 1; i + 2 <= sysexStart + argBytes; i += 3) {
+		setAnalogPin(inbuf[i], inbuf[i + 1] | (inbuf[i + 2] << 7));
+	}
 }
 
 static void extendedAnalogWrite(int sysexStart, int argBytes) {
@@ -501,9 +1145,9 @@ static void streamAnalogChannel(uint8_t chan, uint8_t isOn) {
 
 	if (chan > 15) return;
 	isStreamingChannel[chan] = isOn;
-	if (chan < 6) {
-		int pin = (5 == chan) ? 10 : chan; // channels 0-4 are pins 0-4; channel 5 is pin 10
-		if (displayEnabled && (pin > 2)) { // display uses pins 3-5
+	int pin = analogChannelPin[chan];
+	if (pin >= 0) {
+		if (!pinAvailable(pin)) {
 			isStreamingChannel[chan] = false;
 			return;
 		}
@@ -588,6 +1232,19 @@ static void scrollString(int sysexStart, int argBytes) {
 	display.scrollAsync(scrollingString, scrollSpeed);
 }
 
+static void scrollStringPacked(int sysexStart, int argBytes) {
+	// Like scrollString(), but the UTF-8 data is packed (seven bytes in every eight data bytes).
+
+	if (argBytes < 1) return;
+	int scrollSpeed = inbuf[sysexStart + 1];
+	if (!displayEnabled) sendScrollDoneEvent();
+	display.stopAnimation();
+	int utf8Bytecount = unpackData(&inbuf[sysexStart + 2], argBytes - 1,
+		(uint8_t *) scrollingString, MAX_SCROLLING_STRING - 1);
+	scrollingString[utf8Bytecount] = 0; // null terminator
+	display.scrollAsync(scrollingString, scrollSpeed);
+}
+
 static void scrollNumber(int sysexStart, int argBytes) {
 	if (argBytes < 2) return;
 	int scrollSpeed = inbuf[sysexStart + 1];
@@ -648,34 +1305,742 @@ static void enableDisplay(int sysexStart, int argBytes) {
 	setDisplayEnable(isEnabled);
 }
 
-// MIDI parsing
+// Radio Commands
 
-static void dispatchSysexCommand(int sysexStart, int argBytes) {
-	uint8_t sysexCmd = inbuf[sysexStart];
-	switch (sysexCmd) {
-	case MB_DISPLAY_CLEAR:
-		display_clear();
+static uint32_t get32Bits(int index) {
+	// Return the 32-bit value in the five data bytes starting at inbuf[index].
+
+	uint32_t result = 0;
+	for (int i = 4; i >= 0; i--) result = (result << 7) | (inbuf[index + i] & 0x7F);
+	return result;
+}
+
+static uint64_t get64Bits(int index) {
+	// Return the 64-bit value in the ten data bytes starting at inbuf[index].
+
+	uint64_t result = 0;
+	for (int i = 9; i >= 0; i--) result = (result << 7) | (inbuf[index + i] & 0x7F);
+	return result;
+}
+
+static void radioQueuePacket(const uint8_t *packet, int len) {
+	if (!radioEnabled || (len <= 0) || (len > RADIO_MAX_PACKET)) return;
+	if (radioTxCount >= RADIO_TX_QUEUE_SIZE) {
+		radioSendsDropped++;
+		return;
+	}
+	uint8_t *entry = radioTxQueue[(radioTxHead + radioTxCount) % RADIO_TX_QUEUE_SIZE];
+	entry[0] = len;
+	memcpy(&entry[1], packet, len);
+	radioTxCount++;
+}
+
+static int radioPacketHeader(uint8_t *packet, int packetType) {
+	// Fill in the header used by MakeCode radio packets: type, sender time, sender serial number.
+	// Return the header length.
+
+	uint32_t t = now();
+	uint32_t serialNumber = microbit_serial_number();
+	packet[0] = packetType;
+	memcpy(&packet[1], &t, 4);
+	memcpy(&packet[5], &serialNumber, 4);
+	return 9;
+}
+
+static int radioAppendString(uint8_t *packet, int i, int sysexStart, int argBytes, int maxLen) {
+	// Append the length and bytes of the string in inbuf (two data bytes per byte) to packet.
+
+	int len = argBytes / 2;
+	if (len > maxLen) len = maxLen;
+	packet[i++] = len;
+	for (int j = 0; j < len; j++) {
+		packet[i++] = inbuf[sysexStart + (2 * j)] | (inbuf[sysexStart + (2 * j) + 1] << 7);
+	}
+	return i;
+}
+
+static void radioSendValue(int sysexStart, int argBytes) {
+	// Send a MakeCode radio packet: a string, integer, float, or name-value pair.
+	// sysexStart is the index of the extended command byte.
+
+	// MakeCode packet types
+	const int PACKET_TYPE_NUMBER = 0;
+	const int PACKET_TYPE_VALUE = 1;
+	const int PACKET_TYPE_STRING = 2;
+	const int PACKET_TYPE_DOUBLE = 4;
+	const int PACKET_TYPE_DOUBLE_VALUE = 5;
+
+	uint8_t packet[RADIO_MAX_PACKET];
+	int i;
+	uint32_t n;
+	uint64_t d;
+	switch (inbuf[sysexStart]) {
+	case MB_EXT_RADIO_SEND_STRING:
+		i = radioPacketHeader(packet, PACKET_TYPE_STRING);
+		i = radioAppendString(packet, i, sysexStart + 1, argBytes, 19);
 		break;
-	case MB_DISPLAY_SHOW:
-		display_show(sysexStart, argBytes);
+	case MB_EXT_RADIO_SEND_INTEGER:
+		if (argBytes < 5) return;
+		i = radioPacketHeader(packet, PACKET_TYPE_NUMBER);
+		n = get32Bits(sysexStart + 1);
+		memcpy(&packet[i], &n, 4);
+		i += 4;
 		break;
-	case MB_DISPLAY_PLOT:
-		display_plot(sysexStart, argBytes);
+	case MB_EXT_RADIO_SEND_FLOAT:
+		if (argBytes < 10) return;
+		i = radioPacketHeader(packet, PACKET_TYPE_DOUBLE);
+		d = get64Bits(sysexStart + 1);
+		memcpy(&packet[i], &d, 8);
+		i += 8;
 		break;
-	case MB_SCROLL_STRING:
-		scrollString(sysexStart, argBytes);
+	case MB_EXT_RADIO_SEND_PAIR_INTEGER:
+		if (argBytes < 5) return;
+		i = radioPacketHeader(packet, PACKET_TYPE_VALUE);
+		n = get32Bits(sysexStart + 1);
+		memcpy(&packet[i], &n, 4);
+		i = radioAppendString(packet, i + 4, sysexStart + 6, argBytes - 5, 8);
 		break;
-	case MB_SCROLL_INTEGER:
-		scrollNumber(sysexStart, argBytes);
+	case MB_EXT_RADIO_SEND_PAIR_FLOAT:
+		if (argBytes < 10) return;
+		i = radioPacketHeader(packet, PACKET_TYPE_DOUBLE_VALUE);
+		d = get64Bits(sysexStart + 1);
+		memcpy(&packet[i], &d, 8);
+		i = radioAppendString(packet, i + 8, sysexStart + 11, argBytes - 10, 8);
 		break;
-	case MB_SET_TOUCH_MODE:
-		setTouchMode(sysexStart, argBytes);
+	default:
+		return;
+	}
+	radioQueuePacket(packet, i);
+}
+
+static void radioSendPacket(int sysexStart, int argBytes) {
+	// Send a packet supplied by the client (packed 7-in-8).
+
+	uint8_t packet[RADIO_MAX_PACKET];
+	int len = unpackData(&inbuf[sysexStart + 1], argBytes, packet, sizeof(packet));
+	radioQueuePacket(packet, len);
+}
+
+static void radioSetEnable(int isOn) {
+	radioEnabled = isOn;
+	radioTxCount = 0;
+	radioBatchCount = 0;
+	radioEnable(isOn);
+	if (isOn) radioConfigure(radioGroup, radioPower, radioChannel);
+}
+
+static void radioSetting(int sysexStart, int argBytes) {
+	if (argBytes < 1) return;
+	int arg = inbuf[sysexStart + 1];
+	switch (inbuf[sysexStart]) {
+	case MB_EXT_RADIO_ENABLE:
+		radioSetEnable(arg);
+		return;
+	case MB_EXT_RADIO_GROUP:
+		if (argBytes > 1) arg |= inbuf[sysexStart + 2] << 7;
+		radioGroup = arg;
 		break;
-	case MB_DISPLAY_ENABLE:
-		enableDisplay(sysexStart, argBytes);
+	case MB_EXT_RADIO_POWER:
+		radioPower = (arg > 7) ? 7 : arg;
 		break;
-	case ANALOG_MAPPING_QUERY:
-		reportAnalogMapping();
+	case MB_EXT_RADIO_CHANNEL:
+		radioChannel = (arg > 83) ? 83 : arg;
+		break;
+	case MB_EXT_RADIO_BATCH_INTERVAL:
+		if (argBytes > 1) arg |= inbuf[sysexStart + 2] << 7;
+		radioBatchInterval = arg;
+		return;
+	}
+	if (radioEnabled) radioConfigure(radioGroup, radioPower, radioChannel);
+}
+
+static void reportRadioStats() {
+	send3Bytes(SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_RADIO_STATS);
+	send32Bits(radioPacketsReceived);
+	send32Bits(radioPacketsSent);
+	send32Bits(radioSendsDropped);
+	send32Bits(radioDropped());
+	sendByte(SYSEX_END);
+}
+
+// Accelerometer Commands
+
+static void reportAccelerometerConfig() {
+	int period = accelerometer.getPeriod();
+	send3Bytes(SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_ACCEL_CONFIG);
+	send3Bytes(accelerometer.getRange(), period & 0x7F, (period >> 7) & 0x7F);
+	sendByte(SYSEX_END);
+}
+
+static void setAccelerometerConfig(int sysexStart, int argBytes) {
+	// Set the accelerometer range (g) and sample period (msecs, two data bytes). A value of
+	// zero (or a missing argument) leaves that setting unchanged. The accelerometer driver
+	// picks the nearest range and period the sensor supports; reply with the actual values.
+
+	int range = (argBytes >= 1) ? inbuf[sysexStart + 1] : 0;
+	int period = (argBytes >= 3) ? (inbuf[sysexStart + 2] | (inbuf[sysexStart + 3] << 7)) : 0;
+	if (range) accelerometer.setRange(range);
+	if (period) accelerometer.setPeriod(period);
+	accelPeriodMicros = 1000 * accelerometer.getPeriod();
+	reportAccelerometerConfig();
+}
+
+static void setAccelerometerStreaming(int sysexStart, int argBytes) {
+	// Start streaming every accelerometer sample in bursts of the given number of samples
+	// (1-16), or stop if it is zero.
+
+	if (argBytes < 1) return;
+	int burstSize = inbuf[sysexStart + 1];
+	if (burstSize > ACCEL_MAX_BURST) burstSize = ACCEL_MAX_BURST;
+	accelBurstSize = burstSize;
+	accelBurstCount = 0;
+	accelMissed = 0;
+	accelPeriodMicros = 1000 * accelerometer.getPeriod();
+	accelNextSample = nowMicros();
+}
+
+// Waveform Commands
+
+#define WAVE_MAX_RATE 10000
+#define DEFAULT_PWM_PERIOD 20000 // usecs
+
+static void stopWaveform() {
+	if (!waveRate) return;
+	waveTimerStop();
+	waveRate = 0;
+	if (PWM == firmataPinMode[wavePin]) io.pin[wavePin].setAnalogPeriodUs(DEFAULT_PWM_PERIOD);
+}
+
+static void setWaveformData(int sysexStart, int argBytes) {
+	// Store packed 16-bit PWM values (0-1023, little-endian) in the waveform table, starting
+	// at the given offset. Offset zero starts a new table. Large tables take several messages.
+	// Playback is stopped first, so the timer interrupt never reads a partly written table.
+
+	if (argBytes < 2) return;
+	stopWaveform();
+	int offset = inbuf[sysexStart + 1] | (inbuf[sysexStart + 2] << 7);
+	if (offset > waveLength) return; // a message was lost
+	uint16_t *dst = &waveTable[offset];
+	int count = unpackData(&inbuf[sysexStart + 3], argBytes - 2, (uint8_t *) dst, 2 * (WAVE_MAX_SAMPLES - offset)) / 2;
+	for (int i = 0; i < count; i++) {
+		if (dst[i] > 1023) dst[i] = 1023;
+	}
+	waveLength = offset + count;
+	if (wavePosition >= waveLength) wavePosition = 0;
+}
+
+static void waveTick() {
+	// Called from the timer interrupt once per sample period: output the next sample, or set
+	// waveDone a period after the last one. Does nothing if the pin was changed to another
+	// mode, since the DAL would allocate a PWM channel here. stepWaveform() does the rest.
+
+	if (waveDone || (PWM != firmataPinMode[wavePin])) return;
+	if (!waveForever && (0 == waveRemaining)) {
+		waveDone = true;
+		return;
+	}
+	uint16_t value = waveTable[wavePosition];
+	firmataPinState[wavePin] = value;
+	io.pin[wavePin].setAnalogValue(value);
+	int next = wavePosition + 1;
+	wavePosition = (next < waveLength) ? next : 0;
+	if (!waveForever) waveRemaining = waveRemaining - 1;
+}
+
+static void playWaveform(int sysexStart, int argBytes) {
+	// Play the waveform table on a pin (switching it to PWM mode) at the given rate, the given
+	// number of times (zero repeats until stopped). A rate of zero stops playback. The PWM
+	// period is shortened to the sample period, so each sample lasts at least one PWM cycle.
+
+	if (argBytes < 4) return;
+	int pin = inbuf[sysexStart + 1];
+	if ((pin < 0) || (pin >= PIN_COUNT)) return;
+	uint32_t rate = inbuf[sysexStart + 2] | (inbuf[sysexStart + 3] << 7) | (inbuf[sysexStart + 4] << 14);
+	int loops = (argBytes >= 6) ? (inbuf[sysexStart + 5] | (inbuf[sysexStart + 6] << 7)) : 0;
+	stopWaveform();
+	if (!rate || !waveLength) return;
+	if (PWM != firmataPinMode[pin]) setPinMode(pin, PWM);
+	if (PWM != firmataPinMode[pin]) return; // pin not available
+
+	if (rate > WAVE_MAX_RATE) rate = WAVE_MAX_RATE;
+	int pwmPeriod = 1000000 / rate;
+	if (pwmPeriod > DEFAULT_PWM_PERIOD) pwmPeriod = DEFAULT_PWM_PERIOD;
+	io.pin[pin].setAnalogPeriodUs(pwmPeriod);
+	wavePin = pin;
+	waveRate = rate;
+	wavePosition = 0;
+	waveForever = (0 == loops);
+	waveRemaining = loops * waveLength;
+	waveDone = false;
+	waveTick(); // the first sample is written here, where the PWM channel can be allocated
+	waveTimerStart(1000000 / rate, waveTick);
+}
+
+// Main Loop Statistics
+
+static void reportLoopStats() {
+	// Report the main loop statistics since the last report: loop iterations, sleeps,
+	// usecs asleep, usecs elapsed, and the maximum and mean wake-up latency (usecs from
+	// a sampling deadline to the start of the loop iteration that handles it).
+
+	uint32_t t = nowMicros();
+	send3Bytes(SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_LOOP_STATS);
+	send32Bits(loopIterations);
+	send32Bits(loopSleeps);
+	send32Bits(loopMicrosAsleep);
+	send32Bits(t - loopStatsStart);
+	send32Bits(loopLatencyMax);
+	send32Bits(loopLatencyCount ? (loopLatencySum / loopLatencyCount) : 0);
+	sendByte(SYSEX_END);
+
+	loopIterations = loopSleeps = loopMicrosAsleep = 0;
+	loopLatencyMax = loopLatencySum = loopLatencyCount = 0;
+	loopStatsStart = t;
+}
+
+// Microphone Commands
+
+static void setMicrophoneMode(int sysexStart, int argBytes) {
+	// Start or stop microphone capture. Arguments: mode, sample rate (two data bytes), and
+	// (for MIC_LEVEL) msecs per level report (two data bytes). Reply with the mode started,
+	// which is MIC_OFF if the board has no microphone.
+
+	if (argBytes < 1) return;
+	int mode = inbuf[sysexStart + 1];
+	int rate = (argBytes >= 3) ? (inbuf[sysexStart + 2] | (inbuf[sysexStart + 3] << 7)) : 8000;
+	int windowMSecs = (argBytes >= 5) ? (inbuf[sysexStart + 4] | (inbuf[sysexStart + 5] << 7)) : 50;
+	if (rate < 1000) rate = 1000;
+	if (rate > 16000) rate = 16000;
+	if (windowMSecs < 1) windowMSecs = 1;
+
+	micStop();
+	micMode = MIC_OFF;
+	if (((MIC_AUDIO == mode) || (MIC_LEVEL == mode)) && micStart(rate)) {
+		micMode = mode;
+		micSampleRate = rate;
+		micLevelWindow = (rate * windowMSecs) / 1000;
+		if (micLevelWindow < 1) micLevelWindow = 1;
+		micBlockCount = 0;
+		micDC = 0;
+		micLevelSum = 0;
+		micLevelCount = 0;
+		adpcmPredictor = 0;
+		adpcmIndex = 0;
+		micReportedOverruns = micOverruns();
+	}
+	send3Bytes(SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_MICROPHONE);
+	send2Bytes(micMode, SYSEX_END);
+}
+
+// Scheduler Commands
+
+static FirmataTask *findTask(int id) {
+	for (int i = 0; i < taskCount; i++) {
+		if (id == tasks[i].id) return &tasks[i];
+	}
+	return NULL;
+}
+
+static void sendTaskState(int replyCmd, FirmataTask *task) {
+	// Send the task's id, followed (if the task exists) by its packed state and commands:
+	// run time (msecs, 4 bytes), length (2 bytes), position (2 bytes), and the commands
+	// added so far. Multi-byte values are little-endian.
+
+	send3Bytes(SYSEX_START, SCHEDULER_DATA, replyCmd);
+	sendByte(task ? task->id : 0);
+	if (task) {
+		uint8_t state[8];
+		memcpy(&state[0], &task->runTime, 4);
+		memcpy(&state[4], &task->length, 2);
+		memcpy(&state[6], &task->position, 2);
+
+		// Packing seven bytes at a time gives the same encoding as packing them all at
+		// once. A large task doesn't fit in the transmit buffer, so wait for room as needed.
+		uint8_t group[7];
+		int n = 0;
+		for (int i = 0; i < 8 + task->filled; i++) {
+			group[n++] = (i < 8) ? state[i] : taskMemory[task->offset + i - 8];
+			if (7 == n) {
+				while (serial.txBufferedSize() > 200) __WFE();
+				sendPackedData(group, n);
+				n = 0;
+			}
+		}
+		if (n) sendPackedData(group, n);
+	}
+	sendByte(SYSEX_END);
+}
+
+static void createTask(int id, int length) {
+	if (findTask(id) || (taskCount >= MAX_TASKS) || (taskMemoryUsed + length > TASK_MEMORY)) {
+		FirmataTask failed = { (uint8_t) id, false, 0, (uint16_t) length, 0, 0, 0 };
+		sendTaskState(ERROR_TASK_REPLY, &failed);
+		return;
+	}
+	FirmataTask *task = &tasks[taskCount++];
+	memset(task, 0, sizeof(FirmataTask));
+	task->id = id;
+	task->offset = taskMemoryUsed;
+	task->length = length;
+	taskMemoryUsed += length;
+}
+
+static void deleteTask(int id) {
+	// Remove the task and close the gap it leaves in taskMemory.
+
+	FirmataTask *task = findTask(id);
+	if (!task) return;
+	int offset = task->offset;
+	int length = task->length;
+	memmove(&taskMemory[offset], &taskMemory[offset + length], taskMemoryUsed - (offset + length));
+	taskMemoryUsed -= length;
+	int index = task - tasks;
+	memmove(&tasks[index], &tasks[index + 1], (taskCount - (index + 1)) * sizeof(FirmataTask));
+	taskCount--;
+	for (int i = index; i < taskCount; i++) tasks[i].offset -= length;
+}
+
+static void addToTask(int id, int sysexStart, int argBytes) {
+	FirmataTask *task = findTask(id);
+	if (!task) return;
+	if (((argBytes * 7) / 8) > (task->length - task->filled)) { // more than the task's length
+		sendTaskState(ERROR_TASK_REPLY, task);
+		return;
+	}
+	uint8_t *dst = &taskMemory[task->offset + task->filled];
+	task->filled += unpackData(&inbuf[sysexStart], argBytes, dst, task->length - task->filled);
+}
+
+static uint32_t packedMSecs(int sysexStart, int argBytes) {
+	uint8_t msecs[5];
+	int n = unpackData(&inbuf[sysexStart], (argBytes < 5) ? argBytes : 5, msecs, sizeof(msecs));
+	if (n < 4) return 0;
+	return msecs[0] | (msecs[1] << 8) | (msecs[2] << 16) | ((uint32_t) msecs[3] << 24);
+}
+
+static void schedulerCommand(int sysexStart, int argBytes) {
+	// Handle a SCHEDULER_DATA command. Commands that add or remove task memory are ignored
+	// within a running task; DELAY_FIRMATA_TASK is only meaningful there.
+
+	if (argBytes < 1) return;
+	int cmd = inbuf[sysexStart + 1];
+	int id = (argBytes > 1) ? inbuf[sysexStart + 2] : 0;
+	int movesMemory = (CREATE_FIRMATA_TASK == cmd) || (DELETE_FIRMATA_TASK == cmd) || (ADD_TO_FIRMATA_TASK == cmd);
+	if (runningTask && movesMemory) return;
+
+	FirmataTask *task;
+	switch (cmd) {
+	case CREATE_FIRMATA_TASK:
+		if (argBytes >= 4) createTask(id, inbuf[sysexStart + 3] | (inbuf[sysexStart + 4] << 7));
+		break;
+	case DELETE_FIRMATA_TASK:
+		deleteTask(id);
+		break;
+	case ADD_TO_FIRMATA_TASK:
+		if (argBytes > 2) addToTask(id, sysexStart + 3, argBytes - 2);
+		break;
+	case DELAY_FIRMATA_TASK:
+		if (runningTask) {
+			runningTask->runTime += packedMSecs(sysexStart + 2, argBytes - 1);
+			runningTaskDelayed = true;
+		}
+		break;
+	case SCHEDULE_FIRMATA_TASK:
+		task = findTask(id);
+		if (task && (argBytes > 2)) {
+			task->runTime = now() + packedMSecs(sysexStart + 3, argBytes - 2);
+			task->scheduled = true;
+			if (task == runningTask) runningTaskDelayed = true;
+		}
+		break;
+	case QUERY_ALL_FIRMATA_TASKS:
+		send3Bytes(SYSEX_START, SCHEDULER_DATA, QUERY_ALL_TASKS_REPLY);
+		for (int i = 0; i < taskCount; i++) sendByte(tasks[i].id);
+		sendByte(SYSEX_END);
+		break;
+	case QUERY_FIRMATA_TASK:
+		task = findTask(id);
+		if (task) {
+			sendTaskState(QUERY_TASK_REPLY, task);
+		} else {
+			send3Bytes(SYSEX_START, SCHEDULER_DATA, QUERY_TASK_REPLY);
+			send2Bytes(id, SYSEX_END);
+		}
+		break;
+	case RESET_FIRMATA_TASKS:
+		resetTasks();
+		break;
+	}
+}
+
+// Saved Configuration
+
+// The pin modes, digital outputs, streamed channels and ports, sampling interval, heading mode,
+// and display state can be saved in flash. initFirmata() restores them, so the board starts streaming as
+// soon as it boots. The record must fit in a 32-byte storage value.
+
+#define CONFIG_KEY "firmata"
+#define CONFIG_VERSION 1
+#define CONFIG_SIZE 21
+
+static void encodeConfig(uint8_t *cfg) {
+	memset(cfg, 0, CONFIG_SIZE);
+	cfg[0] = CONFIG_VERSION;
+	cfg[1] = samplingInterval & 0xFF;
+	cfg[2] = (samplingInterval >> 8) & 0xFF;
+	cfg[3] = (displayEnabled ? 1 : 0) | (lightSensorEnabled ? 2 : 0) | (sendSampleTimestamps ? 4 : 0) |
+		(headingMode ? 8 : 0);
+	for (int i = 0; i < 16; i++) {
+		if (isStreamingChannel[i]) cfg[4 + (i / 8)] |= 1 << (i % 8);
+	}
+	for (int i = 0; i < 8; i++) {
+		if (isStreamingPort[i]) cfg[6] |= 1 << i;
+	}
+	for (int pin = 0; pin < PIN_COUNT; pin++) {
+		if ((DIGITAL_OUTPUT == firmataPinMode[pin]) && (1 == firmataPinState[pin])) {
+			cfg[7 + (pin / 8)] |= 1 << (pin % 8);
+		}
+		cfg[10 + (pin / 2)] |= (firmataPinMode[pin] & 0x0F) << (4 * (pin % 2));
+	}
+}
+
+static void applyConfig(const uint8_t *cfg) {
+	// Restore a saved configuration. The display state is restored first, since it
+	// determines which pins are available.
+
+	setDisplayEnable(cfg[3] & 1);
+	lightSensorEnabled = (cfg[3] & 2) != 0;
+	sendSampleTimestamps = (cfg[3] & 4) != 0;
+	headingMode = (cfg[3] & 8) != 0;
+	setSamplingInterval(cfg[1] | (cfg[2] << 8));
+	for (int pin = 0; pin < PIN_COUNT; pin++) {
+		int mode = (cfg[10 + (pin / 2)] >> (4 * (pin % 2))) & 0x0F;
+		if (UNKNOWN_PIN_MODE == mode) continue;
+		setPinMode(pin, mode);
+		if (cfg[7 + (pin / 8)] & (1 << (pin % 8))) setDigitalPin(pin, 1);
+	}
+	for (int i = 0; i < 16; i++) {
+		if (cfg[4 + (i / 8)] & (1 << (i % 8))) streamAnalogChannel(i, true);
+	}
+	for (int i = 0; i < 8; i++) {
+		if (cfg[6] & (1 << i)) streamDigitalPort(i, true);
+	}
+}
+
+static void restoreConfig() {
+	KeyValuePair *pair = storage.get(CONFIG_KEY);
+	if (!pair) return;
+	if (CONFIG_VERSION == pair->value[0]) applyConfig(pair->value);
+	delete pair;
+}
+
+static void saveConfig(int sysexStart, int argBytes) {
+	// Save the current configuration (argument 1) or erase the saved one (argument 0).
+	// Reply with the same command and 1 if successful, 0 if not.
+
+	if (argBytes < 1) return;
+	int result = 0;
+	if (inbuf[sysexStart + 1]) {
+		uint8_t cfg[CONFIG_SIZE];
+		encodeConfig(cfg);
+		result = storage.put(CONFIG_KEY, cfg, sizeof(cfg));
+	} else {
+		storage.remove(CONFIG_KEY); // fails harmlessly if nothing was saved
+	}
+	send3Bytes(SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_SAVE_CONFIG);
+	send2Bytes((0 == result) ? 1 : 0, SYSEX_END);
+}
+
+// Bulk Transfer Commands
+
+static uint16_t crc16(uint16_t crc, const uint8_t *data, int count) {
+	// Update a CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF) with the given data.
+
+	for (int i = 0; i < count; i++) {
+		crc ^= data[i] << 8;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+		}
+	}
+	return crc;
+}
+
+static int unpackCheckedData(int index, int srcCount, const uint8_t *header, int headerCount, uint8_t *dst, int dstSize) {
+	// Unpack data from inbuf followed by its CRC, which covers the header and then the data.
+	// dst must have room for the CRC after dstSize bytes of data. Return the number of data
+	// bytes, or -1 if the check fails.
+
+	if (srcCount < 0) return -1;
+	int count = unpackData(&inbuf[index], srcCount, dst, dstSize + 2) - 2;
+	if (count < 0) return -1;
+	uint16_t crc = crc16(crc16(0xFFFF, header, headerCount), dst, count);
+	return (crc == (dst[count] | (dst[count + 1] << 8))) ? count : -1;
+}
+
+static void sendBulkAck(int id) {
+	// Report the next chunk needed and which of the chunks after it are held, so the client
+	// resends only the chunks that were lost or corrupted.
+
+	uint8_t ack[5] = { (uint8_t) id, 0, 0, 0, BULK_STATUS_UNKNOWN };
+	if (id == bulkID) {
+		ack[1] = bulkNextSeq & 0x7F;
+		ack[2] = bulkNextSeq >> 7;
+		for (int i = 0; i < BULK_WINDOW; i++) {
+			if (bulkSlotLength[(bulkNextSeq + i) % BULK_WINDOW]) ack[3] |= 1 << i;
+		}
+		ack[4] = bulkStatus;
+	}
+	uint16_t crc = crc16(0xFFFF, ack, sizeof(ack));
+	send3Bytes(SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_BULK_ACK);
+	sendBytes(ack, sizeof(ack));
+	send3Bytes(crc & 0x7F, (crc >> 7) & 0x7F, crc >> 14);
+	sendByte(SYSEX_END);
+}
+
+static void bulkStart(int sysexStart, int argBytes) {
+	// Start receiving a bulk transfer. A repeated start for the transfer being received
+	// (e.g. because its acknowledgement was lost) is just acknowledged again.
+
+	if (argBytes < 1) return;
+	uint8_t id = inbuf[sysexStart + 1];
+	uint8_t data[4 + 2];
+	if (unpackCheckedData(sysexStart + 2, argBytes - 1, &id, 1, data, 4) != 4) return; // corrupted
+	uint32_t length = data[0] | (data[1] << 8) | (data[2] << 16) | (data[3] << 24);
+	if ((id != bulkID) || (bulkStatus != BULK_STATUS_RECEIVING) || (length != bulkLength)) {
+		bulkID = id;
+		bulkStatus = (length > 0) ? BULK_STATUS_RECEIVING : BULK_STATUS_COMPLETE;
+		bulkLength = length;
+		bulkReceived = 0;
+		bulkNextSeq = 0;
+		memset(bulkSlotLength, 0, sizeof(bulkSlotLength));
+		bulkBufCount = 0;
+	}
+	sendBulkAck(id);
+}
+
+static void bulkChunk(int sysexStart, int argBytes) {
+	// Hold a chunk that passes its CRC check in its window slot. Chunks already received
+	// or beyond the window are ignored. stepBulk() acknowledges the chunks received.
+
+	if (argBytes < 3) return;
+	uint8_t header[3] = { inbuf[sysexStart + 1], inbuf[sysexStart + 2], inbuf[sysexStart + 3] };
+	if ((header[0] != bulkID) || (bulkStatus != BULK_STATUS_RECEIVING)) {
+		sendBulkAck(header[0]);
+		return;
+	}
+	bulkAckPending = true;
+	int seq = header[1] | (header[2] << 7);
+	if (((seq - bulkNextSeq) & BULK_SEQ_MASK) >= BULK_WINDOW) return;
+	uint8_t data[BULK_CHUNK_SIZE + 2];
+	int count = unpackCheckedData(sysexStart + 4, argBytes - 3, header, 3, data, BULK_CHUNK_SIZE);
+	if (count <= 0) return; // corrupted
+	int slot = seq % BULK_WINDOW;
+	memcpy(bulkSlots[slot], data, count);
+	bulkSlotLength[slot] = count;
+}
+
+// MIDI parsing
+
+static void dispatchExtendedSysexCommand(int sysexStart, int argBytes) {
+	// Dispatch an extended sysex command. sysexStart is the index of the extended command byte.
+
+	if (argBytes < 0) return;
+	uint8_t extendedCmd = inbuf[sysexStart];
+	switch (extendedCmd) {
+	case MB_EXT_SCROLL_STRING_PACKED:
+		scrollStringPacked(sysexStart, argBytes);
+		break;
+	case MB_EXT_REPORT_FIRMWARE_PACKED:
+		reportFirmwareVersionPacked();
+		break;
+	case MB_EXT_BOARD_TIME:
+		reportBoardTime(sysexStart, argBytes);
+		break;
+	case MB_EXT_RADIO_ENABLE:
+	case MB_EXT_RADIO_GROUP:
+	case MB_EXT_RADIO_POWER:
+	case MB_EXT_RADIO_CHANNEL:
+	case MB_EXT_RADIO_BATCH_INTERVAL:
+		radioSetting(sysexStart, argBytes);
+		break;
+	case MB_EXT_RADIO_SEND_STRING:
+	case MB_EXT_RADIO_SEND_INTEGER:
+	case MB_EXT_RADIO_SEND_FLOAT:
+	case MB_EXT_RADIO_SEND_PAIR_INTEGER:
+	case MB_EXT_RADIO_SEND_PAIR_FLOAT:
+		radioSendValue(sysexStart, argBytes);
+		break;
+	case MB_EXT_RADIO_SEND_PACKET:
+		radioSendPacket(sysexStart, argBytes);
+		break;
+	case MB_EXT_RADIO_STATS:
+		reportRadioStats();
+		break;
+	case MB_EXT_SAMPLE_TIMESTAMPS:
+		setSampleTimestamps(sysexStart, argBytes);
+		break;
+	case MB_EXT_SAVE_CONFIG:
+		saveConfig(sysexStart, argBytes);
+		break;
+	case MB_EXT_HEADING_MODE:
+		if (argBytes > 0) headingMode = (inbuf[sysexStart + 1] != 0);
+		break;
+	case MB_EXT_MICROPHONE:
+		setMicrophoneMode(sysexStart, argBytes);
+		break;
+	case MB_EXT_ACCEL_CONFIG:
+		setAccelerometerConfig(sysexStart, argBytes);
+		break;
+	case MB_EXT_ACCEL_STREAM:
+		setAccelerometerStreaming(sysexStart, argBytes);
+		break;
+	case MB_EXT_LOOP_STATS:
+		reportLoopStats();
+		break;
+	case MB_EXT_WAVEFORM_DATA:
+		setWaveformData(sysexStart, argBytes);
+		break;
+	case MB_EXT_WAVEFORM_PLAY:
+		playWaveform(sysexStart, argBytes);
+		break;
+	case MB_EXT_ANALOG_WRITE_BATCH:
+		analogWriteBatch(sysexStart, argBytes);
+		break;
+	case MB_EXT_BULK_START:
+		if (!bulkRunning) bulkStart(sysexStart, argBytes);
+		break;
+	case MB_EXT_BULK_CHUNK:
+		if (!bulkRunning) bulkChunk(sysexStart, argBytes);
+		break;
+	}
+}
+
+static void dispatchSysexCommand(int sysexStart, int argBytes) {
+	uint8_t sysexCmd = inbuf[sysexStart];
+	switch (sysexCmd) {
+	case MB_DISPLAY_CLEAR:
+		display_clear();
+		break;
+	case MB_DISPLAY_SHOW:
+		display_show(sysexStart, argBytes);
+		break;
+	case MB_DISPLAY_PLOT:
+		display_plot(sysexStart, argBytes);
+		break;
+	case MB_SCROLL_STRING:
+		scrollString(sysexStart, argBytes);
+		break;
+	case MB_SCROLL_INTEGER:
+		scrollNumber(sysexStart, argBytes);
+		break;
+	case MB_SET_TOUCH_MODE:
+		setTouchMode(sysexStart, argBytes);
+		break;
+	case MB_DISPLAY_ENABLE:
+		enableDisplay(sysexStart, argBytes);
+		break;
+	case ANALOG_MAPPING_QUERY:
+		reportAnalogMapping();
 		break;
 	case CAPABILITY_QUERY:
 		reportPinCapabilities();
@@ -686,6 +2051,9 @@ static void dispatchSysexCommand(int sysexStart, int argBytes) {
 	case EXTENDED_ANALOG_WRITE:
 		extendedAnalogWrite(sysexStart, argBytes);
 		break;
+	case SERVO_CONFIG:
+		servoConfig(sysexStart, argBytes);
+		break;
 	case REPORT_FIRMWARE:
 		reportFirmwareVersion();
 		break;
@@ -695,6 +2063,12 @@ static void dispatchSysexCommand(int sysexStart, int argBytes) {
 	case MB_COMPASS_CALIBRATE:
 		calibrateCompass();
 		break;
+	case SCHEDULER_DATA:
+		schedulerCommand(sysexStart, argBytes);
+		break;
+	case MB_EXTENDED_SYSEX:
+		dispatchExtendedSysexCommand(sysexStart + 1, argBytes - 1);
+		break;
 	}
 }
 
@@ -806,57 +2180,465 @@ static void streamDigitalPins() {
 	}
 }
 
+// Orientation
+
+// The accelerometer and compass are read at most once per batch of samples, so all channels
+// in a batch (including the derived orientation channels 6-7 and the heading) come from the
+// same snapshot. Pitch, roll, and tilt-compensated heading use the DAL's formulas in the
+// north-east-down frame, computed with integer math in tenths of a degree.
+
+struct Vector3 { int32_t x, y, z; };
+struct Orientation { int pitch, roll, heading; }; // degrees
+
+static Vector3 accelerometerSnapshot;
+static Vector3 compassSnapshot;
+static Orientation orientationSnapshot;
+static uint8_t snapshotValid = 0; // bit mask of the snapshots taken in this batch
+
+#define ACCELEROMETER_SNAPSHOT	1
+#define COMPASS_SNAPSHOT		2
+#define ORIENTATION_SNAPSHOT	4
+
+// sin(0..90 degrees) * 16384
+static constexpr int16_t sineTable[91] = {
+	0, 286, 572, 857, 1143, 1428, 1713, 1997, 2280, 2563,
+	2845, 3126, 3406, 3686, 3964, 4240, 4516, 4790, 5063, 5334,
+	5604, 5872, 6138, 6402, 6664, 6924, 7182, 7438, 7692, 7943,
+	8192, 8438, 8682, 8923, 9162, 9397, 9630, 9860, 10087, 10311,
+	10531, 10749, 10963, 11174, 11381, 11585, 11786, 11982, 12176, 12365,
+	12551, 12733, 12911, 13085, 13255, 13421, 13583, 13741, 13894, 14044,
+	14189, 14330, 14466, 14598, 14726, 14849, 14968, 15082, 15191, 15296,
+	15396, 15491, 15582, 15668, 15749, 15826, 15897, 15964, 16026, 16083,
+	16135, 16182, 16225, 16262, 16294, 16322, 16344, 16362, 16374, 16382,
+	16384
+};
+
+static int32_t sinTenths(int angle) {
+	// Return the sine of the given angle (tenths of a degree) times 16384.
+
+	angle %= 3600;
+	if (angle < 0) angle += 3600;
+	int sign = 1;
+	if (angle >= 1800) {
+		angle -= 1800;
+		sign = -1;
+	}
+	if (angle > 900) angle = 1800 - angle;
+	int i = angle / 10;
+	int32_t result = sineTable[i];
+	if (angle % 10) result += ((sineTable[i + 1] - result) * (angle % 10)) / 10;
+	return sign * result;
+}
+
+static int32_t cosTenths(int angle) { return sinTenths(angle + 900); }
+
+static int atan2Tenths(int64_t y, int64_t x) {
+	// Return atan2(y, x) in tenths of a degree (-1800 to 1800). Uses the approximation
+	// atan(z) = 45z + z(1 - z)(14.02 + 3.8z) degrees for 0 <= z <= 1 (error under 0.15 degrees).
+
+	if ((0 == x) && (0 == y)) return 0;
+	int64_t ax = (x < 0) ? -x : x;
+	int64_t ay = (y < 0) ? -y : y;
+	int64_t z = (ay <= ax) ? ((ay << 15) / ax) : ((ax << 15) / ay); // 0..32768
+	int64_t w = (z * (32768 - z)) >> 15; // z(1 - z)
+	int angle = (int) (((4500 * z) + ((w * ((1402 * 32768) + (380 * z))) >> 15) + 163840) / 327680);
+	if (ay > ax) angle = 900 - angle;
+	if (x < 0) angle = 1800 - angle;
+	return (y < 0) ? -angle : angle;
+}
+
+static int roundTenths(int tenths) {
+	return (tenths >= 0) ? ((tenths + 5) / 10) : -((5 - tenths) / 10);
+}
+
+static const Vector3 &accelerometerSample() {
+	if (!(snapshotValid & ACCELEROMETER_SNAPSHOT)) {
+		accelerometerSnapshot.x = accelerometer.getX();
+		accelerometerSnapshot.y = accelerometer.getY();
+		accelerometerSnapshot.z = accelerometer.getZ();
+		snapshotValid |= ACCELEROMETER_SNAPSHOT;
+	}
+	return accelerometerSnapshot;
+}
+
+static const Vector3 &compassSample() {
+	if (!(snapshotValid & COMPASS_SNAPSHOT)) {
+		compassSnapshot.x = compass.getX();
+		compassSnapshot.y = compass.getY();
+		compassSnapshot.z = compass.getZ();
+		snapshotValid |= COMPASS_SNAPSHOT;
+	}
+	return compassSnapshot;
+}
+
+static const Orientation &orientationSample() {
+	if (snapshotValid & ORIENTATION_SNAPSHOT) return orientationSnapshot;
+
+	// convert from the DAL's default (simple cartesian) axes to north-east-down
+	const Vector3 &a = accelerometerSample();
+	int64_t ax = -a.y, ay = a.x, az = -a.z;
+
+	int roll = atan2Tenths(ay, az);
+	int64_t sinRoll = sinTenths(roll), cosRoll = cosTenths(roll);
+	int64_t d = ((ay * sinRoll) + (az * cosRoll)) >> 14;
+	int64_t n = -ax;
+	if (d < 0) { // keep pitch in -90..90, like atan(n / d)
+		d = -d;
+		n = -n;
+	}
+	int pitch = atan2Tenths(n, d);
+
+	int heading = 0;
+	if (headingMode) {
+		const Vector3 &m = compassSample();
+		int64_t mx = -m.y, my = m.x, mz = -m.z;
+		int64_t sinPitch = sinTenths(pitch), cosPitch = cosTenths(pitch);
+		int64_t bx = (mx * cosPitch) + ((((my * sinRoll) + (mz * cosRoll)) * sinPitch) >> 14);
+		int64_t by = (mz * sinRoll) - (my * cosRoll);
+		heading = roundTenths(atan2Tenths(bx, by));
+		if (heading < 0) heading += 360;
+		if (heading >= 360) heading -= 360;
+	}
+
+	orientationSnapshot.pitch = roundTenths(pitch);
+	orientationSnapshot.roll = roundTenths(roll);
+	orientationSnapshot.heading = heading;
+	snapshotValid |= ORIENTATION_SNAPSHOT;
+	return orientationSnapshot;
+}
+
+// Each analog channel has a reader function. Channels 0-5 read pins; the rest read sensors.
+
+static int readPinChannel(int chan) {
+	int pin = analogChannelPin[chan];
+	if (!pinAvailable(pin) || (ANALOG_INPUT != firmataPinMode[pin])) return 0;
+	return io.pin[pin].getAnalogValue();
+}
+
+static int readAccelerometerX(int chan) { return accelerometerSample().x; }
+static int readAccelerometerY(int chan) { return accelerometerSample().y; }
+static int readAccelerometerZ(int chan) { return accelerometerSample().z; }
+static int readPitch(int chan) { return orientationSample().pitch; }
+static int readRoll(int chan) { return orientationSample().roll; }
+
+static int readLightLevel(int chan) {
+	// When enabled, the light sensor monopolizes the A/D converter, preventing correct
+	// analog values from being read from input pins. Thus, the light sensor is disabled
+	// at startup and must be enabled by setting channel 11 to analog input mode. It can
+	// be disabled again by invoking the setDisplayEnable command. (Any change to the
+	// display enabled state disables the light sensor until it explicitly re-enabled.)
+
+	return (displayEnabled && lightSensorEnabled) ? display.readLightLevel() : 0;
+}
+
+static int readTemperature(int chan) { return thermometer.getTemperature(); }
+static int readCompassX(int chan) { return headingMode ? orientationSample().heading : compassSample().x >> 5; }
+static int readCompassY(int chan) { return compassSample().y >> 5; }
+static int readCompassZ(int chan) { return compassSample().z >> 5; }
+
+typedef int (*ChannelReader)(int chan);
+
+static const ChannelReader channelReaders[16] = {
+	readPinChannel, readPinChannel, readPinChannel, // 0-2: P0-P2
+	readPinChannel, readPinChannel, readPinChannel, // 3-5: P3, P4, P10
+	readPitch, readRoll, // 6-7
+	readAccelerometerX, readAccelerometerY, readAccelerometerZ, // 8-10
+	readLightLevel, // 11
+	readTemperature, // 12
+	readCompassX, readCompassY, readCompassZ // 13-15 (13 is the heading in heading mode)
+};
+
 static int analogChannelValue(uint8_t chan) {
 	// Return the value for the given analog channel (0-15).
 	// For the micro:bit, sensors such as the accelerometer are mapped to analog channels.
 
 	if (chan > 15) return 0;
-	if (chan < 6) {
-		if (displayEnabled && (chan > 2)) return 0; // display uses most pins except 0-2
-		int pin = (5 == chan) ? 10 : chan; // channels 0-4 are pins 0-4; channel 5 is pin 10
-		if (ANALOG_INPUT != firmataPinMode[pin]) return 0;
-		return io.pin[pin].getAnalogValue();
-	}
-	if (6 == chan) return 0;
-	if (7 == chan) return 0;
-	if (8 == chan) return accelerometer.getX(); // accelerometer x
-	if (9 == chan) return accelerometer.getY(); // accelerometer y
-	if (10 == chan) return accelerometer.getZ(); // accelerometer z
-	if (11 == chan) {
-		// When enabled, the light sensor monopolizes the A/D converter, preventing correct
-		// analog values from being read from input pins. Thus, the light sensor is disabled
-		// at startup and must be enabled by setting channel 11 to analog input mode. It can
-		// be disabled again by invoking the setDisplayEnable command. (Any change to the
-		// display enabled state disables the light sensor until it explicitly re-enabled.)
-
-		return (displayEnabled && lightSensorEnabled) ? display.readLightLevel() : 0;
-	}
-	if (12 == chan) return thermometer.getTemperature(); // temperature sensor
-	if (13 == chan) return compass.getX() >> 5; // compass x
-	if (14 == chan) return compass.getY() >> 5; // compass y
-	if (15 == chan) return compass.getZ() >> 5; // compass z
-
-	return 0;
+	return channelReaders[chan](chan);
 }
 
 static void streamSensors() {
 	// Send updates for all currently streaming sensor channels if samplingInterval msecs
 	// have elapsed since the last updates were sent.
 
-	int elapsed = now() - lastSampleTime;
-	if ((elapsed >= 0) && (elapsed < samplingInterval)) return;
+	int32_t elapsed = nowMicros() - lastSampleTime;
+	if ((elapsed >= 0) && (elapsed < (1000 * samplingInterval))) return;
 
+	uint32_t sampleTime = nowMicros();
+	int needTimestamp = sendSampleTimestamps;
+	snapshotValid = 0; // take new sensor snapshots for this batch
 	for (int chan = 0; chan < 16; chan++) {
 		if (isStreamingChannel[chan]) {
-			if (chan < 6) { // analog pin
-				int pin = (chan == 5) ? 10 : chan;
-				if (firmataPinMode[pin] != ANALOG_INPUT) continue; // pin not in analog mode
+			int pin = analogChannelPin[chan];
+			if ((pin >= 0) && (firmataPinMode[pin] != ANALOG_INPUT)) continue; // pin not in analog mode
+			if (needTimestamp) { // timestamp precedes the first sample of the batch
+				send3Bytes(SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_SAMPLE_TIMESTAMPS);
+				send32Bits(sampleTime);
+				sendByte(SYSEX_END);
+				needTimestamp = false;
 			}
 			int analogValue = analogChannelValue(chan);
 			send3Bytes(ANALOG_UPDATE | chan, analogValue & 0x7F, (analogValue >> 7) & 0x7F);
 		}
 	}
-	lastSampleTime = now();
+	lastSampleTime = nowMicros();
+}
+
+// Accelerometer Bursts
+
+static void putInt16(uint8_t *dst, int n) {
+	dst[0] = n & 0xFF;
+	dst[1] = (n >> 8) & 0xFF;
+}
+
+static void sendAccelerometerBurst() {
+	// Send the collected samples as one packed message. The header is the board time of the
+	// first sample (usecs, 4 bytes), the sample period (msecs, 2 bytes), the sample count,
+	// and the number of samples missed before this burst. It is followed by x, y, and z
+	// (milli-g, 2 bytes each) for each sample. Multi-byte values are little-endian. If
+	// earlier output in this step left too little room in the transmit buffer, wait for it.
+
+	int dataBytes = 8 + (6 * accelBurstCount);
+	waitForPackedRoom(4, dataBytes);
+
+	uint32_t firstSample = accelNextSample - (accelBurstCount * accelPeriodMicros);
+	accelBurst[0] = firstSample & 0xFF;
+	accelBurst[1] = (firstSample >> 8) & 0xFF;
+	accelBurst[2] = (firstSample >> 16) & 0xFF;
+	accelBurst[3] = (firstSample >> 24) & 0xFF;
+	putInt16(&accelBurst[4], accelPeriodMicros / 1000);
+	accelBurst[6] = accelBurstCount;
+	accelBurst[7] = (accelMissed > 255) ? 255 : accelMissed;
+	send3Bytes(SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_ACCEL_BURST);
+	sendPackedData(accelBurst, dataBytes);
+	sendByte(SYSEX_END);
+	accelBurstCount = 0;
+	accelMissed = 0;
+}
+
+static void stepAccelerometer() {
+	// Collect one accelerometer sample when it falls due. The driver reads all three axes in
+	// one I2C transfer when the sensor has a new sample, so sampling at the sensor's own
+	// period captures every sample it produces. Samples missed because the main loop fell
+	// behind are counted rather than made up.
+
+	if (!accelBurstSize) return;
+	int32_t late = nowMicros() - accelNextSample;
+	if (late < 0) return;
+	if ((uint32_t) late >= accelPeriodMicros) {
+		if (accelBurstCount > 0) sendAccelerometerBurst(); // keep the samples in a burst evenly spaced
+		uint32_t skipped = late / accelPeriodMicros;
+		accelMissed += skipped;
+		accelNextSample += skipped * accelPeriodMicros;
+	}
+	uint8_t *sample = &accelBurst[8 + (6 * accelBurstCount)];
+	putInt16(&sample[0], accelerometer.getX());
+	putInt16(&sample[2], accelerometer.getY());
+	putInt16(&sample[4], accelerometer.getZ());
+	accelBurstCount++;
+	accelNextSample += accelPeriodMicros;
+	if (accelBurstCount >= accelBurstSize) sendAccelerometerBurst();
+}
+
+// Waveform Playback
+
+static void stepWaveform() {
+	// The samples are written by waveTick(). Stop the timer when the pin is changed to another
+	// mode, and report the end of playback.
+
+	if (!waveRate) return;
+	if (PWM != firmataPinMode[wavePin]) {
+		waveTimerStop();
+		waveRate = 0;
+		return;
+	}
+	if (!waveDone) return;
+	stopWaveform();
+	send2Bytes(SYSEX_START, MB_REPORT_EVENT);
+	send3Bytes(MB_WAVEFORM_EVENT_ID & 0x7F, (MB_WAVEFORM_EVENT_ID >> 7) & 0x7F, (MB_WAVEFORM_EVENT_ID >> 14) & 0x7F);
+	send3Bytes(MB_WAVEFORM_EVT_DONE, 0, 0);
+	sendByte(SYSEX_END);
+}
+
+// Radio Relay
+
+static void radioFlushBatch() {
+	// Send the batch of received packets. The batch starts with a five byte header (the board
+	// time of the first packet in msecs and the number of packets lost since the last batch),
+	// followed by an entry for each packet: length, RSSI (dBm, negated), msecs since the
+	// first packet (two bytes), and the packet bytes. Multi-byte values are little-endian.
+	// Waits for room after other output in this step (e.g. an accelerometer burst).
+
+	if (0 == radioBatchCount) return;
+	waitForPackedRoom(4, radioBatchCount);
+	uint32_t dropped = radioDropped();
+	int lost = dropped - radioBatchDropped;
+	radioBatch[4] = (lost > 255) ? 255 : lost;
+	radioBatchDropped = dropped;
+
+	send3Bytes(SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_RADIO_PACKETS);
+	sendPackedData(radioBatch, radioBatchCount);
+	sendByte(SYSEX_END);
+	radioBatchCount = 0;
+}
+
+static void stepRadio() {
+	// Send the next queued packet, then collect received packets into the current batch.
+
+	if (!radioEnabled) return;
+
+	if (radioTxCount > 0) {
+		uint8_t *entry = radioTxQueue[radioTxHead];
+		radioSend(&entry[1], entry[0]);
+		radioTxHead = (radioTxHead + 1) % RADIO_TX_QUEUE_SIZE;
+		radioTxCount--;
+		radioPacketsSent++;
+	}
+
+	// Only one batch fits in the serial transmit buffer, so at most one is sent per step.
+	// Packets that don't fit in the batch stay in the radio's queue until the next step.
+	uint8_t packet[RADIO_MAX_PACKET];
+	int rssi;
+	int len;
+	int flushed = false;
+	while (true) {
+		if ((radioBatchCount + 4 + RADIO_MAX_PACKET) > RADIO_BATCH_BYTES) { // the next packet might not fit
+			if (flushed) break;
+			radioFlushBatch();
+			flushed = true;
+		}
+		if ((len = radioReceive(packet, &rssi)) <= 0) break;
+		radioPacketsReceived++;
+		uint32_t t = now();
+		if (0 == radioBatchCount) { // start a new batch
+			radioBatchTime = t;
+			memcpy(radioBatch, &radioBatchTime, 4);
+			radioBatchCount = 5;
+		}
+		int dt = t - radioBatchTime;
+		uint8_t *entry = &radioBatch[radioBatchCount];
+		entry[0] = len;
+		entry[1] = (rssi < 0) ? -rssi : rssi;
+		entry[2] = dt & 0xFF;
+		entry[3] = (dt >> 8) & 0xFF;
+		memcpy(&entry[4], packet, len);
+		radioBatchCount += 4 + len;
+	}
+	if (!flushed && radioBatchCount && ((int32_t) (now() - radioBatchTime) >= radioBatchInterval)) radioFlushBatch();
+}
+
+// Microphone Streaming
+
+static constexpr int16_t adpcmStepTable[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21,
+	23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66,
+	73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209,
+	230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+	724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484,
+	7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350,
+	22385, 24623, 27086, 29794, 32767
+};
+
+static constexpr int8_t adpcmIndexTable[16] = {
+	-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static int adpcmEncode(int sample) {
+	// Return the 4-bit IMA-ADPCM code for the given sample and update the encoder state.
+
+	int step = adpcmStepTable[adpcmIndex];
+	int diff = sample - adpcmPredictor;
+	int code = 0;
+	if (diff < 0) {
+		code = 8;
+		diff = -diff;
+	}
+	int delta = step >> 3;
+	if (diff >= step) { code |= 4; diff -= step; delta += step; }
+	step >>= 1;
+	if (diff >= step) { code |= 2; diff -= step; delta += step; }
+	step >>= 1;
+	if (diff >= step) { code |= 1; delta += step; }
+
+	int predictor = adpcmPredictor + ((code & 8) ? -delta : delta);
+	if (predictor > 32767) predictor = 32767;
+	if (predictor < -32768) predictor = -32768;
+	adpcmPredictor = predictor;
+	adpcmIndex += adpcmIndexTable[code];
+	if (adpcmIndex < 0) adpcmIndex = 0;
+	if (adpcmIndex > 88) adpcmIndex = 88;
+	return code;
+}
+
+static void sendAudioBlock() {
+	// Encode and send micBlock. The packed block starts with the encoder state (predictor,
+	// two bytes little-endian, and step index), so each block can be decoded on its own,
+	// followed by two samples per byte, low nibble first. The top bit of the step index
+	// byte is set if samples were lost before this block. Waits for transmit buffer room.
+
+	uint8_t block[3 + (MIC_BLOCK_SAMPLES / 2)];
+	waitForPackedRoom(5, sizeof(block));
+	uint32_t overruns = micOverruns();
+	block[0] = adpcmPredictor & 0xFF;
+	block[1] = (adpcmPredictor >> 8) & 0xFF;
+	block[2] = adpcmIndex | ((overruns != micReportedOverruns) ? 0x80 : 0);
+	micReportedOverruns = overruns;
+	for (int i = 0; i < MIC_BLOCK_SAMPLES; i += 2) {
+		int low = adpcmEncode(micBlock[i]);
+		int high = adpcmEncode(micBlock[i + 1]);
+		block[3 + (i / 2)] = (high << 4) | low;
+	}
+	send3Bytes(SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_AUDIO_BLOCK);
+	sendByte(micSequence);
+	sendPackedData(block, sizeof(block));
+	sendByte(SYSEX_END);
+	micSequence = (micSequence + 1) & 0x7F;
+}
+
+static void sendSoundLevel() {
+	uint32_t meanSquare = micLevelSum / micLevelCount;
+	uint32_t rms = 0;
+	for (uint32_t bit = 1UL << 30; bit; bit >>= 2) { // integer square root
+		if (meanSquare >= rms + bit) {
+			meanSquare -= rms + bit;
+			rms = (rms >> 1) + bit;
+		} else {
+			rms >>= 1;
+		}
+	}
+	send3Bytes(SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_SOUND_LEVEL);
+	send32Bits(rms);
+	sendByte(SYSEX_END);
+	micLevelSum = 0;
+	micLevelCount = 0;
+}
+
+static void stepMicrophone() {
+	// Process the captured samples. At most two audio blocks are sent per step, so the rest
+	// of the main loop isn't held up; other samples wait for the next step. sendAudioBlock()
+	// waits for room after other output in this step (e.g. a radio batch).
+
+	if (MIC_OFF == micMode) return;
+	int16_t samples[MIC_BLOCK_SAMPLES / 2];
+	int blocksSent = 0;
+	int n;
+	while ((blocksSent < 2) && ((n = micRead(samples, MIC_BLOCK_SAMPLES / 2)) > 0)) {
+		for (int i = 0; i < n; i++) {
+			micDC += ((samples[i] * 256) - micDC) >> 10;
+			int sample = samples[i] - (micDC >> 8);
+			if (MIC_AUDIO == micMode) {
+				micBlock[micBlockCount++] = sample;
+				if (MIC_BLOCK_SAMPLES == micBlockCount) {
+					sendAudioBlock();
+					micBlockCount = 0;
+					blocksSent++;
+				}
+			} else {
+				micLevelSum += (int64_t) sample * sample; // the square can exceed INT_MAX
+				if (++micLevelCount >= micLevelWindow) sendSoundLevel();
+			}
+		}
+	}
 }
 
 // Events
@@ -887,30 +2669,227 @@ static void registerEventListeners() {
 	messageBus.listen(MICROBIT_ID_DISPLAY, MICROBIT_DISPLAY_EVT_ANIMATION_COMPLETE, onEvent);
 }
 
+// Scheduled Tasks
+
+static void runTask(FirmataTask *task) {
+	// Run the task's commands through the same dispatcher as commands from the serial port,
+	// starting where it last stopped, until the task delays itself or ends. A task whose
+	// last command is a delay repeats from its start, so periodic control loops run without
+	// the host. A task that ends without a delay is unscheduled but kept.
+
+	uint8_t *serialInbuf = inbuf;
+	int serialInbufCount = inbufCount;
+	inbuf = &taskMemory[task->offset];
+	inbufCount = task->filled;
+	runningTask = task;
+	runningTaskDelayed = false;
+
+	int position = task->position;
+	int failed = false;
+	while (position < inbufCount) {
+		int cmdStart = findCmdByte(position);
+		if (cmdStart < 0) break; // only data bytes remain
+		int cmdBytes = processCommandAt(cmdStart);
+		if (cmdBytes < 0) { // incomplete command
+			failed = true;
+			break;
+		}
+		position = cmdStart + cmdBytes;
+		if (runningTaskDelayed) break;
+	}
+
+	inbuf = serialInbuf;
+	inbufCount = serialInbufCount;
+	runningTask = NULL;
+
+	if (runningTaskDelayed && !failed) {
+		task->position = (position < task->filled) ? position : 0;
+	} else {
+		task->position = 0;
+		task->scheduled = false;
+		if (failed) sendTaskState(ERROR_TASK_REPLY, task);
+	}
+	if (tasksResetPending) {
+		tasksResetPending = false;
+		resetTasks();
+	}
+}
+
+static void runTasks() {
+	// Run each task that is due. A task runs at most once per pass through the main loop.
+
+	uint32_t t = now(); // called even with no tasks, to keep the DAL msec clock current
+	if (!taskCount) return;
+	for (int i = 0; i < taskCount; i++) {
+		if (tasks[i].scheduled && ((int32_t) (t - tasks[i].runTime) >= 0)) runTask(&tasks[i]);
+	}
+}
+
+// Bulk Transfers
+
+static void stepBulk() {
+	// Append the held chunks that are next in order to bulkBuf and run its complete commands
+	// like a task, keeping any incomplete command for the next chunk. Then acknowledge the
+	// chunks received since the last step.
+
+	if (BULK_STATUS_RECEIVING == bulkStatus) {
+		uint8_t *serialInbuf = inbuf;
+		int serialInbufCount = inbufCount;
+		inbuf = bulkBuf;
+		bulkRunning = true;
+
+		int slot = bulkNextSeq % BULK_WINDOW;
+		while (bulkSlotLength[slot]) {
+			int count = bulkSlotLength[slot];
+			if ((uint32_t) count > (bulkLength - bulkReceived)) count = bulkLength - bulkReceived;
+			memcpy(&bulkBuf[bulkBufCount], bulkSlots[slot], count);
+			bulkBufCount += count;
+			bulkReceived += count;
+			bulkSlotLength[slot] = 0;
+			bulkNextSeq = (bulkNextSeq + 1) & BULK_SEQ_MASK;
+			slot = bulkNextSeq % BULK_WINDOW;
+
+			inbufCount = bulkBufCount;
+			int cmdStart = findCmdByte(0);
+			while (cmdStart >= 0) {
+				int cmdBytes = processCommandAt(cmdStart);
+				if (cmdBytes < 0) break; // incomplete command
+				cmdStart = findCmdByte(cmdStart + cmdBytes);
+			}
+			int remainingBytes = (cmdStart < 0) ? 0 : bulkBufCount - cmdStart;
+			if (remainingBytes >= IN_BUF_SIZE) remainingBytes = 0; // too long for a command; discard
+			memmove(bulkBuf, &bulkBuf[bulkBufCount - remainingBytes], remainingBytes);
+			bulkBufCount = remainingBytes;
+
+			if (bulkReceived >= bulkLength) {
+				bulkStatus = BULK_STATUS_COMPLETE;
+				bulkAckPending = true;
+				break;
+			}
+		}
+
+		bulkRunning = false;
+		inbuf = serialInbuf;
+		inbufCount = serialInbufCount;
+	}
+	if (bulkAckPending) {
+		sendBulkAck(bulkID);
+		bulkAckPending = false;
+	}
+}
+
+// Sleeping
+
+// The system tick (6 msecs on the DAL, 4 on CODAL) wakes the processor from any sleep, so
+// the main loop can sleep whenever its next deadline is at least one tick away. Closer
+// deadlines are met by polling. Received serial data, transmit-complete, radio, ADC, timer, and
+// button interrupts also wake it, and events are delivered by those interrupts.
+
+#ifdef SCHEDULER_TICK_PERIOD_US
+#define SLEEP_TICK_MICROS SCHEDULER_TICK_PERIOD_US
+#elif defined(SYSTEM_TICK_PERIOD_MS)
+#define SLEEP_TICK_MICROS (1000 * SYSTEM_TICK_PERIOD_MS)
+#else
+#define SLEEP_TICK_MICROS 6000
+#endif
+
+#define NO_DEADLINE 0x7FFFFFFF
+
+static int32_t microsUntilWork() {
+	// Return the usecs until the main loop has work to do, zero if it must keep polling,
+	// or NO_DEADLINE if it only has to respond to interrupts.
+
+	if (serial.rxBufferedSize() > 0) return 0;
+	for (int port = 0; port < 3; port++) {
+		if (isStreamingPort[port]) return 0; // digital pins are polled for changes
+	}
+	if (radioEnabled && (radioTxCount > 0)) return 0;
+
+	int32_t result = NO_DEADLINE;
+	for (int chan = 0; chan < 16; chan++) {
+		if (isStreamingChannel[chan]) {
+			result = (1000 * samplingInterval) - (int32_t) (nowMicros() - lastSampleTime);
+			break;
+		}
+	}
+	if (accelBurstSize) {
+		int32_t t = accelNextSample - nowMicros();
+		if (t < result) result = t;
+	}
+	for (int i = 0; i < taskCount; i++) {
+		if (!tasks[i].scheduled) continue;
+		int32_t msecs = tasks[i].runTime - now();
+		if (msecs < 0) msecs = 0; // overdue
+		if (msecs < (result / 1000)) result = 1000 * msecs;
+	}
+	if (radioEnabled && radioBatchCount) {
+		int32_t msecs = radioBatchInterval - (int32_t) (now() - radioBatchTime);
+		if (msecs < 0) msecs = 0; // overdue
+		if (msecs < (result / 1000)) result = 1000 * msecs;
+	}
+	return (result > 0) ? result : 0;
+}
+
+static void recordWakeupLatency() {
+	// Called at the start of each loop iteration. Record the latency if a deadline has passed.
+
+	loopIterations++;
+	if (!loopDeadlineSet) return;
+	int32_t latency = nowMicros() - loopDeadline;
+	if (latency < 0) return;
+	loopDeadlineSet = false;
+	if ((uint32_t) latency > loopLatencyMax) loopLatencyMax = latency;
+	loopLatencySum += latency;
+	loopLatencyCount++;
+}
+
+void sleepFirmata() {
+	int32_t idle = microsUntilWork();
+	if (!loopDeadlineSet && (idle != NO_DEADLINE)) {
+		loopDeadline = nowMicros() + idle;
+		loopDeadlineSet = true;
+	}
+	if (idle < SLEEP_TICK_MICROS) return; // too close to sleep; keep polling
+	uint32_t start = nowMicros();
+	__WFE(); // sleep until the next interrupt
+	loopMicrosAsleep += nowMicros() - start;
+	loopSleeps++;
+}
+
 // Entry Points
 
 void initFirmata() {
 	device_init();
 	serial_setBaud(57600);
 	serial.setRxBufferSize(249);
-	serial.setTxBufferSize(249);
+	serial.setTxBufferSize(OUT_BUF_SIZE);
 
 	systemReset();
 	registerEventListeners();
 	reportFirmataVersion();
+	restoreConfig();
+	loopStatsStart = nowMicros();
 }
 
 void stepFirmata() {
+	recordWakeupLatency();
 	processCommands();
+	stepBulk();
+	runTasks();
 	streamDigitalPins();
 	streamSensors();
+	stepAccelerometer();
+	stepWaveform();
+	stepRadio();
+	stepMicrophone();
 
 	// Note: The following code is essential to avoid overrunning the serial line
 	// and losing or corrupting data, A fixed delay works, too, but a delay
 	// long enough to handle the worst case (streaming 16 channels of analog data
 	// and three digital ports, a total of 3 * 19 = 57 bytes) reduces the maximum
 	// sampling rate for a single channel. The code below is like a bulk SYNC_SPINWAIT
-	// for all serial data queued by the last call to stepFirmata().
+	// for all serial data queued by the last call to stepFirmata(). The processor
+	// sleeps until the transmit interrupt (or the system tick) rather than spinning.
 
-	while (serial.txBufferedSize() > 0) /* wait for all bytes to be sent */;
+	while (serial.txBufferedSize() > 0) __WFE(); /* wait for all bytes to be sent */
 }
@@ -47,9 +47,25 @@ SOFTWARE.
 #define PIN_STATE_RESPONSE		0x6E // reply with a pin's current mode and state (different than value)
 #define EXTENDED_ANALOG_WRITE	0x6F // analog write (PWM, Servo, etc) to any pin
 
+#define SERVO_CONFIG			0x70 // set a servo pin's pulse width range (min and max usecs)
 #define STRING_DATA				0x71 // send a string (UTF-8)
 #define REPORT_FIRMWARE			0x79 // firmware version and name
 #define SAMPLING_INTERVAL		0x7A // set milliseconds between streamed analog samples
+#define SCHEDULER_DATA			0x7B // create, run, and query stored command tasks (see below)
+
+// Firmata Scheduler Commands (sent after SCHEDULER_DATA)
+
+#define CREATE_FIRMATA_TASK		0x00 // task id, length (two data bytes)
+#define DELETE_FIRMATA_TASK		0x01 // task id
+#define ADD_TO_FIRMATA_TASK		0x02 // task id, packed command bytes
+#define DELAY_FIRMATA_TASK		0x03 // packed msecs (4 bytes); only within a task
+#define SCHEDULE_FIRMATA_TASK	0x04 // task id, packed msecs until it runs (4 bytes)
+#define QUERY_ALL_FIRMATA_TASKS	0x05 // reply with QUERY_ALL_TASKS_REPLY
+#define QUERY_FIRMATA_TASK		0x06 // task id; reply with QUERY_TASK_REPLY
+#define RESET_FIRMATA_TASKS		0x07 // delete all tasks
+#define ERROR_TASK_REPLY		0x08 // task id, packed task state and data
+#define QUERY_ALL_TASKS_REPLY	0x09 // task ids
+#define QUERY_TASK_REPLY		0x0A // task id, packed task state and data
 
 // Custom Sysex Messages for micro:bit (0x01-0x0F)
 
@@ -68,12 +84,67 @@ SOFTWARE.
 #define MB_DEBUG_STRING			0x0E
 #define MB_EXTENDED_SYSEX		0x0F // can be used to add 128 additional micro:bit commands
 
+// Extended micro:bit Sysex Messages (SYSEX_START, MB_EXTENDED_SYSEX, <command>, ... SYSEX_END)
+
+// Radio commands (0x01-0x0F)
+#define MB_EXT_RADIO_ENABLE				0x01 // 1 - turn on, 0 - turn off
+#define MB_EXT_RADIO_GROUP				0x02 // group (0-255, two data bytes)
+#define MB_EXT_RADIO_POWER				0x03 // transmit power (0-7)
+#define MB_EXT_RADIO_CHANNEL			0x04 // frequency band (0-83)
+#define MB_EXT_RADIO_SEND_STRING		0x05 // string (two data bytes per byte)
+#define MB_EXT_RADIO_SEND_INTEGER		0x06 // 32-bit integer (five data bytes)
+#define MB_EXT_RADIO_SEND_FLOAT			0x07 // 64-bit float (ten data bytes)
+#define MB_EXT_RADIO_SEND_PAIR_INTEGER	0x08 // 32-bit integer, then name string
+#define MB_EXT_RADIO_SEND_PAIR_FLOAT	0x09 // 64-bit float, then name string
+#define MB_EXT_RADIO_SEND_PACKET		0x0A // packed raw radio packet (MakeCode format)
+#define MB_EXT_RADIO_PACKETS			0x0B // batch of received packets (packed; board to client)
+#define MB_EXT_RADIO_BATCH_INTERVAL		0x0C // max msecs to hold received packets (two data bytes)
+#define MB_EXT_RADIO_STATS				0x0D // request/report radio packet counts
+
+#define MB_EXT_SCROLL_STRING_PACKED		0x10 // like MB_SCROLL_STRING, but with packed UTF-8 data
+#define MB_EXT_REPORT_FIRMWARE_PACKED	0x11 // like REPORT_FIRMWARE, but with packed UTF-8 data
+#define MB_EXT_BOARD_TIME				0x12 // report the board's microsecond clock (for clock offset estimation)
+#define MB_EXT_SAMPLE_TIMESTAMPS		0x13 // enable/disable a board timestamp before each batch of samples
+#define MB_EXT_SAVE_CONFIG				0x14 // save (1) or erase (0) the configuration restored at startup
+#define MB_EXT_HEADING_MODE				0x15 // channel 13 reports tilt-compensated heading (1) or compass x (0)
+#define MB_EXT_MICROPHONE				0x16 // start/stop microphone capture: mode, sample rate, level window
+#define MB_EXT_AUDIO_BLOCK				0x17 // sequence number, packed IMA-ADPCM block (board to client)
+#define MB_EXT_SOUND_LEVEL				0x18 // RMS sound level of the last window (board to client)
+#define MB_EXT_ACCEL_CONFIG				0x19 // set/report accelerometer range (g) and sample period (msecs)
+#define MB_EXT_ACCEL_STREAM				0x1A // stream every accelerometer sample in bursts (samples per burst; 0 stops)
+#define MB_EXT_ACCEL_BURST				0x1B // packed burst of accelerometer samples (board to client)
+#define MB_EXT_LOOP_STATS				0x1C // request/report main loop sleep and wake-up latency statistics
+#define MB_EXT_WAVEFORM_DATA			0x1D // table offset (two data bytes), packed 16-bit PWM values
+#define MB_EXT_WAVEFORM_PLAY			0x1E // pin, samples/sec (three data bytes; 0 stops), loops (two data bytes; 0 forever)
+#define MB_EXT_ANALOG_WRITE_BATCH		0x1F // set several PWM/servo outputs at once: pin and value (two data bytes) for each
+#define MB_EXT_BULK_START				0x20 // transfer id, packed length (4 bytes) and CRC-16
+#define MB_EXT_BULK_CHUNK				0x21 // transfer id, chunk number (two data bytes), packed data (up to 32 bytes) and CRC-16
+#define MB_EXT_BULK_ACK					0x22 // transfer id, next chunk (two data bytes), held chunks, status, CRC-16 (three data bytes) (board to client)
+
+// Waveform Playback Event (reported with MB_REPORT_EVENT when playback finishes)
+
+#define MB_WAVEFORM_EVENT_ID	3100
+#define MB_WAVEFORM_EVT_DONE	1
+
+// Bulk Transfer Status (MB_EXT_BULK_ACK)
+
+#define BULK_STATUS_RECEIVING	0x00
+#define BULK_STATUS_COMPLETE	0x01 // all commands received and run
+#define BULK_STATUS_UNKNOWN		0x02 // no transfer with that id (e.g. the board was reset)
+
+// Microphone Modes (MB_EXT_MICROPHONE)
+
+#define MIC_OFF					0x00
+#define MIC_AUDIO				0x01 // IMA-ADPCM audio blocks
+#define MIC_LEVEL				0x02 // RMS sound level per window
+
 // Firmata Pin Modes
 
 #define DIGITAL_INPUT			0x00
 #define DIGITAL_OUTPUT			0x01
 #define ANALOG_INPUT			0x02
 #define PWM						0x03
+#define SERVO					0x04
 #define INPUT_PULLUP			0x0B
 #define INPUT_PULLDOWN			0x0F // micro:bit extension; not defined in standard Firmata
 
@@ -81,3 +152,16 @@ SOFTWARE.
 
 void initFirmata();
 void stepFirmata();
+void sleepFirmata(); // sleep until an interrupt, unless work is due within one system tick
+
+#if FIRMATA_RADIO_LOOPBACK
+// Deliver a packet to the loopback radio, as if it had been received over the air.
+void radioLoopbackInject(const uint8_t *packet, int len, int rssi);
+#endif
+
+#if FIRMATA_SIMULATED_MICROPHONE
+// Supplied by the simulation: start (or, with a sample rate of zero, stop) the microphone,
+// and read up to maxCount of the samples captured since the last read.
+void simulatedMicrophoneStart(int sampleRate);
+int simulatedMicrophoneRead(int16_t *samples, int maxCount);
+#endif
@@ -0,0 +1,465 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "BoardAggregator.h"
+#include "mbFirmata.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// BoardClock
+
+BoardClock::BoardClock()
+	: lastBoard(0), haveBoardTime(false), minRoundTrip(0),
+	  refBoard(0), refHost(0), clockRate(1.0) {
+}
+
+int64_t BoardClock::extend(uint32_t boardMicros) {
+	// Extend a 32-bit board time to 64-bits, relative to the most recent board time.
+
+	if (!haveBoardTime) {
+		lastBoard = boardMicros;
+		haveBoardTime = true;
+		return lastBoard;
+	}
+	int32_t delta = (int32_t) (boardMicros - (uint32_t) lastBoard);
+	int64_t result = lastBoard + delta;
+	if (delta > 0) lastBoard = result;
+	return result;
+}
+
+void BoardClock::addPing(int64_t hostSend, int64_t hostReceive, uint32_t boardMicros) {
+	int64_t roundTrip = hostReceive - hostSend;
+	if (roundTrip < 0) return;
+	Ping ping;
+	ping.board = extend(boardMicros);
+	ping.host = hostSend + (roundTrip / 2);
+	ping.roundTrip = roundTrip;
+	pings.push_back(ping);
+	if (pings.size() > MAX_PINGS) pings.pop_front();
+	fit();
+}
+
+void BoardClock::fit() {
+	// Fit host time as a linear function of board time using the queries whose round trips
+	// were close to the best one, since long round trips (e.g. waiting behind a burst of
+	// streamed data) have uncertain midpoints.
+
+	minRoundTrip = pings[0].roundTrip;
+	for (size_t i = 1; i < pings.size(); i++) minRoundTrip = std::min(minRoundTrip, pings[i].roundTrip);
+	int64_t threshold = minRoundTrip + std::max(minRoundTrip / 2, (int64_t) 500);
+
+	std::vector<const Ping *> good;
+	const Ping *best = &pings[0];
+	for (size_t i = 0; i < pings.size(); i++) {
+		if (pings[i].roundTrip <= threshold) good.push_back(&pings[i]);
+		if (pings[i].roundTrip < best->roundTrip) best = &pings[i];
+	}
+	refBoard = best->board;
+	refHost = best->host;
+	clockRate = 1.0;
+
+	// Only estimate the rate when the queries span enough time to make it meaningful.
+	if ((good.size() < 3) || ((good.back()->board - good.front()->board) < 2000000)) return;
+
+	double boardMean = 0, hostMean = 0;
+	for (size_t i = 0; i < good.size(); i++) {
+		boardMean += good[i]->board - good[0]->board;
+		hostMean += good[i]->host - good[0]->host;
+	}
+	boardMean /= good.size();
+	hostMean /= good.size();
+	double covariance = 0, variance = 0;
+	for (size_t i = 0; i < good.size(); i++) {
+		double b = (good[i]->board - good[0]->board) - boardMean;
+		double h = (good[i]->host - good[0]->host) - hostMean;
+		covariance += b * h;
+		variance += b * b;
+	}
+	double rate = covariance / variance;
+	if ((rate < 0.999) || (rate > 1.001)) return; // more than 1000 ppm: not a plausible crystal
+	clockRate = rate;
+	refBoard = good[0]->board + (int64_t) boardMean;
+	refHost = good[0]->host + (int64_t) hostMean;
+}
+
+int64_t BoardClock::toHostTime(uint32_t boardMicros) {
+	return refHost + (int64_t) ((extend(boardMicros) - refBoard) * clockRate);
+}
+
+// BoardAggregator
+
+struct BoardAggregator::Board {
+	Board(int index, const std::string &path, EventLoop &loop)
+		: index(index), path(path), loop(loop), client(loop),
+		  batchTime(0), batchArrival(-1), nextSeq(0), pingCount(0), lastPing(0), pingTimer(-1), sampleCount(0) {
+		for (int i = 0; i < 128; i++) pingSent[i] = -1;
+		status.path = path;
+		status.connected = false;
+		status.clockValid = false;
+		status.roundTrip = 0;
+		status.offset = 0;
+		status.rate = 1.0;
+		status.samples = 0;
+	}
+
+	int index;
+	std::string path;
+	EventLoop &loop;
+	MBFirmataClient client;
+	BoardClock clock;
+
+	int64_t batchTime; // host time of the current batch of samples
+	int64_t batchArrival; // host time the batch timestamp arrived; -1 if none
+
+	int64_t pingSent[128]; // host send time of each outstanding query, by sequence number
+	int nextSeq;
+	int pingCount;
+	int64_t lastPing;
+	int pingTimer;
+
+	std::vector<AlignedSample> pending; // samples not yet added to the merge queue
+	uint64_t sampleCount;
+
+	BoardStatus status; // protected by statusLock
+};
+
+struct BoardAggregator::Worker {
+	EventLoop loop;
+	std::thread thread;
+	std::vector<Board *> boards;
+};
+
+BoardAggregator::BoardAggregator(const Options &options)
+	: samplesReceived(0), samplesPublished(0), lateSamples(0),
+	  options(options), startTime(std::chrono::steady_clock::now()),
+	  stopping(false), running(false), lastReleased(INT64_MIN), listenFD(-1) {
+
+	int threadCount = std::max(1, options.threads);
+	for (int i = 0; i < threadCount; i++) workers.push_back(std::unique_ptr<Worker>(new Worker()));
+}
+
+BoardAggregator::~BoardAggregator() {
+	stop();
+	for (size_t i = 0; i < clients.size(); i++) close(clients[i]->fd);
+	if (listenFD >= 0) {
+		close(listenFD);
+		unlink(socketPath.c_str());
+	}
+	boards.clear(); // disconnect boards before their event loops are destroyed
+}
+
+int64_t BoardAggregator::hostTime() const {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - startTime).count();
+}
+
+int BoardAggregator::addBoard(const std::string &path) {
+	// Boards are assigned to worker threads round-robin.
+
+	if (running) return -1;
+	int index = boards.size();
+	Worker &worker = *workers[index % workers.size()];
+	std::unique_ptr<Board> board(new Board(index, path, worker.loop));
+	if (!board->client.connect(path)) return -1;
+	worker.boards.push_back(board.get());
+	boards.push_back(std::move(board));
+	return index;
+}
+
+std::vector<BoardAggregator::BoardStatus> BoardAggregator::boardStatus() {
+	std::lock_guard<std::mutex> guard(statusLock);
+	std::vector<BoardStatus> result;
+	for (size_t i = 0; i < boards.size(); i++) result.push_back(boards[i]->status);
+	return result;
+}
+
+void BoardAggregator::start() {
+	if (running) return;
+	running = true;
+	stopping = false;
+	for (size_t i = 0; i < workers.size(); i++) {
+		Worker *worker = workers[i].get();
+		worker->thread = std::thread([this, worker]() { runWorker(*worker); });
+	}
+	publisherThread = std::thread([this]() { runPublisher(); });
+}
+
+void BoardAggregator::stop() {
+	if (!running) return;
+	stopping = true;
+	for (size_t i = 0; i < workers.size(); i++) workers[i]->thread.join();
+	publisherThread.join();
+	publish(true);
+	running = false;
+}
+
+// Boards (called on worker threads)
+
+void BoardAggregator::startBoard(Board &board) {
+	MBFirmataClient &mb = board.client;
+	mb.addFirmataTimeListener([this, &board](int seq, uint32_t boardMicros) {
+		receivedTime(board, seq, boardMicros);
+	});
+	mb.addFirmataChannelListener([this, &board](int chan, int value) {
+		receivedSample(board, chan, value);
+	});
+
+	mb.setAnalogSamplingInterval(options.samplingInterval);
+	mb.enableSampleTimestamps(options.sampleTimestamps);
+	for (size_t i = 0; i < options.channels.size(); i++) {
+		int chan = options.channels[i];
+		if (chan < 6) mb.setPinMode((5 == chan) ? 10 : chan, ANALOG_INPUT);
+		if (11 == chan) mb.enableLightSensor();
+		mb.streamAnalogChannel(chan);
+	}
+
+	// Query the board time quickly at first to get a good initial offset, then at pingInterval.
+	pingBoard(board);
+	board.pingTimer = board.loop.addTimer(50, [this, &board]() {
+		if ((board.pingCount < 10) || ((hostTime() - board.lastPing) >= (1000 * options.pingInterval))) {
+			pingBoard(board);
+		}
+	}, true);
+}
+
+void BoardAggregator::pingBoard(Board &board) {
+	int seq = board.nextSeq;
+	board.nextSeq = (seq + 1) & 0x7F;
+	board.lastPing = hostTime();
+	board.pingSent[seq] = board.lastPing;
+	board.pingCount++;
+	board.client.requestBoardTime(seq);
+}
+
+void BoardAggregator::receivedTime(Board &board, int seq, uint32_t boardMicros) {
+	int64_t now = hostTime();
+	if (seq < 0) { // sample timestamp
+		if (!board.clock.isValid()) return;
+		board.batchTime = board.clock.toHostTime(boardMicros);
+		board.batchArrival = now;
+		return;
+	}
+	if (board.pingSent[seq] < 0) return; // not a query we sent
+	board.clock.addPing(board.pingSent[seq], now, boardMicros);
+	board.pingSent[seq] = -1;
+}
+
+void BoardAggregator::receivedSample(Board &board, int chan, int value) {
+	// Use the batch timestamp if there is a recent one, otherwise estimate the sample time
+	// from the arrival time.
+
+	int64_t now = hostTime();
+	AlignedSample sample;
+	if ((board.batchArrival >= 0) && ((now - board.batchArrival) < (1000 * options.samplingInterval))) {
+		sample.time = board.batchTime;
+	} else {
+		sample.time = now - (board.clock.bestRoundTrip() / 2);
+	}
+	sample.board = board.index;
+	sample.chan = chan;
+	sample.value = value;
+	board.pending.push_back(sample);
+	board.sampleCount++;
+}
+
+void BoardAggregator::runWorker(Worker &worker) {
+	for (size_t i = 0; i < worker.boards.size(); i++) startBoard(*worker.boards[i]);
+
+	while (!stopping) {
+		worker.loop.runOnce(10);
+
+		// Move the samples from this pass into the merge queue while holding the lock once.
+		size_t count = 0;
+		{
+			std::lock_guard<std::mutex> guard(queueLock);
+			for (size_t i = 0; i < worker.boards.size(); i++) {
+				std::vector<AlignedSample> &pending = worker.boards[i]->pending;
+				for (size_t j = 0; j < pending.size(); j++) queue.push(pending[j]);
+				count += pending.size();
+				pending.clear();
+			}
+		}
+		samplesReceived += count;
+
+		std::lock_guard<std::mutex> guard(statusLock);
+		for (size_t i = 0; i < worker.boards.size(); i++) {
+			Board &board = *worker.boards[i];
+			board.status.connected = board.client.isConnected();
+			board.status.clockValid = board.clock.isValid();
+			board.status.roundTrip = board.clock.bestRoundTrip();
+			board.status.offset = board.clock.offset();
+			board.status.rate = board.clock.rate();
+			board.status.samples = board.sampleCount;
+		}
+	}
+
+	// Stop streaming so the boards are idle until the next client connects.
+	for (size_t i = 0; i < worker.boards.size(); i++) {
+		MBFirmataClient &mb = worker.boards[i]->client;
+		worker.loop.cancelTimer(worker.boards[i]->pingTimer);
+		for (size_t j = 0; j < options.channels.size(); j++) mb.stopStreamingAnalogChannel(options.channels[j]);
+		mb.enableSampleTimestamps(false);
+	}
+}
+
+// Publishing (called on the publisher thread)
+
+bool BoardAggregator::listen(const std::string &path) {
+	struct sockaddr_un addr = {};
+	if (path.size() >= sizeof(addr.sun_path)) return false;
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) return false;
+	unlink(path.c_str());
+	if ((bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) || (::listen(fd, 16) < 0)) {
+		close(fd);
+		return false;
+	}
+	listenFD = fd;
+	socketPath = path;
+	publisherLoop.add(listenFD, EPOLLIN, [this](uint32_t events) { acceptClients(); });
+	return true;
+}
+
+void BoardAggregator::acceptClients() {
+	while (true) {
+		int fd = accept4(listenFD, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) return;
+		std::unique_ptr<Client> client(new Client());
+		client->fd = fd;
+		for (size_t i = 0; i < boards.size(); i++) {
+			client->outbuf += "# board " + std::to_string(i) + " " + boards[i]->path + "\n";
+		}
+		publisherLoop.add(fd, EPOLLIN | EPOLLOUT, [this, fd](uint32_t events) {
+			for (size_t i = 0; i < clients.size(); i++) {
+				if (clients[i]->fd != fd) continue;
+				if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+					// Clients don't send anything, so readable means closed (or misbehaving).
+					char buf[256];
+					if ((read(fd, buf, sizeof(buf)) <= 0) || (events & (EPOLLERR | EPOLLHUP))) {
+						closeClient(fd);
+						return;
+					}
+				}
+				if (events & EPOLLOUT) writeClient(*clients[i]);
+				return;
+			}
+		});
+		clients.push_back(std::move(client));
+	}
+}
+
+void BoardAggregator::writeClient(Client &client) {
+	// Write as much as possible without blocking. Clients that fall too far behind are dropped.
+
+	const size_t maxBuffered = 4 * 1024 * 1024;
+	while (!client.outbuf.empty()) {
+		ssize_t n = send(client.fd, client.outbuf.data(), client.outbuf.size(), MSG_NOSIGNAL);
+		if (n < 0) {
+			if ((EAGAIN == errno) || (EINTR == errno)) break;
+			closeClient(client.fd);
+			return;
+		}
+		client.outbuf.erase(0, n);
+	}
+	if (client.outbuf.size() > maxBuffered) {
+		fprintf(stderr, "Dropping a client that is not keeping up\n");
+		closeClient(client.fd);
+		return;
+	}
+	publisherLoop.modify(client.fd, client.outbuf.empty() ? EPOLLIN : (EPOLLIN | EPOLLOUT));
+}
+
+void BoardAggregator::closeClient(int fd) {
+	publisherLoop.remove(fd);
+	close(fd);
+	for (size_t i = 0; i < clients.size(); i++) {
+		if (clients[i]->fd == fd) {
+			clients.erase(clients.begin() + i);
+			return;
+		}
+	}
+}
+
+void BoardAggregator::runPublisher() {
+	publisherLoop.addTimer(10, [this]() { publish(false); }, true);
+	while (!stopping) publisherLoop.runOnce(50);
+}
+
+void BoardAggregator::publish(bool releaseAll) {
+	// Release the samples that are older than the latency window, in time order.
+
+	int64_t watermark = releaseAll ? INT64_MAX : hostTime() - (1000 * options.latencyWindow);
+	std::vector<AlignedSample> ready;
+	{
+		std::lock_guard<std::mutex> guard(queueLock);
+		while (!queue.empty() && (queue.top().time <= watermark)) {
+			ready.push_back(queue.top());
+			queue.pop();
+		}
+	}
+	if (ready.empty()) return;
+
+	std::string lines;
+	char line[64];
+	for (size_t i = 0; i < ready.size(); i++) {
+		const AlignedSample &sample = ready[i];
+		if (sample.time < lastReleased) {
+			lateSamples++;
+		} else {
+			lastReleased = sample.time;
+		}
+		if (sampleSink) sampleSink(sample);
+		if (!clients.empty()) {
+			int n = snprintf(line, sizeof(line), "%lld %d %d %d\n",
+				(long long) sample.time, sample.board, sample.chan, sample.value);
+			lines.append(line, n);
+		}
+	}
+	samplesPublished += ready.size();
+
+	// Iterate over a copy of the fds, since writeClient() may drop clients.
+	std::vector<int> fds;
+	for (size_t i = 0; i < clients.size(); i++) fds.push_back(clients[i]->fd);
+	for (size_t i = 0; i < fds.size(); i++) {
+		for (size_t j = 0; j < clients.size(); j++) {
+			if (clients[j]->fd != fds[i]) continue;
+			clients[j]->outbuf += lines;
+			writeClient(*clients[j]);
+			break;
+		}
+	}
+}
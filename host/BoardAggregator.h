@@ -0,0 +1,198 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// BoardAggregator: stream sensor data from many boards and merge it into one time-aligned
+// stream.
+//
+// Each board has its own MBFirmataClient. Boards are spread across a small pool of worker
+// threads, each running its own EventLoop, so one thread can serve many boards.
+//
+// Each sample is assigned a host time (microseconds since the aggregator was created):
+//   - The board clock is related to the host clock by periodic MB_EXT_BOARD_TIME queries.
+//     The reply time is assumed to be the midpoint of the round trip; the queries with the
+//     shortest round trips are used to fit an offset and a clock rate (BoardClock).
+//   - With sample timestamps enabled, each batch of samples carries the board time at which
+//     it was sampled, which is converted to host time using the fitted clock.
+//   - Otherwise (e.g. older firmware), a sample's time is its arrival time less half of the
+//     best round-trip time.
+//
+// Samples from all boards are merged by time and released once they are older than the
+// latency window, so samples that arrive later than that are published out of order (they
+// are counted as late). The merged stream is published to clients of a Unix domain socket
+// as text lines:
+//
+//   <host time usecs> <board index> <channel> <value>
+//
+// preceded by a "# board <index> <path>" header line for each board.
+
+#pragma once
+
+#include "EventLoop.h"
+#include "MBFirmataClient.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct AlignedSample {
+	int64_t time; // host microseconds
+	int board;
+	int chan;
+	int value;
+
+	bool operator>(const AlignedSample &other) const { return time > other.time; }
+};
+
+class BoardClock {
+  public:
+	BoardClock();
+
+	// Record a time query sent at hostSend and answered at hostReceive with boardMicros.
+	void addPing(int64_t hostSend, int64_t hostReceive, uint32_t boardMicros);
+
+	// True once at least one query has been answered.
+	bool isValid() const { return !pings.empty(); }
+
+	// Convert a board time to host time. Board times must be passed roughly in order,
+	// since they are used to extend the 32-bit board clock (which wraps every 71 minutes).
+	int64_t toHostTime(uint32_t boardMicros);
+
+	int64_t bestRoundTrip() const { return minRoundTrip; }
+	int64_t offset() const { return refHost - refBoard; } // host time - board time
+	double rate() const { return clockRate; } // host microseconds per board microsecond
+
+  private:
+	struct Ping {
+		int64_t board; // extended board time
+		int64_t host; // host time at the midpoint of the round trip
+		int64_t roundTrip;
+	};
+
+	int64_t extend(uint32_t boardMicros);
+	void fit();
+
+	static const size_t MAX_PINGS = 32;
+
+	std::deque<Ping> pings;
+	int64_t lastBoard;
+	bool haveBoardTime;
+	int64_t minRoundTrip;
+	int64_t refBoard;
+	int64_t refHost;
+	double clockRate;
+};
+
+class BoardAggregator {
+  public:
+	struct Options {
+		int threads = 2;
+		int samplingInterval = 10; // msecs
+		std::vector<int> channels = {8, 9, 10}; // accelerometer
+		bool sampleTimestamps = true;
+		int pingInterval = 1000; // msecs
+		int latencyWindow = 100; // msecs
+	};
+
+	struct BoardStatus {
+		std::string path;
+		bool connected;
+		bool clockValid;
+		int64_t roundTrip; // usecs
+		int64_t offset; // usecs
+		double rate;
+		uint64_t samples;
+	};
+
+	typedef std::function<void(const AlignedSample &sample)> SampleSink;
+
+	explicit BoardAggregator(const Options &options);
+	~BoardAggregator();
+
+	// Add a board before calling start(). Return its index, or -1 if it can't be opened.
+	int addBoard(const std::string &path);
+
+	// Publish the merged stream on a Unix domain socket at path.
+	bool listen(const std::string &socketPath);
+
+	// Call sink for each merged sample (on the publishing thread).
+	void setSampleSink(SampleSink sink) { sampleSink = sink; }
+
+	void start();
+	void stop(); // stops the threads and publishes any remaining samples
+
+	int64_t hostTime() const; // microseconds since the aggregator was created
+	std::vector<BoardStatus> boardStatus();
+
+	// statistics:
+	std::atomic<uint64_t> samplesReceived;
+	std::atomic<uint64_t> samplesPublished;
+	std::atomic<uint64_t> lateSamples;
+
+  private:
+	struct Board;
+	struct Worker;
+	struct Client {
+		int fd;
+		std::string outbuf;
+	};
+
+	void startBoard(Board &board);
+	void pingBoard(Board &board);
+	void receivedTime(Board &board, int seq, uint32_t boardMicros);
+	void receivedSample(Board &board, int chan, int value);
+	void runWorker(Worker &worker);
+	void runPublisher();
+	void publish(bool releaseAll);
+	void acceptClients();
+	void writeClient(Client &client);
+	void closeClient(int fd);
+
+	Options options;
+	std::chrono::steady_clock::time_point startTime;
+	std::vector<std::unique_ptr<Worker> > workers;
+	std::vector<std::unique_ptr<Board> > boards;
+	std::atomic<bool> stopping;
+	bool running;
+
+	std::mutex queueLock;
+	std::priority_queue<AlignedSample, std::vector<AlignedSample>, std::greater<AlignedSample> > queue;
+	int64_t lastReleased;
+
+	std::mutex statusLock; // protects the status fields of each Board
+
+	EventLoop publisherLoop;
+	std::thread publisherThread;
+	int listenFD;
+	std::string socketPath;
+	std::vector<std::unique_ptr<Client> > clients;
+	SampleSink sampleSink;
+};
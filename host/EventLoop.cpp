@@ -0,0 +1,132 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "EventLoop.h"
+
+#include <chrono>
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+EventLoop::EventLoop() : running(false), nextSerial(0) {
+	epollFD = epoll_create1(EPOLL_CLOEXEC);
+}
+
+EventLoop::~EventLoop() {
+	close(epollFD);
+}
+
+bool EventLoop::add(int fd, uint32_t events, Handler handler) {
+	uint32_t serial = nextSerial++;
+	struct epoll_event ev = {};
+	ev.events = events;
+	ev.data.u64 = ((uint64_t) serial << 32) | (uint32_t) fd;
+	if (epoll_ctl(epollFD, EPOLL_CTL_ADD, fd, &ev) < 0) return false;
+	watches[fd] = { serial, std::make_shared<Handler>(handler) };
+	return true;
+}
+
+bool EventLoop::modify(int fd, uint32_t events) {
+	std::map<int, Watch>::iterator it = watches.find(fd);
+	if (it == watches.end()) return false;
+	struct epoll_event ev = {};
+	ev.events = events;
+	ev.data.u64 = ((uint64_t) it->second.serial << 32) | (uint32_t) fd;
+	return epoll_ctl(epollFD, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void EventLoop::remove(int fd) {
+	if (!watches.erase(fd)) return;
+	epoll_ctl(epollFD, EPOLL_CTL_DEL, fd, NULL);
+}
+
+int EventLoop::addTimer(int msecs, TimerHandler handler, bool repeat) {
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0) return -1;
+
+	struct itimerspec spec = {};
+	if (msecs < 1) msecs = 1;
+	spec.it_value.tv_sec = msecs / 1000;
+	spec.it_value.tv_nsec = (msecs % 1000) * 1000000L;
+	if (repeat) spec.it_interval = spec.it_value;
+	timerfd_settime(fd, 0, &spec, NULL);
+
+	bool ok = add(fd, EPOLLIN, [this, fd, handler, repeat](uint32_t events) {
+		uint64_t expirations;
+		if (read(fd, &expirations, sizeof(expirations)) < 0) return;
+		if (!repeat) cancelTimer(fd);
+		handler();
+	});
+	if (!ok) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void EventLoop::cancelTimer(int timerID) {
+	if (timerID < 0) return;
+	if (!watches.count(timerID)) return;
+	remove(timerID);
+	close(timerID);
+}
+
+int EventLoop::runOnce(int timeoutMSecs) {
+	const int maxEvents = 32;
+	struct epoll_event events[maxEvents];
+	int n = epoll_wait(epollFD, events, maxEvents, timeoutMSecs);
+	for (int i = 0; i < n; i++) {
+		// Look up the handler each time, since an earlier handler may have removed it, and
+		// perhaps reused its fd number for a new file descriptor that didn't have this event.
+		int fd = (int) (uint32_t) events[i].data.u64;
+		uint32_t serial = events[i].data.u64 >> 32;
+		std::map<int, Watch>::iterator it = watches.find(fd);
+		if ((it == watches.end()) || (it->second.serial != serial)) continue;
+		std::shared_ptr<Handler> handler = it->second.handler; // keep alive while running
+		(*handler)(events[i].events);
+	}
+	return (n > 0) ? n : 0;
+}
+
+void EventLoop::run() {
+	running = true;
+	while (running) runOnce(-1);
+}
+
+void EventLoop::stop() {
+	running = false;
+}
+
+bool EventLoop::runUntil(std::function<bool()> done, int msecs) {
+	std::chrono::steady_clock::time_point deadline =
+		std::chrono::steady_clock::now() + std::chrono::milliseconds(msecs);
+	while (!done()) {
+		int remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+			deadline - std::chrono::steady_clock::now()).count();
+		if (remaining <= 0) return done();
+		runOnce(remaining);
+	}
+	return true;
+}
@@ -0,0 +1,77 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// EventLoop: a minimal epoll-based event loop for file descriptors and timers.
+//
+// Handlers are called on the thread that runs the loop. A handler may add or remove
+// file descriptors and timers (including its own) while it is running.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+
+class EventLoop {
+  public:
+	typedef std::function<void(uint32_t events)> Handler; // events are EPOLLIN, EPOLLOUT, etc.
+	typedef std::function<void()> TimerHandler;
+
+	EventLoop();
+	~EventLoop();
+
+	// Watch a file descriptor for the given epoll events.
+	bool add(int fd, uint32_t events, Handler handler);
+	bool modify(int fd, uint32_t events);
+	void remove(int fd);
+
+	// Call handler after msecs, and then every msecs if repeat is true. Returns a timer id.
+	int addTimer(int msecs, TimerHandler handler, bool repeat = false);
+	void cancelTimer(int timerID);
+
+	// Wait up to timeoutMSecs (-1 means forever) and dispatch any events.
+	// Return the number of events dispatched.
+	int runOnce(int timeoutMSecs);
+
+	// Run until stop() is called.
+	void run();
+	void stop();
+
+	// Run until done() returns true or msecs have elapsed. Return the final value of done().
+	bool runUntil(std::function<bool()> done, int msecs);
+
+  private:
+	// Each add() gets a new serial number, which is also in the epoll data, so an event that
+	// was pending for a removed fd isn't passed to a later handler for a reused fd number.
+	struct Watch {
+		uint32_t serial;
+		std::shared_ptr<Handler> handler;
+	};
+
+	int epollFD;
+	bool running;
+	uint32_t nextSerial;
+	std::map<int, Watch> watches;
+};
@@ -0,0 +1,154 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "FirmataParser.h"
+#include "mbFirmata.h"
+
+#include <cstring>
+
+FirmataParser::FirmataParser(Listener &listener)
+	: bytesParsed(0), messagesParsed(0), bytesDropped(0), listener(listener) {
+
+	reset();
+}
+
+void FirmataParser::reset() {
+	end = 0;
+	inSysex = false;
+	sysexStart = 0;
+	cmdByte = 0;
+	argsNeeded = 0;
+	argCount = 0;
+}
+
+uint8_t *FirmataParser::writeBuffer() {
+	writeSpace(); // compact, if possible
+	return &buf[end];
+}
+
+size_t FirmataParser::writeSpace() {
+	// Everything before an incomplete sysex has been parsed and can be discarded.
+	// Channel message arguments are kept in args[], so they don't need the buffer.
+
+	if (!inSysex) {
+		end = 0;
+	} else if (end == BUF_SIZE) {
+		if (sysexStart > 1) {
+			// move the incomplete sysex (including SYSEX_START) to the start of the buffer
+			size_t keep = end - (sysexStart - 1);
+			memmove(buf, &buf[sysexStart - 1], keep);
+			end = keep;
+			sysexStart = 1;
+		} else {
+			// sysex is larger than the buffer; discard it
+			bytesDropped += end;
+			inSysex = false;
+			end = 0;
+		}
+	}
+	return BUF_SIZE - end;
+}
+
+void FirmataParser::commit(size_t count) {
+	size_t first = end;
+	end += count;
+	for (size_t i = first; i < end; i++) parseByte(i);
+}
+
+void FirmataParser::parse(const uint8_t *data, size_t count) {
+	while (count > 0) {
+		size_t n = writeSpace();
+		if (n > count) n = count;
+		memcpy(writeBuffer(), data, n);
+		commit(n);
+		data += n;
+		count -= n;
+	}
+}
+
+void FirmataParser::parseByte(size_t index) {
+	uint8_t b = buf[index];
+	bytesParsed++;
+
+	if (b & 0x80) { // command byte
+		if (inSysex) {
+			inSysex = false;
+			int count = index - sysexStart;
+			if ((SYSEX_END == b) && (count > 0)) {
+				messagesParsed++;
+				listener.receivedSysex(&buf[sysexStart], count);
+				return;
+			}
+			bytesDropped += count + 1; // malformed sysex; skip it
+			if (SYSEX_END == b) return;
+		} else if (cmdByte) {
+			bytesDropped += argCount + 1; // incomplete command; skip it
+			cmdByte = 0;
+		}
+		if (SYSEX_START == b) {
+			inSysex = true;
+			sysexStart = index + 1;
+			return;
+		}
+		if (SYSEX_END == b) { // ends a sysex discarded as oversized, or is stray; not a message
+			bytesDropped++;
+			return;
+		}
+		startCommand(b);
+		return;
+	}
+
+	if (inSysex) return; // sysex data is delivered when SYSEX_END arrives
+	if (!cmdByte) { // data byte without a command
+		bytesDropped++;
+		return;
+	}
+	args[argCount++] = b;
+	if (argCount >= argsNeeded) dispatchCommand();
+}
+
+void FirmataParser::startCommand(uint8_t b) {
+	uint8_t chanCmd = b & 0xF0;
+	cmdByte = b;
+	argCount = 0;
+	args[0] = args[1] = 0;
+	argsNeeded = 2;
+	if ((STREAM_ANALOG == chanCmd) || (STREAM_DIGITAL == chanCmd)) argsNeeded = 1;
+	if ((0xF0 == chanCmd) && (SET_PIN_MODE != b) && (SET_DIGITAL_PIN != b) && (FIRMATA_VERSION != b)) {
+		argsNeeded = 0; // other system messages (e.g. SYSTEM_RESET) have no arguments
+	}
+	if (0 == argsNeeded) dispatchCommand();
+}
+
+void FirmataParser::dispatchCommand() {
+	uint8_t chanCmd = cmdByte & 0xF0;
+	int chan = cmdByte & 0xF;
+	int value = args[0] | (args[1] << 7);
+
+	messagesParsed++;
+	if (ANALOG_UPDATE == chanCmd) listener.receivedAnalogUpdate(chan, value);
+	if (DIGITAL_UPDATE == chanCmd) listener.receivedDigitalUpdate(chan, value);
+	if (FIRMATA_VERSION == cmdByte) listener.receivedFirmataVersion(args[0], args[1]);
+	cmdByte = 0;
+}
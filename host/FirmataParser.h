@@ -0,0 +1,90 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// FirmataParser: incremental parser for Firmata messages sent by the micro:bit.
+//
+// Incoming bytes are read directly into the parser's buffer (see writeBuffer()/commit()).
+// Each byte is examined exactly once; the parser keeps its state between reads, so a message
+// split across reads is never rescanned. Channel messages are decoded as they arrive. System
+// exclusive messages are delivered as a pointer into the buffer, without copying. The only
+// bytes ever moved are those of a sysex message that is still incomplete when the end of the
+// buffer is reached.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class FirmataParser {
+  public:
+	class Listener {
+	  public:
+		virtual ~Listener() {}
+		virtual void receivedFirmataVersion(int major, int minor) {}
+		virtual void receivedAnalogUpdate(int chan, int value) {}
+		virtual void receivedDigitalUpdate(int port, int pinMask) {}
+
+		// data[0] is the sysex command byte; count excludes SYSEX_START and SYSEX_END.
+		// The data is only valid until the listener returns.
+		virtual void receivedSysex(const uint8_t *data, int count) {}
+	};
+
+	explicit FirmataParser(Listener &listener);
+
+	// Space for incoming data. Read up to writeSpace() bytes into writeBuffer(),
+	// then call commit() with the number of bytes read.
+	uint8_t *writeBuffer();
+	size_t writeSpace();
+	void commit(size_t count);
+
+	// Parse bytes held elsewhere (e.g. a recording). The bytes are copied into the buffer.
+	void parse(const uint8_t *data, size_t count);
+
+	// Discard any partial message.
+	void reset();
+
+	// statistics:
+	uint64_t bytesParsed;
+	uint64_t messagesParsed;
+	uint64_t bytesDropped; // discarded malformed or oversized messages
+
+  private:
+	enum { BUF_SIZE = 4096 };
+
+	void parseByte(size_t index);
+	void startCommand(uint8_t cmdByte);
+	void dispatchCommand();
+
+	Listener &listener;
+	uint8_t buf[BUF_SIZE];
+	size_t end;			// number of bytes in buf
+
+	bool inSysex;
+	size_t sysexStart;	// index of the byte after SYSEX_START
+
+	uint8_t cmdByte;	// current channel/system command; zero when idle
+	int argsNeeded;
+	int argCount;
+	uint8_t args[2];
+};
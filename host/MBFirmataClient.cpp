@@ -0,0 +1,1182 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "MBFirmataClient.h"
+#include "SerialPort.h"
+#include "SessionLog.h"
+#include "mbFirmata.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+// Bulk transfer parameters
+static const size_t bulkChunkSize = 32; // BULK_CHUNK_SIZE in the firmware
+static const size_t bulkWindow = 4; // BULK_WINDOW in the firmware
+static const int bulkTickMSecs = 20;
+static const uint64_t bulkResendMSecs = 250; // resend a chunk not acknowledged by then
+static const uint64_t bulkGiveUpMSecs = 5000; // fail after this long without progress
+
+MBFirmataClient::MBFirmataClient(EventLoop &loop)
+	: firmwareVersionNumber(257), // 1.1
+	  usePackedStrings(false),
+	  buttonAPressed(false), buttonBPressed(false), isScrolling(false),
+	  accelerometerRange(0), accelerometerPeriod(0), accelerometerSamplesMissed(0),
+	  waveformPlaying(false), configurationSaved(-1), taskErrors(0),
+	  bulkState(BULK_IDLE), bulkChunksResent(0),
+	  radioPacketsReceived(0), radioPacketsSent(0), radioSendsDropped(0), radioPacketsLost(0),
+	  microphoneMode(-1), soundLevel(0), audioBlocksLost(0),
+	  loopIterations(0), loopSleeps(0), loopMicrosAsleep(0), loopMicrosElapsed(0),
+	  loopLatencyMax(0), loopLatencyMean(0),
+	  parser(*this), loop(loop), fd(-1), waitingToWrite(false), recorder(NULL),
+	  lastAudioSequence(-1),
+	  bulkID(msecsNow() & 0x7F), // unlikely to match a transfer left on the board by another client
+	  bulkChunkCount(0), bulkAcked(0), bulkNextChunk(0), bulkStarted(false),
+	  bulkStartTime(0), bulkProgressTime(0), bulkSendCount(0), bulkTimer(-1) {
+
+	memset(digitalInput, 0, sizeof(digitalInput));
+	clearChannelData();
+	updateEventIDs();
+}
+
+MBFirmataClient::~MBFirmataClient() {
+	disconnect();
+}
+
+// Connecting/Disconnecting
+
+bool MBFirmataClient::connect() {
+	// Search for a connected micro:bit and, if found, open that port.
+
+	std::string path = findMicrobitPort();
+	if (path.empty()) {
+		fprintf(stderr, "No micro:bit found; is your board plugged in?\n");
+		return false;
+	}
+	return connect(path);
+}
+
+bool MBFirmataClient::connect(const std::string &path) {
+	int portFD = openSerialPort(path, 57600);
+	if (portFD < 0) return false;
+	if (!setSerialPort(portFD)) return false;
+	boardVersion = boardVersionFromSerialNumber(usbSerialNumber(path));
+	return true;
+}
+
+bool MBFirmataClient::setSerialPort(int portFD) {
+	// Use the given port. Assume the port has been opened by the caller.
+
+	disconnect();
+	fd = portFD;
+	parser.reset();
+	outbuf.clear();
+	waitingToWrite = false;
+	if (!loop.add(fd, EPOLLIN, [this](uint32_t events) {
+			if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) readReady();
+			if ((fd >= 0) && (events & EPOLLOUT)) writeReady();
+		})) {
+		close(fd);
+		fd = -1;
+		return false;
+	}
+	requestFirmataVersion();
+	requestFirmwareVersion();
+	return true;
+}
+
+bool MBFirmataClient::isConnected() const {
+	return fd >= 0;
+}
+
+void MBFirmataClient::disconnect() {
+	// Close and discard the serial port.
+
+	cancelBulkTransfer();
+	if (fd < 0) return;
+	loop.remove(fd);
+	close(fd);
+	fd = -1;
+}
+
+// Internal: Connecting/Disconnecting Support
+
+std::string MBFirmataClient::boardVersionFromSerialNumber(const std::string &usbSerialNumber) {
+	// The micro:bit board version can be determined from the USB device serial number.
+
+	std::string id = usbSerialNumber.substr(0, 4);
+	if ("9900" == id) return "1.3";
+	if ("9901" == id) return "1.5";
+	if ("9903" == id) return "2.0";
+	if ("9904" == id) return "2.0";
+	if ("9905" == id) return "2.20";
+	if ("9906" == id) return "2.21";
+	return "unrecognized board";
+}
+
+void MBFirmataClient::requestFirmataVersion() {
+	sendBytes({FIRMATA_VERSION, 0, 0});
+}
+
+void MBFirmataClient::requestFirmwareVersion() {
+	if (usePackedStrings) {
+		sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_REPORT_FIRMWARE_PACKED, SYSEX_END});
+	} else {
+		sendBytes({SYSEX_START, REPORT_FIRMWARE, SYSEX_END});
+	}
+}
+
+void MBFirmataClient::requestBoardTime(int seq) {
+	// The board replies with seq and its microsecond clock; see addFirmataTimeListener().
+
+	sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_BOARD_TIME, (uint8_t) (seq & 0x7F), SYSEX_END});
+}
+
+void MBFirmataClient::enableSampleTimestamps(bool enableFlag) {
+	// When enabled, each batch of streamed samples is preceded by the board time at which
+	// it was sampled. Time listeners receive these with a seq of -1.
+
+	sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_SAMPLE_TIMESTAMPS,
+		(uint8_t) (enableFlag ? 1 : 0), SYSEX_END});
+}
+
+void MBFirmataClient::requestLoopStats() {
+	// Request the board's main loop statistics, which show how much of the time it sleeps
+	// and how promptly it wakes for sampling deadlines. Each request starts a new period.
+
+	sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_LOOP_STATS, SYSEX_END});
+}
+
+void MBFirmataClient::updateEventIDs() {
+	// The display ID changed between firmware 1.0 (DAL <= 2.1.1) and 1.1 (DAL >= 2.2.0-rc6 and CODAL)
+
+	MICROBIT_ID_DISPLAY = (firmwareVersionNumber >= 257) ? 7 : 6;
+}
+
+// Internal: Serial I/O
+
+void MBFirmataClient::readReady() {
+	// Read directly into the parser's buffer until no more data is available.
+
+	while (fd >= 0) {
+		ssize_t n = read(fd, parser.writeBuffer(), parser.writeSpace());
+		if (n > 0) {
+			if (recorder) recorder->record(SESSION_FROM_BOARD, parser.writeBuffer(), n);
+			parser.commit(n);
+			continue;
+		}
+		if ((n < 0) && ((EAGAIN == errno) || (EINTR == errno))) return;
+		disconnect(); // end of file or error
+		return;
+	}
+}
+
+void MBFirmataClient::writeReady() {
+	while (!outbuf.empty()) {
+		ssize_t n = write(fd, outbuf.data(), outbuf.size());
+		if (n < 0) {
+			if ((EAGAIN == errno) || (EINTR == errno)) break;
+			disconnect();
+			return;
+		}
+		outbuf.erase(outbuf.begin(), outbuf.begin() + n);
+	}
+	bool needWrite = !outbuf.empty();
+	if (needWrite != waitingToWrite) {
+		loop.modify(fd, needWrite ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+		waitingToWrite = needWrite;
+	}
+}
+
+void MBFirmataClient::sendBytes(const uint8_t *data, size_t count) {
+	if (fd < 0) return;
+	if (recorder) recorder->record(SESSION_TO_BOARD, data, count);
+	outbuf.insert(outbuf.end(), data, data + count);
+	if (!waitingToWrite) writeReady();
+}
+
+void MBFirmataClient::sendBytes(std::initializer_list<uint8_t> bytes) {
+	sendBytes(bytes.begin(), bytes.size());
+}
+
+void MBFirmataClient::setRecorder(SessionRecorder *sessionRecorder) {
+	recorder = sessionRecorder;
+}
+
+// Internal: 8-to-7 Bit Packing
+
+std::vector<uint8_t> MBFirmataClient::packData(const uint8_t *data, size_t count) {
+	// Encode 8-bit data using the Firmata 7-bit encoding (seven bytes in eight data bytes).
+
+	std::vector<uint8_t> result;
+	int shift = 0;
+	int previous = 0;
+	for (size_t i = 0; i < count; i++) {
+		uint8_t b = data[i];
+		if (0 == shift) {
+			result.push_back(b & 0x7F);
+			shift = 1;
+			previous = b >> 7;
+		} else {
+			result.push_back(((b << shift) & 0x7F) | previous);
+			if (6 == shift) {
+				result.push_back(b >> 1);
+				shift = 0;
+			} else {
+				shift++;
+				previous = b >> (8 - shift);
+			}
+		}
+	}
+	if (shift > 0) result.push_back(previous);
+	return result;
+}
+
+std::vector<uint8_t> MBFirmataClient::unpackData(const uint8_t *data, size_t count) {
+	std::vector<uint8_t> result((7 * count) >> 3);
+	for (size_t i = 0; i < result.size(); i++) {
+		size_t bitIndex = 8 * i;
+		size_t pos = bitIndex / 7;
+		int shift = bitIndex % 7;
+		result[i] = (data[pos] >> shift) | ((data[pos + 1] << (7 - shift)) & 0xFF);
+	}
+	return result;
+}
+
+// Internal: Handling Messages from the micro:bit
+
+void MBFirmataClient::receivedFirmataVersion(int major, int minor) {
+	firmataVersion = "Firmata Protocol " + std::to_string(major) + "." + std::to_string(minor);
+}
+
+void MBFirmataClient::receivedAnalogUpdate(int chan, int value) {
+	if (value > 8191) value = value - 16384; // negative value (14-bits 2-completement)
+	analogChannel[chan] = value;
+
+	// update stats:
+	analogUpdateCount++;
+	channelUpdateCounts[chan]++;
+
+	for (size_t i = 0; i < channelListeners.size(); i++) channelListeners[i](chan, value);
+	for (size_t i = 0; i < updateListeners.size(); i++) updateListeners[i]();
+}
+
+void MBFirmataClient::receivedDigitalUpdate(int port, int pinMask) {
+	int pinNum = 8 * port;
+	for (int i = 0; i < 8; i++) {
+		if (pinNum < 21) digitalInput[pinNum] = (pinMask & (1 << i)) != 0;
+		pinNum++;
+	}
+	for (size_t i = 0; i < updateListeners.size(); i++) updateListeners[i]();
+}
+
+void MBFirmataClient::receivedSysex(const uint8_t *data, int count) {
+	switch (data[0]) {
+	case MB_REPORT_EVENT:
+		receivedEvent(data, count);
+		break;
+	case MB_DEBUG_STRING:
+		fprintf(stderr, "DB: %.*s\n", count - 1, (const char *) &data[1]);
+		break;
+	case REPORT_FIRMWARE:
+		receivedFirmwareVersion(data, count, false);
+		break;
+	case SCHEDULER_DATA:
+		receivedSchedulerReply(data, count);
+		break;
+	case MB_EXTENDED_SYSEX:
+		if (count < 2) break;
+		if (MB_EXT_REPORT_FIRMWARE_PACKED == data[1]) receivedFirmwareVersion(&data[1], count - 1, true);
+		if ((MB_EXT_BOARD_TIME == data[1]) && (count > 2)) receivedTime(data[2], &data[3], count - 3);
+		if (MB_EXT_SAMPLE_TIMESTAMPS == data[1]) receivedTime(-1, &data[2], count - 2);
+		if (MB_EXT_RADIO_PACKETS == data[1]) receivedRadioPackets(&data[2], count - 2);
+		if (MB_EXT_RADIO_STATS == data[1]) receivedRadioStats(&data[2], count - 2);
+		if (MB_EXT_LOOP_STATS == data[1]) receivedLoopStats(&data[2], count - 2);
+		if ((MB_EXT_SAVE_CONFIG == data[1]) && (count > 2)) configurationSaved = data[2];
+		if ((MB_EXT_MICROPHONE == data[1]) && (count > 2)) microphoneMode = data[2];
+		if (MB_EXT_AUDIO_BLOCK == data[1]) receivedAudioBlock(&data[2], count - 2);
+		if ((MB_EXT_ACCEL_CONFIG == data[1]) && (count > 4)) {
+			accelerometerRange = data[2];
+			accelerometerPeriod = data[3] | (data[4] << 7);
+		}
+		if (MB_EXT_ACCEL_BURST == data[1]) receivedAccelerometerBurst(&data[2], count - 2);
+		if ((MB_EXT_SOUND_LEVEL == data[1]) && (count >= 7)) soundLevel = get32Bits(&data[2]);
+		if (MB_EXT_BULK_ACK == data[1]) receivedBulkAck(&data[2], count - 2);
+		break;
+	}
+	for (size_t i = 0; i < sysexListeners.size(); i++) sysexListeners[i](data, count);
+}
+
+void MBFirmataClient::receivedFirmwareVersion(const uint8_t *data, int count, bool packed) {
+	if (count < 3) return;
+	int major = data[1];
+	int minor = data[2];
+	std::string firmwareName;
+	if (packed) {
+		std::vector<uint8_t> utf8Bytes = unpackData(&data[3], count - 3);
+		firmwareName.assign(utf8Bytes.begin(), utf8Bytes.end());
+	} else {
+		for (int i = 3; i + 1 < count; i += 2) firmwareName += (char) (data[i] | (data[i + 1] << 7));
+	}
+	firmwareVersion = firmwareName + " " + std::to_string(major) + "." + std::to_string(minor);
+	firmwareVersionNumber = (256 * major) + minor;
+	updateEventIDs();
+}
+
+void MBFirmataClient::receivedTime(int seq, const uint8_t *data, int count) {
+	// A 32-bit board time is sent as five 7-bit data bytes, least significant first.
+
+	if (count < 5) return;
+	uint32_t t = get32Bits(data);
+	for (size_t i = 0; i < timeListeners.size(); i++) timeListeners[i](seq, t);
+}
+
+uint32_t MBFirmataClient::get32Bits(const uint8_t *data) {
+	// Return the 32-bit value sent as five 7-bit data bytes, least significant first.
+
+	return data[0] | (data[1] << 7) | (data[2] << 14) | (data[3] << 21) | ((uint32_t) data[4] << 28);
+}
+
+void MBFirmataClient::receivedAudioBlock(const uint8_t *data, int count) {
+	// An audio block: a 7-bit sequence number followed by a packed IMA-ADPCM block.
+
+	if (count < 2) return;
+	int seq = data[0];
+	if (lastAudioSequence >= 0) audioBlocksLost += (seq - lastAudioSequence - 1) & 0x7F;
+	lastAudioSequence = seq;
+	std::vector<uint8_t> block = unpackData(&data[1], count - 1);
+	if ((block.size() > 2) && (block[2] & 0x80)) audioBlocksLost++; // board dropped samples
+	std::vector<int16_t> samples = decodeADPCM(block.data(), block.size());
+	for (size_t i = 0; i < audioListeners.size(); i++) audioListeners[i](samples.data(), samples.size());
+}
+
+std::vector<int16_t> MBFirmataClient::decodeADPCM(const uint8_t *block, size_t count) {
+	// Decode an IMA-ADPCM block: the predictor (16-bit, little-endian) and step index,
+	// then two 4-bit samples per byte, low nibble first. The top bit of the step index
+	// byte is a flag (samples lost), not part of the index.
+
+	static const int16_t stepTable[89] = {
+		7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21,
+		23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66,
+		73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209,
+		230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+		724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+		2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484,
+		7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350,
+		22385, 24623, 27086, 29794, 32767
+	};
+	static const int8_t indexTable[16] = { -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8 };
+
+	std::vector<int16_t> samples;
+	if (count < 3) return samples;
+	int predictor = (int16_t) (block[0] | (block[1] << 8));
+	int index = block[2] & 0x7F;
+	if (index > 88) index = 88;
+	for (size_t i = 3; i < count; i++) {
+		for (int nibble = 0; nibble < 2; nibble++) {
+			int code = nibble ? (block[i] >> 4) : (block[i] & 0xF);
+			int step = stepTable[index];
+			int delta = step >> 3;
+			if (code & 4) delta += step;
+			if (code & 2) delta += step >> 1;
+			if (code & 1) delta += step >> 2;
+			predictor += (code & 8) ? -delta : delta;
+			if (predictor > 32767) predictor = 32767;
+			if (predictor < -32768) predictor = -32768;
+			index += indexTable[code];
+			if (index < 0) index = 0;
+			if (index > 88) index = 88;
+			samples.push_back(predictor);
+		}
+	}
+	return samples;
+}
+
+void MBFirmataClient::receivedAccelerometerBurst(const uint8_t *data, int count) {
+	// A packed burst: the board time of the first sample (usecs), the sample period (msecs),
+	// the sample count, and samples missed, followed by x, y, and z for each sample. See
+	// mbFirmataFirmware.md.
+
+	std::vector<uint8_t> burst = unpackData(data, count);
+	if (burst.size() < 8) return;
+	const uint8_t *b = burst.data();
+	uint32_t t = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t) b[3] << 24);
+	uint32_t periodMicros = 1000 * (b[4] | (b[5] << 8));
+	size_t sampleCount = b[6];
+	accelerometerSamplesMissed += b[7];
+	if (burst.size() < 8 + (6 * sampleCount)) return;
+	for (size_t i = 0; i < sampleCount; i++) {
+		const uint8_t *sample = &b[8 + (6 * i)];
+		int x = (int16_t) (sample[0] | (sample[1] << 8));
+		int y = (int16_t) (sample[2] | (sample[3] << 8));
+		int z = (int16_t) (sample[4] | (sample[5] << 8));
+		for (size_t j = 0; j < accelerometerListeners.size(); j++) accelerometerListeners[j](t, x, y, z);
+		t += periodMicros;
+	}
+}
+
+void MBFirmataClient::receivedRadioPackets(const uint8_t *data, int count) {
+	// A batch of packets: a header (board time of the first packet and packets lost), then
+	// for each packet its length, RSSI, msecs after the first packet, and data. See
+	// mbFirmataFirmware.md.
+
+	std::vector<uint8_t> batch = unpackData(data, count);
+	if (batch.size() < 5) return;
+	uint32_t batchTime;
+	memcpy(&batchTime, batch.data(), 4);
+
+	size_t i = 5;
+	while (i + 4 <= batch.size()) {
+		size_t len = batch[i];
+		if (i + 4 + len > batch.size()) break;
+		RadioPacket packet;
+		packet.boardTime = batchTime + (batch[i + 2] | (batch[i + 3] << 8));
+		packet.rssi = -batch[i + 1];
+		packet.data.assign(&batch[i + 4], &batch[i + 4 + len]);
+		i += 4 + len;
+
+		// decode a MakeCode packet
+		const uint8_t *p = packet.data.data();
+		packet.type = -1;
+		packet.senderTime = packet.senderSerial = 0;
+		packet.intValue = 0;
+		packet.floatValue = 0;
+		if (len >= 9) {
+			memcpy(&packet.senderTime, &p[1], 4);
+			memcpy(&packet.senderSerial, &p[5], 4);
+			size_t stringStart = len;
+			switch (p[0]) {
+			case 0: // integer
+			case 1: // integer pair
+				if (len < 13) break;
+				packet.type = p[0];
+				memcpy(&packet.intValue, &p[9], 4);
+				packet.floatValue = packet.intValue;
+				stringStart = 13;
+				break;
+			case 2: // string
+				packet.type = p[0];
+				stringStart = 9;
+				break;
+			case 4: // float
+			case 5: // float pair
+				if (len < 17) break;
+				packet.type = p[0];
+				memcpy(&packet.floatValue, &p[9], 8);
+				packet.intValue = (int32_t) packet.floatValue;
+				stringStart = 17;
+				break;
+			}
+			if (stringStart < len) {
+				size_t stringLen = std::min((size_t) p[stringStart], len - stringStart - 1);
+				packet.stringValue.assign((const char *) &p[stringStart + 1], stringLen);
+			}
+		}
+		for (size_t j = 0; j < radioListeners.size(); j++) radioListeners[j](packet);
+	}
+}
+
+void MBFirmataClient::receivedRadioStats(const uint8_t *data, int count) {
+	if (count < 20) return;
+	radioPacketsReceived = get32Bits(&data[0]);
+	radioPacketsSent = get32Bits(&data[5]);
+	radioSendsDropped = get32Bits(&data[10]);
+	radioPacketsLost = get32Bits(&data[15]);
+}
+
+void MBFirmataClient::receivedLoopStats(const uint8_t *data, int count) {
+	if (count < 30) return;
+	loopIterations = get32Bits(&data[0]);
+	loopSleeps = get32Bits(&data[5]);
+	loopMicrosAsleep = get32Bits(&data[10]);
+	loopMicrosElapsed = get32Bits(&data[15]);
+	loopLatencyMax = get32Bits(&data[20]);
+	loopLatencyMean = get32Bits(&data[25]);
+}
+
+void MBFirmataClient::receivedSchedulerReply(const uint8_t *data, int count) {
+	// Task replies are a task id followed by the packed task state (run time, length, and
+	// position) and its commands. See mbFirmataFirmware.md.
+
+	if (count < 2) return;
+	if (QUERY_ALL_TASKS_REPLY == data[1]) {
+		taskIDs.assign(&data[2], &data[count]);
+		return;
+	}
+	if ((QUERY_TASK_REPLY != data[1]) && (ERROR_TASK_REPLY != data[1])) return;
+	if (ERROR_TASK_REPLY == data[1]) taskErrors++;
+	if (count < 3) return;
+	std::vector<uint8_t> state = unpackData(&data[3], count - 3);
+	taskInfo.id = data[2];
+	taskInfo.exists = (state.size() >= 8);
+	taskInfo.runTime = taskInfo.exists ? (state[0] | (state[1] << 8) | (state[2] << 16) | ((uint32_t) state[3] << 24)) : 0;
+	taskInfo.length = taskInfo.exists ? (state[4] | (state[5] << 8)) : 0;
+	taskInfo.position = taskInfo.exists ? (state[6] | (state[7] << 8)) : 0;
+	taskInfo.commands.assign(state.begin() + (taskInfo.exists ? 8 : state.size()), state.end());
+}
+
+void MBFirmataClient::receivedBulkAck(const uint8_t *data, int count) {
+	// The acknowledgement gives the next chunk the board needs and a bit for each chunk
+	// from there on that it holds. A chunk that is missing when a chunk sent after it has
+	// arrived was lost or corrupted, so it is resent at once.
+
+	if ((count < 8) || (BULK_SENDING != bulkState) || (data[0] != bulkID)) return;
+	uint16_t crc = crc16(0xFFFF, data, 5);
+	if (crc != (data[5] | (data[6] << 7) | (data[7] << 14))) return; // corrupted
+	int status = data[4];
+	if (BULK_STATUS_COMPLETE == status) {
+		bulkAcked = bulkChunkCount;
+		bulkState = BULK_DONE;
+		cancelBulkTransfer();
+		return;
+	}
+	if (BULK_STATUS_RECEIVING != status) { // the board no longer has the transfer
+		bulkState = BULK_FAILED;
+		cancelBulkTransfer();
+		return;
+	}
+
+	bulkStarted = true;
+	size_t advance = ((data[1] | (data[2] << 7)) - bulkAcked) & 0x3FFF;
+	if (advance > (bulkNextChunk - bulkAcked)) return; // acknowledges chunks not yet sent
+	uint32_t latestArrived = 0; // send order of the latest chunk sent that the board has
+	for (size_t i = bulkAcked; i < bulkAcked + advance; i++) {
+		latestArrived = std::max(latestArrived, bulkSendOrder[i]);
+	}
+	if (advance > 0) bulkProgressTime = msecsNow();
+	bulkAcked += advance;
+	for (size_t i = 0; (i < bulkWindow) && ((bulkAcked + i) < bulkNextChunk); i++) {
+		if (data[3] & (1 << i)) {
+			bulkHeld[bulkAcked + i] = true;
+			latestArrived = std::max(latestArrived, bulkSendOrder[bulkAcked + i]);
+		}
+	}
+	for (size_t i = bulkAcked; i < bulkNextChunk; i++) {
+		if (!bulkHeld[i] && (bulkSendOrder[i] < latestArrived)) {
+			sendBulkChunk(i);
+			bulkChunksResent++;
+		}
+	}
+	while ((bulkNextChunk < bulkChunkCount) && (bulkNextChunk < bulkAcked + bulkWindow)) {
+		sendBulkChunk(bulkNextChunk++);
+	}
+}
+
+void MBFirmataClient::receivedEvent(const uint8_t *data, int count) {
+	const int MICROBIT_ID_BUTTON_A = 1;
+	const int MICROBIT_ID_BUTTON_B = 2;
+	const int MICROBIT_BUTTON_EVT_DOWN = 1;
+	const int MICROBIT_BUTTON_EVT_UP = 2;
+	const int MICROBIT_DISPLAY_EVT_ANIMATION_COMPLETE = 1;
+
+	if (count < 7) return;
+	int sourceID = (data[3] << 14) | (data[2] << 7) | data[1];
+	int eventID = (data[6] << 14) | (data[5] << 7) | data[4];
+
+	if (MICROBIT_ID_BUTTON_A == sourceID) {
+		if (MICROBIT_BUTTON_EVT_DOWN == eventID) buttonAPressed = true;
+		if (MICROBIT_BUTTON_EVT_UP == eventID) buttonAPressed = false;
+	}
+	if (MICROBIT_ID_BUTTON_B == sourceID) {
+		if (MICROBIT_BUTTON_EVT_DOWN == eventID) buttonBPressed = true;
+		if (MICROBIT_BUTTON_EVT_UP == eventID) buttonBPressed = false;
+	}
+	if ((MICROBIT_ID_DISPLAY == sourceID) && (MICROBIT_DISPLAY_EVT_ANIMATION_COMPLETE == eventID)) {
+		isScrolling = false;
+	}
+	if ((MB_WAVEFORM_EVENT_ID == sourceID) && (MB_WAVEFORM_EVT_DONE == eventID)) {
+		waveformPlaying = false;
+	}
+
+	// notify event listeners
+	for (size_t i = 0; i < eventListeners.size(); i++) eventListeners[i](sourceID, eventID);
+}
+
+// Display Commands
+
+void MBFirmataClient::enableDisplay(bool enableFlag) {
+	sendBytes({SYSEX_START, MB_DISPLAY_ENABLE, (uint8_t) (enableFlag ? 1 : 0), SYSEX_END});
+}
+
+void MBFirmataClient::displayClear() {
+	isScrolling = false;
+	sendBytes({SYSEX_START, MB_DISPLAY_CLEAR, SYSEX_END});
+}
+
+void MBFirmataClient::displayShow(bool useGrayscale, const uint8_t pixels[5][5]) {
+	uint8_t msg[29];
+	int i = 0;
+	isScrolling = false;
+	msg[i++] = SYSEX_START;
+	msg[i++] = MB_DISPLAY_SHOW;
+	msg[i++] = useGrayscale ? 1 : 0;
+	for (int y = 0; y < 5; y++) {
+		for (int x = 0; x < 5; x++) {
+			int pix = pixels[y][x];
+			if (pix > 1) pix = pix / 2; // transmit as 7-bits
+			msg[i++] = pix & 0x7F;
+		}
+	}
+	msg[i++] = SYSEX_END;
+	sendBytes(msg, i);
+}
+
+void MBFirmataClient::displayPlot(int x, int y, int brightness) {
+	isScrolling = false;
+	sendBytes({SYSEX_START, MB_DISPLAY_PLOT,
+		(uint8_t) x, (uint8_t) y, (uint8_t) ((brightness / 2) & 0x7F),
+		SYSEX_END});
+}
+
+void MBFirmataClient::scrollString(const std::string &s, int delay) {
+	// The maximum string length is 100 bytes.
+
+	std::string utf8 = s.substr(0, 100);
+	std::vector<uint8_t> msg;
+	isScrolling = true;
+	msg.push_back(SYSEX_START);
+	if (usePackedStrings) {
+		msg.push_back(MB_EXTENDED_SYSEX);
+		msg.push_back(MB_EXT_SCROLL_STRING_PACKED);
+		msg.push_back(delay & 0x7F);
+		std::vector<uint8_t> packed = packData((const uint8_t *) utf8.data(), utf8.size());
+		msg.insert(msg.end(), packed.begin(), packed.end());
+	} else {
+		msg.push_back(MB_SCROLL_STRING);
+		msg.push_back(delay & 0x7F);
+		for (size_t i = 0; i < utf8.size(); i++) {
+			uint8_t b = utf8[i];
+			msg.push_back(b & 0x7F);
+			msg.push_back((b >> 7) & 0x7F);
+		}
+	}
+	msg.push_back(SYSEX_END);
+	sendBytes(msg.data(), msg.size());
+}
+
+void MBFirmataClient::scrollInteger(int n, int delay) {
+	// Note: 32-bit integer is transmitted as five 7-bit data bytes.
+
+	isScrolling = true;
+	sendBytes({SYSEX_START, MB_SCROLL_INTEGER, (uint8_t) (delay & 0x7F),
+		(uint8_t) (n & 0x7F), (uint8_t) ((n >> 7) & 0x7F), (uint8_t) ((n >> 14) & 0x7F),
+		(uint8_t) ((n >> 21) & 0x7F), (uint8_t) ((n >> 28) & 0x7F),
+		SYSEX_END});
+}
+
+// Pin and Sensor Channel Commands
+
+void MBFirmataClient::setPinMode(int pinNum, int mode) {
+	if ((pinNum < 0) || (pinNum > 20)) return;
+	sendBytes({SET_PIN_MODE, (uint8_t) pinNum, (uint8_t) mode});
+}
+
+void MBFirmataClient::trackDigitalPin(int pinNum, int optionalMode) {
+	// The optional mode can be 0 (no pullup or pulldown), 1 (pullup resistor),
+	// or 2 (pulldown resistor). It defaults to 0.
+
+	if ((pinNum < 0) || (pinNum > 20)) return;
+	int port = pinNum >> 3;
+	int mode = DIGITAL_INPUT;
+	if (1 == optionalMode) mode = INPUT_PULLUP;
+	if (2 == optionalMode) mode = INPUT_PULLDOWN;
+	sendBytes({SET_PIN_MODE, (uint8_t) pinNum, (uint8_t) mode});
+	sendBytes({(uint8_t) (STREAM_DIGITAL | port), 1});
+}
+
+void MBFirmataClient::stopTrackingDigitalPins() {
+	for (int i = 0; i < 3; i++) sendBytes({(uint8_t) (STREAM_DIGITAL | i), 0});
+}
+
+void MBFirmataClient::clearChannelData() {
+	memset(analogChannel, 0, sizeof(analogChannel));
+	analogUpdateCount = 0;
+	memset(channelUpdateCounts, 0, sizeof(channelUpdateCounts));
+}
+
+void MBFirmataClient::streamAnalogChannel(int chan) {
+	if ((chan < 0) || (chan > 15)) return;
+	sendBytes({(uint8_t) (STREAM_ANALOG | chan), 1});
+}
+
+void MBFirmataClient::stopStreamingAnalogChannel(int chan) {
+	if ((chan < 0) || (chan > 15)) return;
+	sendBytes({(uint8_t) (STREAM_ANALOG | chan), 0});
+}
+
+void MBFirmataClient::setAnalogSamplingInterval(int samplingMSecs) {
+	if ((samplingMSecs < 1) || (samplingMSecs > 16383)) return;
+	sendBytes({SYSEX_START, SAMPLING_INTERVAL,
+		(uint8_t) (samplingMSecs & 0x7F), (uint8_t) ((samplingMSecs >> 7) & 0x7F),
+		SYSEX_END});
+}
+
+void MBFirmataClient::compassCalibration() {
+	sendBytes({SYSEX_START, MB_COMPASS_CALIBRATE, SYSEX_END});
+}
+
+void MBFirmataClient::enableLightSensor() {
+	sendBytes({SET_PIN_MODE, 11, ANALOG_INPUT});
+}
+
+void MBFirmataClient::setTouchMode(int pinNum, bool touchModeOn) {
+	if ((pinNum < 0) || (pinNum > 2)) return;
+	sendBytes({SYSEX_START, MB_SET_TOUCH_MODE,
+		(uint8_t) pinNum, (uint8_t) (touchModeOn ? 1 : 0),
+		SYSEX_END});
+}
+
+void MBFirmataClient::setHeadingMode(bool headingFlag) {
+	// When on, analog channel 13 reports the tilt-compensated compass heading (0-359 degrees)
+	// instead of the compass x value. Channels 6 and 7 always report pitch and roll.
+
+	sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_HEADING_MODE,
+		(uint8_t) (headingFlag ? 1 : 0), SYSEX_END});
+}
+
+void MBFirmataClient::setAccelerometerConfig(int rangeG, int periodMSecs) {
+	sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_ACCEL_CONFIG, (uint8_t) (rangeG & 0x7F),
+		(uint8_t) (periodMSecs & 0x7F), (uint8_t) ((periodMSecs >> 7) & 0x7F), SYSEX_END});
+}
+
+void MBFirmataClient::streamAccelerometerBursts(int samplesPerBurst) {
+	if (samplesPerBurst < 1) samplesPerBurst = 1;
+	if (samplesPerBurst > 16) samplesPerBurst = 16;
+	sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_ACCEL_STREAM, (uint8_t) samplesPerBurst, SYSEX_END});
+}
+
+void MBFirmataClient::stopAccelerometerBursts() {
+	sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_ACCEL_STREAM, 0, SYSEX_END});
+}
+
+// Digital and Analog Outputs
+
+void MBFirmataClient::setDigitalOutput(int pinNum, bool turnOn) {
+	if ((pinNum < 0) || (pinNum > 20)) return;
+	sendBytes({SET_PIN_MODE, (uint8_t) pinNum, DIGITAL_OUTPUT});
+	sendBytes({SET_DIGITAL_PIN, (uint8_t) pinNum, (uint8_t) (turnOn ? 1 : 0)});
+}
+
+void MBFirmataClient::setAnalogOutput(int pinNum, int level) {
+	if ((pinNum < 0) || (pinNum > 20)) return;
+	sendBytes({SET_PIN_MODE, (uint8_t) pinNum, PWM});
+	sendBytes({SYSEX_START, EXTENDED_ANALOG_WRITE,
+		(uint8_t) pinNum, (uint8_t) (level & 0x7F), (uint8_t) ((level >> 7) & 0x7F),
+		SYSEX_END});
+}
+
+void MBFirmataClient::turnOffOutput(int pinNum) {
+	if ((pinNum < 0) || (pinNum > 20)) return;
+	sendBytes({SET_PIN_MODE, (uint8_t) pinNum, DIGITAL_INPUT});
+}
+
+void MBFirmataClient::setServoOutput(int pinNum, int angle) {
+	if ((pinNum < 0) || (pinNum > 20)) return;
+	sendBytes({SET_PIN_MODE, (uint8_t) pinNum, SERVO});
+	sendBytes({SYSEX_START, EXTENDED_ANALOG_WRITE,
+		(uint8_t) pinNum, (uint8_t) (angle & 0x7F), (uint8_t) ((angle >> 7) & 0x7F),
+		SYSEX_END});
+}
+
+void MBFirmataClient::configureServo(int pinNum, int minPulse, int maxPulse) {
+	if ((pinNum < 0) || (pinNum > 20)) return;
+	sendBytes({SYSEX_START, SERVO_CONFIG, (uint8_t) pinNum,
+		(uint8_t) (minPulse & 0x7F), (uint8_t) ((minPulse >> 7) & 0x7F),
+		(uint8_t) (maxPulse & 0x7F), (uint8_t) ((maxPulse >> 7) & 0x7F), SYSEX_END});
+}
+
+void MBFirmataClient::setAnalogOutputs(const std::vector<std::pair<int, int> > &pinValues) {
+	std::vector<uint8_t> msg = {SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_ANALOG_WRITE_BATCH};
+	for (size_t i = 0; i < pinValues.size(); i++) {
+		int value = pinValues[i].second;
+		msg.push_back(pinValues[i].first & 0x7F);
+		msg.push_back(value & 0x7F);
+		msg.push_back((value >> 7) & 0x7F);
+	}
+	msg.push_back(SYSEX_END);
+	sendBytes(msg.data(), msg.size());
+}
+
+void MBFirmataClient::uploadWaveform(const std::vector<uint16_t> &samples) {
+	// Send the table in chunks that fit the board's input buffer. Each chunk gives its
+	// offset in the table; offset zero starts a new table. The board stops any playback.
+
+	waveformPlaying = false;
+	const size_t chunkSize = 48; // 96 bytes, 110 packed
+	for (size_t offset = 0; (offset == 0) || (offset < samples.size()); offset += chunkSize) {
+		size_t n = std::min(chunkSize, samples.size() - offset);
+		std::vector<uint8_t> bytes;
+		for (size_t i = 0; i < n; i++) {
+			bytes.push_back(samples[offset + i] & 0xFF);
+			bytes.push_back((samples[offset + i] >> 8) & 0xFF);
+		}
+		std::vector<uint8_t> msg = {SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_WAVEFORM_DATA,
+			(uint8_t) (offset & 0x7F), (uint8_t) ((offset >> 7) & 0x7F)};
+		std::vector<uint8_t> packed = packData(bytes.data(), bytes.size());
+		msg.insert(msg.end(), packed.begin(), packed.end());
+		msg.push_back(SYSEX_END);
+		sendBytes(msg.data(), msg.size());
+	}
+}
+
+void MBFirmataClient::playWaveform(int pinNum, int samplesPerSecond, int loops) {
+	if ((pinNum < 0) || (pinNum > 20)) return;
+	sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_WAVEFORM_PLAY, (uint8_t) pinNum,
+		(uint8_t) (samplesPerSecond & 0x7F), (uint8_t) ((samplesPerSecond >> 7) & 0x7F),
+		(uint8_t) ((samplesPerSecond >> 14) & 0x7F),
+		(uint8_t) (loops & 0x7F), (uint8_t) ((loops >> 7) & 0x7F), SYSEX_END});
+	waveformPlaying = (samplesPerSecond > 0);
+}
+
+void MBFirmataClient::stopWaveform() {
+	sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_WAVEFORM_PLAY, 0, 0, 0, 0, SYSEX_END});
+	waveformPlaying = false;
+}
+
+// Saved Configuration
+
+void MBFirmataClient::saveConfiguration() {
+	configurationSaved = -1;
+	sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_SAVE_CONFIG, 1, SYSEX_END});
+}
+
+void MBFirmataClient::eraseConfiguration() {
+	configurationSaved = -1;
+	sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_SAVE_CONFIG, 0, SYSEX_END});
+}
+
+// Scheduler
+
+void MBFirmataClient::createTask(int taskID, const std::vector<uint8_t> &commands) {
+	// Create the task, then add its commands in chunks that fit the board's input buffer.
+
+	int length = commands.size();
+	sendBytes({SYSEX_START, SCHEDULER_DATA, CREATE_FIRMATA_TASK, (uint8_t) (taskID & 0x7F),
+		(uint8_t) (length & 0x7F), (uint8_t) ((length >> 7) & 0x7F), SYSEX_END});
+	const size_t chunkSize = 56; // 64 packed bytes
+	for (size_t i = 0; i < commands.size(); i += chunkSize) {
+		size_t n = std::min(chunkSize, commands.size() - i);
+		std::vector<uint8_t> msg = {SYSEX_START, SCHEDULER_DATA, ADD_TO_FIRMATA_TASK, (uint8_t) (taskID & 0x7F)};
+		std::vector<uint8_t> packed = packData(&commands[i], n);
+		msg.insert(msg.end(), packed.begin(), packed.end());
+		msg.push_back(SYSEX_END);
+		sendBytes(msg.data(), msg.size());
+	}
+}
+
+void MBFirmataClient::scheduleTask(int taskID, uint32_t delayMSecs) {
+	std::vector<uint8_t> msg = {SYSEX_START, SCHEDULER_DATA, SCHEDULE_FIRMATA_TASK, (uint8_t) (taskID & 0x7F)};
+	uint8_t bytes[4] = {(uint8_t) delayMSecs, (uint8_t) (delayMSecs >> 8), (uint8_t) (delayMSecs >> 16), (uint8_t) (delayMSecs >> 24)};
+	std::vector<uint8_t> packed = packData(bytes, 4);
+	msg.insert(msg.end(), packed.begin(), packed.end());
+	msg.push_back(SYSEX_END);
+	sendBytes(msg.data(), msg.size());
+}
+
+void MBFirmataClient::deleteTask(int taskID) {
+	sendBytes({SYSEX_START, SCHEDULER_DATA, DELETE_FIRMATA_TASK, (uint8_t) (taskID & 0x7F), SYSEX_END});
+}
+
+void MBFirmataClient::resetTasks() {
+	sendBytes({SYSEX_START, SCHEDULER_DATA, RESET_FIRMATA_TASKS, SYSEX_END});
+}
+
+void MBFirmataClient::queryAllTasks() {
+	sendBytes({SYSEX_START, SCHEDULER_DATA, QUERY_ALL_FIRMATA_TASKS, SYSEX_END});
+}
+
+void MBFirmataClient::queryTask(int taskID) {
+	taskInfo = SchedulerTask();
+	taskInfo.id = -1;
+	sendBytes({SYSEX_START, SCHEDULER_DATA, QUERY_FIRMATA_TASK, (uint8_t) (taskID & 0x7F), SYSEX_END});
+}
+
+std::vector<uint8_t> MBFirmataClient::delayTaskCommand(uint32_t msecs) {
+	// Return the command that, within a task, delays the rest of the task by msecs.
+	// If it is the task's last command, the task repeats every msecs.
+
+	uint8_t bytes[4] = {(uint8_t) msecs, (uint8_t) (msecs >> 8), (uint8_t) (msecs >> 16), (uint8_t) (msecs >> 24)};
+	std::vector<uint8_t> cmd = {SYSEX_START, SCHEDULER_DATA, DELAY_FIRMATA_TASK};
+	std::vector<uint8_t> packed = packData(bytes, 4);
+	cmd.insert(cmd.end(), packed.begin(), packed.end());
+	cmd.push_back(SYSEX_END);
+	return cmd;
+}
+
+// Bulk Transfer
+
+void MBFirmataClient::sendBulkTransfer(const std::vector<uint8_t> &commands) {
+	// Start the transfer. The rest is driven by the board's acknowledgements and a timer.
+
+	cancelBulkTransfer();
+	bulkData = commands;
+	bulkID = (bulkID + 1) & 0x7F;
+	bulkChunkCount = (commands.size() + bulkChunkSize - 1) / bulkChunkSize;
+	bulkAcked = bulkNextChunk = 0;
+	bulkStarted = false;
+	bulkHeld.assign(bulkChunkCount, false);
+	bulkSendTime.assign(bulkChunkCount, 0);
+	bulkSendOrder.assign(bulkChunkCount, 0);
+	bulkSendCount = 0;
+	bulkChunksResent = 0;
+	bulkState = BULK_SENDING;
+	bulkProgressTime = msecsNow();
+	sendBulkStart();
+	bulkTimer = loop.addTimer(bulkTickMSecs, [this]() { checkBulkTimeouts(); }, true);
+}
+
+void MBFirmataClient::cancelBulkTransfer() {
+	// Stop sending. The board keeps what it has received until the next transfer starts.
+
+	if (bulkTimer >= 0) loop.cancelTimer(bulkTimer);
+	bulkTimer = -1;
+	if (BULK_SENDING == bulkState) bulkState = BULK_IDLE;
+}
+
+void MBFirmataClient::sendBulkStart() {
+	uint32_t length = bulkData.size();
+	uint8_t bytes[6] = {(uint8_t) length, (uint8_t) (length >> 8), (uint8_t) (length >> 16), (uint8_t) (length >> 24)};
+	uint8_t id = bulkID;
+	uint16_t crc = crc16(crc16(0xFFFF, &id, 1), bytes, 4);
+	bytes[4] = crc & 0xFF;
+	bytes[5] = crc >> 8;
+	std::vector<uint8_t> msg = {SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_BULK_START, id};
+	std::vector<uint8_t> packed = packData(bytes, 6);
+	msg.insert(msg.end(), packed.begin(), packed.end());
+	msg.push_back(SYSEX_END);
+	sendBytes(msg.data(), msg.size());
+	bulkStartTime = msecsNow();
+}
+
+void MBFirmataClient::sendBulkChunk(size_t chunk) {
+	// Send a chunk of the command stream. Its CRC covers the id and chunk number bytes,
+	// then the data.
+
+	size_t offset = chunk * bulkChunkSize;
+	size_t n = std::min(bulkChunkSize, bulkData.size() - offset);
+	uint8_t header[3] = {(uint8_t) bulkID, (uint8_t) (chunk & 0x7F), (uint8_t) ((chunk >> 7) & 0x7F)};
+	std::vector<uint8_t> bytes(&bulkData[offset], &bulkData[offset + n]);
+	uint16_t crc = crc16(crc16(0xFFFF, header, 3), bytes.data(), n);
+	bytes.push_back(crc & 0xFF);
+	bytes.push_back(crc >> 8);
+	std::vector<uint8_t> msg = {SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_BULK_CHUNK, header[0], header[1], header[2]};
+	std::vector<uint8_t> packed = packData(bytes.data(), bytes.size());
+	msg.insert(msg.end(), packed.begin(), packed.end());
+	msg.push_back(SYSEX_END);
+	sendBytes(msg.data(), msg.size());
+	bulkSendTime[chunk] = msecsNow();
+	bulkSendOrder[chunk] = ++bulkSendCount;
+}
+
+void MBFirmataClient::checkBulkTimeouts() {
+	// Resend the start or any chunk not acknowledged in time (e.g. the last chunk sent,
+	// which has no later chunk to reveal its loss), and give up if the board stops responding.
+
+	uint64_t t = msecsNow();
+	if (t - bulkProgressTime > bulkGiveUpMSecs) {
+		bulkState = BULK_FAILED;
+		cancelBulkTransfer();
+		return;
+	}
+	if (!bulkStarted) {
+		if (t - bulkStartTime > bulkResendMSecs) sendBulkStart();
+		return;
+	}
+	for (size_t i = bulkAcked; i < bulkNextChunk; i++) {
+		if (!bulkHeld[i] && (t - bulkSendTime[i] > bulkResendMSecs)) {
+			sendBulkChunk(i);
+			bulkChunksResent++;
+		}
+	}
+}
+
+uint16_t MBFirmataClient::crc16(uint16_t crc, const uint8_t *data, size_t count) {
+	// Update a CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF) with the given data.
+
+	for (size_t i = 0; i < count; i++) {
+		crc ^= data[i] << 8;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+		}
+	}
+	return crc;
+}
+
+uint64_t MBFirmataClient::msecsNow() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Radio
+
+void MBFirmataClient::radioEnable(bool enableFlag) {
+	sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_RADIO_ENABLE, (uint8_t) (enableFlag ? 1 : 0), SYSEX_END});
+}
+
+void MBFirmataClient::radioSetGroup(int group) {
+	sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_RADIO_GROUP,
+		(uint8_t) (group & 0x7F), (uint8_t) ((group >> 7) & 1), SYSEX_END});
+}
+
+void MBFirmataClient::radioSetPower(int power) {
+	sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_RADIO_POWER, (uint8_t) (power & 7), SYSEX_END});
+}
+
+void MBFirmataClient::radioSetChannel(int channel) {
+	sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_RADIO_CHANNEL, (uint8_t) (channel & 0x7F), SYSEX_END});
+}
+
+void MBFirmataClient::radioSetBatchInterval(int msecs) {
+	// The board holds received packets for up to msecs to batch them; zero sends each at once.
+
+	sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_RADIO_BATCH_INTERVAL,
+		(uint8_t) (msecs & 0x7F), (uint8_t) ((msecs >> 7) & 0x7F), SYSEX_END});
+}
+
+void MBFirmataClient::sendRadioValue(int cmd, uint64_t value, int valueBytes, const std::string &s, size_t maxLen) {
+	// Send a radio command with an optional value (valueBytes 7-bit data bytes, LSB first)
+	// followed by an optional string (two data bytes per byte).
+
+	std::vector<uint8_t> msg = {SYSEX_START, MB_EXTENDED_SYSEX, (uint8_t) cmd};
+	for (int i = 0; i < valueBytes; i++) msg.push_back((value >> (7 * i)) & 0x7F);
+	std::string utf8 = s.substr(0, maxLen);
+	for (size_t i = 0; i < utf8.size(); i++) {
+		uint8_t b = utf8[i];
+		msg.push_back(b & 0x7F);
+		msg.push_back((b >> 7) & 0x7F);
+	}
+	msg.push_back(SYSEX_END);
+	sendBytes(msg.data(), msg.size());
+}
+
+void MBFirmataClient::radioSendString(const std::string &s) {
+	sendRadioValue(MB_EXT_RADIO_SEND_STRING, 0, 0, s, 19);
+}
+
+void MBFirmataClient::radioSendInteger(int32_t n) {
+	sendRadioValue(MB_EXT_RADIO_SEND_INTEGER, (uint32_t) n, 5, "", 0);
+}
+
+void MBFirmataClient::radioSendFloat(double n) {
+	uint64_t bits;
+	memcpy(&bits, &n, 8);
+	sendRadioValue(MB_EXT_RADIO_SEND_FLOAT, bits, 10, "", 0);
+}
+
+void MBFirmataClient::radioSendPair(const std::string &name, int32_t n) {
+	sendRadioValue(MB_EXT_RADIO_SEND_PAIR_INTEGER, (uint32_t) n, 5, name, 8);
+}
+
+void MBFirmataClient::radioSendPair(const std::string &name, double n) {
+	uint64_t bits;
+	memcpy(&bits, &n, 8);
+	sendRadioValue(MB_EXT_RADIO_SEND_PAIR_FLOAT, bits, 10, name, 8);
+}
+
+void MBFirmataClient::radioSendPacket(const uint8_t *data, size_t count) {
+	// Send a complete radio packet (up to 32 bytes).
+
+	std::vector<uint8_t> msg = {SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_RADIO_SEND_PACKET};
+	std::vector<uint8_t> packed = packData(data, std::min(count, (size_t) 32));
+	msg.insert(msg.end(), packed.begin(), packed.end());
+	msg.push_back(SYSEX_END);
+	sendBytes(msg.data(), msg.size());
+}
+
+void MBFirmataClient::requestRadioStats() {
+	sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_RADIO_STATS, SYSEX_END});
+}
+
+// Microphone
+
+void MBFirmataClient::startMicrophone(int sampleRate) {
+	sendMicrophoneMode(MIC_AUDIO, sampleRate, 0);
+}
+
+void MBFirmataClient::startSoundLevel(int sampleRate, int windowMSecs) {
+	sendMicrophoneMode(MIC_LEVEL, sampleRate, windowMSecs);
+}
+
+void MBFirmataClient::stopMicrophone() {
+	sendMicrophoneMode(MIC_OFF, 0, 0);
+}
+
+void MBFirmataClient::sendMicrophoneMode(int mode, int sampleRate, int windowMSecs) {
+	microphoneMode = -1;
+	lastAudioSequence = -1;
+	sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_MICROPHONE, (uint8_t) mode,
+		(uint8_t) (sampleRate & 0x7F), (uint8_t) ((sampleRate >> 7) & 0x7F),
+		(uint8_t) (windowMSecs & 0x7F), (uint8_t) ((windowMSecs >> 7) & 0x7F),
+		SYSEX_END});
+}
+
+// Event/Update Listeners
+
+void MBFirmataClient::addFirmataEventListener(EventListener listener) {
+	eventListeners.push_back(listener);
+}
+
+void MBFirmataClient::addFirmataUpdateListener(UpdateListener listener) {
+	updateListeners.push_back(listener);
+}
+
+void MBFirmataClient::addFirmataSysexListener(SysexListener listener) {
+	sysexListeners.push_back(listener);
+}
+
+void MBFirmataClient::addFirmataChannelListener(ChannelListener listener) {
+	channelListeners.push_back(listener);
+}
+
+void MBFirmataClient::addFirmataTimeListener(TimeListener listener) {
+	timeListeners.push_back(listener);
+}
+
+void MBFirmataClient::addFirmataRadioListener(RadioListener listener) {
+	radioListeners.push_back(listener);
+}
+
+void MBFirmataClient::addFirmataAudioListener(AudioListener listener) {
+	audioListeners.push_back(listener);
+}
+
+void MBFirmataClient::addFirmataAccelerometerListener(AccelerometerListener listener) {
+	accelerometerListeners.push_back(listener);
+}
+
+void MBFirmataClient::removeAllFirmataListeners() {
+	eventListeners.clear();
+	updateListeners.clear();
+	sysexListeners.clear();
+	channelListeners.clear();
+	timeListeners.clear();
+	radioListeners.clear();
+	audioListeners.clear();
+	accelerometerListeners.clear();
+}
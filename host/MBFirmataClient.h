@@ -0,0 +1,346 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// MBFirmataClient: a C++ client for BBC micro:bit Firmata.
+//
+// This mirrors the Javascript client (client/MBFirmataClient.js); see firmataClient.md.
+//
+// Use connect() to connect to a board (serial ports are scanned for a connected micro:bit),
+// or setSerialPort() to provide your own serial port (e.g. a pseudo-terminal attached to
+// the simulated firmware in host/sim).
+//
+// All I/O is non-blocking and is driven by the EventLoop passed to the constructor.
+// Listeners are called from the event loop.
+
+#pragma once
+
+#include "EventLoop.h"
+#include "FirmataParser.h"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+class SessionRecorder;
+
+// A radio packet relayed by the board. The MakeCode fields are decoded if the packet is a
+// MakeCode radio packet (type >= 0).
+struct RadioPacket {
+	uint32_t boardTime; // msecs (board clock) when the relaying board received the packet
+	int rssi; // dBm
+	std::vector<uint8_t> data; // the complete packet
+
+	int type; // MakeCode packet type (0 integer, 1 pair, 2 string, 4 float, 5 float pair), or -1
+	uint32_t senderTime; // msecs (sender's clock)
+	uint32_t senderSerial;
+	int32_t intValue;
+	double floatValue;
+	std::string stringValue; // string, or name of a pair
+};
+
+// The state of a task stored on the board (see queryTask()).
+struct SchedulerTask {
+	int id;
+	bool exists;
+	uint32_t runTime; // msecs (board clock) when it runs next, if scheduled
+	int length;
+	int position; // where it resumes after a delay
+	std::vector<uint8_t> commands;
+};
+
+class MBFirmataClient : private FirmataParser::Listener {
+  public:
+	typedef std::function<void(int sourceID, int eventID)> EventListener;
+	typedef std::function<void()> UpdateListener;
+	typedef std::function<void(const uint8_t *data, int count)> SysexListener;
+	typedef std::function<void(int chan, int value)> ChannelListener;
+	typedef std::function<void(int seq, uint32_t boardMicros)> TimeListener;
+	typedef std::function<void(const RadioPacket &packet)> RadioListener;
+	typedef std::function<void(const int16_t *samples, int count)> AudioListener;
+	typedef std::function<void(uint32_t boardMicros, int x, int y, int z)> AccelerometerListener;
+
+	explicit MBFirmataClient(EventLoop &loop);
+	~MBFirmataClient();
+
+	// Connecting/Disconnecting
+
+	bool connect();
+	bool connect(const std::string &path);
+	bool setSerialPort(int fd); // takes ownership of fd, which must be non-blocking
+	bool isConnected() const;
+	void disconnect();
+
+	// Version Information
+
+	std::string boardVersion;
+	std::string firmataVersion;
+	std::string firmwareVersion;
+	int firmwareVersionNumber;
+
+	// Set to true before connecting to use the packed string encoding.
+	bool usePackedStrings;
+
+	// Buttons and Display State
+
+	bool buttonAPressed;
+	bool buttonBPressed;
+	bool isScrolling;
+
+	// Inputs
+
+	bool digitalInput[21];
+	int analogChannel[16];
+
+	// statistics:
+	int analogUpdateCount;
+	int channelUpdateCounts[16];
+
+	// Display Commands
+
+	void enableDisplay(bool enableFlag);
+	void displayClear();
+	void displayShow(bool useGrayscale, const uint8_t pixels[5][5]);
+	void displayPlot(int x, int y, int brightness);
+	void scrollString(const std::string &s, int delay = 120);
+	void scrollInteger(int n, int delay = 120);
+
+	// Pin and Sensor Channel Commands
+
+	void setPinMode(int pinNum, int mode);
+	void trackDigitalPin(int pinNum, int optionalMode = 0);
+	void stopTrackingDigitalPins();
+	void clearChannelData();
+	void streamAnalogChannel(int chan);
+	void stopStreamingAnalogChannel(int chan);
+	void setAnalogSamplingInterval(int samplingMSecs);
+	void compassCalibration();
+	void enableLightSensor();
+	void setTouchMode(int pinNum, bool touchModeOn);
+	void setHeadingMode(bool headingFlag); // channel 13 reports heading instead of compass x
+
+	// Accelerometer range (g) and sample period (msecs); zero leaves a setting unchanged.
+	// The board replies with the values the sensor actually uses.
+	void setAccelerometerConfig(int rangeG, int periodMSecs);
+	int accelerometerRange; // zero until the first reply
+	int accelerometerPeriod;
+
+	// Stream every accelerometer sample (at the sample period) to accelerometer listeners,
+	// sent in bursts of the given number of samples (1-16).
+	void streamAccelerometerBursts(int samplesPerBurst);
+	void stopAccelerometerBursts();
+	uint32_t accelerometerSamplesMissed; // samples the board missed while streaming bursts
+
+	// Digital and Analog Outputs
+
+	void setDigitalOutput(int pinNum, bool turnOn);
+	void setAnalogOutput(int pinNum, int level);
+	void turnOffOutput(int pinNum);
+
+	// Servo angles are 0-180 degrees; values of 544 or more are pulse widths in usecs.
+	// configureServo() sets the pulse widths for 0 and 180 degrees (default 544 and 2400).
+	void setServoOutput(int pinNum, int angle);
+	void configureServo(int pinNum, int minPulse, int maxPulse);
+
+	// Set several PWM or servo outputs (pin, value) at once, e.g. all the joints of a robot.
+	// The pins must already be in PWM or servo mode.
+	void setAnalogOutputs(const std::vector<std::pair<int, int> > &pinValues);
+
+	// The board plays an uploaded table of PWM values (0-1023, up to 256 of them) on a pin
+	// at the given rate (up to 10000 samples/sec) with its own clock. It repeats the table
+	// the given number of times (0 means until stopped), then sends an event with source
+	// MB_WAVEFORM_EVENT_ID, which clears waveformPlaying. Uploading a table stops playback.
+	void uploadWaveform(const std::vector<uint16_t> &samples);
+	void playWaveform(int pinNum, int samplesPerSecond, int loops = 1);
+	void stopWaveform();
+	bool waveformPlaying;
+
+	// Saved Configuration
+
+	// Save the pin modes, streamed channels and ports, sampling interval, and display state
+	// on the board. The board restores them when it starts, so streaming begins at once.
+	void saveConfiguration();
+	void eraseConfiguration();
+	int configurationSaved; // reply to the last save/erase: 1 done, 0 failed, -1 no reply yet
+
+	// Scheduler
+
+	// Tasks are Firmata command sequences stored on the board, which runs them by itself
+	// at the scheduled time. A task whose commands end with delayTaskCommand() repeats,
+	// so periodic control loops keep their timing without host round-trips.
+	void createTask(int taskID, const std::vector<uint8_t> &commands);
+	void scheduleTask(int taskID, uint32_t delayMSecs);
+	void deleteTask(int taskID);
+	void resetTasks();
+	void queryAllTasks();
+	void queryTask(int taskID);
+	static std::vector<uint8_t> delayTaskCommand(uint32_t msecs);
+	std::vector<int> taskIDs; // reply to queryAllTasks()
+	SchedulerTask taskInfo; // reply to queryTask()
+	uint32_t taskErrors; // tasks that could not be created, added to, or run
+
+	// Bulk Transfer
+
+	// Send a long Firmata command stream (e.g. waveform, task, or display uploads) reliably
+	// over a noisy serial line. It is sent in numbered chunks with CRCs, a few at a time. The
+	// board acknowledges the chunks it has and runs the commands in order, and only lost or
+	// corrupted chunks are resent. bulkState is BULK_SENDING until the board has run all the
+	// commands (BULK_DONE) or stops responding (BULK_FAILED).
+	enum BulkState { BULK_IDLE, BULK_SENDING, BULK_DONE, BULK_FAILED };
+	void sendBulkTransfer(const std::vector<uint8_t> &commands);
+	void cancelBulkTransfer();
+	BulkState bulkState;
+	uint32_t bulkChunksResent; // in the current or last transfer
+
+	// Radio
+
+	void radioEnable(bool enableFlag);
+	void radioSetGroup(int group);
+	void radioSetPower(int power);
+	void radioSetChannel(int channel);
+	void radioSetBatchInterval(int msecs);
+	void radioSendString(const std::string &s);
+	void radioSendInteger(int32_t n);
+	void radioSendFloat(double n);
+	void radioSendPair(const std::string &name, int32_t n);
+	void radioSendPair(const std::string &name, double n);
+	void radioSendPacket(const uint8_t *data, size_t count);
+	void requestRadioStats();
+
+	// radio statistics (updated by requestRadioStats()):
+	uint32_t radioPacketsReceived;
+	uint32_t radioPacketsSent;
+	uint32_t radioSendsDropped;
+	uint32_t radioPacketsLost;
+
+	// Microphone (V2 board only)
+
+	// Stream microphone audio as IMA-ADPCM blocks, decoded and passed to audio listeners.
+	// A rate of 8000 samples/sec or less fits in the default 57600 baud serial link.
+	void startMicrophone(int sampleRate = 8000);
+	// Stream only the RMS sound level, once per window; much cheaper than audio.
+	void startSoundLevel(int sampleRate = 8000, int windowMSecs = 50);
+	void stopMicrophone();
+	int microphoneMode; // reply to the last start/stop: MIC_AUDIO, MIC_LEVEL, MIC_OFF (no microphone), or -1
+	int soundLevel; // RMS level of the last window (16-bit sample scale)
+	uint32_t audioBlocksLost; // audio blocks missed by the client or samples dropped by the board
+
+	// Event/Update Listeners
+
+	void addFirmataEventListener(EventListener listener);
+	void addFirmataUpdateListener(UpdateListener listener);
+	void addFirmataSysexListener(SysexListener listener); // all sysex messages, unparsed
+	void addFirmataChannelListener(ChannelListener listener); // each analog channel update
+	void addFirmataTimeListener(TimeListener listener); // seq is -1 for sample timestamps
+	void addFirmataRadioListener(RadioListener listener);
+	void addFirmataAudioListener(AudioListener listener); // decoded microphone samples
+	void addFirmataAccelerometerListener(AccelerometerListener listener); // each burst sample
+	void removeAllFirmataListeners();
+
+	// Low level
+
+	void requestFirmataVersion();
+	void requestFirmwareVersion();
+	void requestBoardTime(int seq);
+	void enableSampleTimestamps(bool enableFlag);
+	void requestLoopStats();
+
+	// main loop statistics since the previous request (updated by requestLoopStats()):
+	uint32_t loopIterations;
+	uint32_t loopSleeps;
+	uint32_t loopMicrosAsleep;
+	uint32_t loopMicrosElapsed;
+	uint32_t loopLatencyMax; // usecs from a deadline to the loop iteration that handles it
+	uint32_t loopLatencyMean;
+	void sendBytes(const uint8_t *data, size_t count);
+	void sendBytes(std::initializer_list<uint8_t> bytes);
+	void setRecorder(SessionRecorder *recorder); // record all serial traffic (NULL to stop)
+	static std::vector<uint8_t> packData(const uint8_t *data, size_t count);
+	static std::vector<uint8_t> unpackData(const uint8_t *data, size_t count);
+	static std::vector<int16_t> decodeADPCM(const uint8_t *block, size_t count); // unpacked audio block
+
+	FirmataParser parser;
+
+  private:
+	// FirmataParser::Listener
+	void receivedFirmataVersion(int major, int minor);
+	void receivedAnalogUpdate(int chan, int value);
+	void receivedDigitalUpdate(int port, int pinMask);
+	void receivedSysex(const uint8_t *data, int count);
+
+	void receivedFirmwareVersion(const uint8_t *data, int count, bool packed);
+	void receivedEvent(const uint8_t *data, int count);
+	void receivedTime(int seq, const uint8_t *data, int count);
+	void receivedRadioPackets(const uint8_t *data, int count);
+	void receivedRadioStats(const uint8_t *data, int count);
+	void receivedLoopStats(const uint8_t *data, int count);
+	void receivedSchedulerReply(const uint8_t *data, int count);
+	void receivedBulkAck(const uint8_t *data, int count);
+	void receivedAudioBlock(const uint8_t *data, int count);
+	void receivedAccelerometerBurst(const uint8_t *data, int count);
+	void sendMicrophoneMode(int mode, int sampleRate, int windowMSecs);
+	void sendRadioValue(int cmd, uint64_t value, int valueBytes, const std::string &s, size_t maxLen);
+	void sendBulkStart();
+	void sendBulkChunk(size_t chunk);
+	void checkBulkTimeouts();
+	static uint16_t crc16(uint16_t crc, const uint8_t *data, size_t count);
+	static uint64_t msecsNow();
+	static uint32_t get32Bits(const uint8_t *data);
+	void updateEventIDs();
+	void readReady();
+	void writeReady();
+	static std::string boardVersionFromSerialNumber(const std::string &usbSerialNumber);
+
+	EventLoop &loop;
+	int fd;
+	std::vector<uint8_t> outbuf;
+	bool waitingToWrite;
+	SessionRecorder *recorder;
+
+	int MICROBIT_ID_DISPLAY;
+	int lastAudioSequence; // -1 before the first audio block
+
+	std::vector<uint8_t> bulkData;
+	int bulkID;
+	size_t bulkChunkCount;
+	size_t bulkAcked; // chunks before this one have been run by the board
+	size_t bulkNextChunk; // the next chunk not yet sent
+	bool bulkStarted; // the board has acknowledged the start
+	uint64_t bulkStartTime; // msecs when the start was last sent
+	uint64_t bulkProgressTime; // msecs of the last acknowledgement that made progress
+	std::vector<bool> bulkHeld; // chunks the board holds, waiting for earlier ones
+	std::vector<uint64_t> bulkSendTime; // msecs when each chunk was last sent
+	std::vector<uint32_t> bulkSendOrder; // value of bulkSendCount when each chunk was last sent
+	uint32_t bulkSendCount;
+	int bulkTimer; // -1 when not sending
+
+	std::vector<EventListener> eventListeners;
+	std::vector<UpdateListener> updateListeners;
+	std::vector<SysexListener> sysexListeners;
+	std::vector<ChannelListener> channelListeners;
+	std::vector<TimeListener> timeListeners;
+	std::vector<RadioListener> radioListeners;
+	std::vector<AudioListener> audioListeners;
+	std::vector<AccelerometerListener> accelerometerListeners;
+};
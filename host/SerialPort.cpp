@@ -0,0 +1,125 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "SerialPort.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+static speed_t baudConstant(int baud) {
+	switch (baud) {
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 115200: return B115200;
+	case 230400: return B230400;
+	}
+	return B57600;
+}
+
+int openSerialPort(const std::string &path, int baud) {
+	int fd = open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) return -1;
+
+	struct termios tio;
+	if (tcgetattr(fd, &tio) == 0) {
+		cfmakeraw(&tio);
+		cfsetispeed(&tio, baudConstant(baud));
+		cfsetospeed(&tio, baudConstant(baud));
+		tio.c_cflag |= CLOCAL | CREAD;
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+	return fd;
+}
+
+static std::string readSysfsAttribute(const std::string &ttyName, const char *attribute) {
+	// USB attributes live in the parent of the tty's interface directory.
+
+	std::ifstream in("/sys/class/tty/" + ttyName + "/device/../" + attribute);
+	std::string value;
+	std::getline(in, value);
+	return value;
+}
+
+static std::string ttyName(const std::string &path) {
+	char resolved[PATH_MAX];
+	std::string p = realpath(path.c_str(), resolved) ? resolved : path;
+	size_t slash = p.rfind('/');
+	return (slash == std::string::npos) ? p : p.substr(slash + 1);
+}
+
+int openPseudoTerminal(std::string &slavePath, int *slaveFd) {
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0) return -1;
+	if ((grantpt(master) < 0) || (unlockpt(master) < 0)) {
+		close(master);
+		return -1;
+	}
+	slavePath = ptsname(master);
+	int slave = open(slavePath.c_str(), O_RDWR | O_NOCTTY);
+	if (slave < 0) {
+		close(master);
+		return -1;
+	}
+	struct termios tio;
+	tcgetattr(slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+	fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+	*slaveFd = slave;
+	return master;
+}
+
+std::string findMicrobitPort() {
+	std::vector<std::string> ports = findMicrobitPorts();
+	return ports.empty() ? "" : ports[0];
+}
+
+std::vector<std::string> findMicrobitPorts() {
+	DIR *dir = opendir("/sys/class/tty");
+	if (!dir) return std::vector<std::string>();
+	std::vector<std::string> result;
+	while (struct dirent *entry = readdir(dir)) {
+		std::string name = entry->d_name;
+		std::string vendor = readSysfsAttribute(name, "idVendor");
+		std::string product = readSysfsAttribute(name, "idProduct");
+		if (((vendor == "0d28") || (vendor == "0D28")) && (product == "0204")) {
+			result.push_back("/dev/" + name);
+		}
+	}
+	closedir(dir);
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+std::string usbSerialNumber(const std::string &path) {
+	return readSysfsAttribute(ttyName(path), "serial");
+}
@@ -0,0 +1,49 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Serial port helpers for host clients.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Open the given serial device in raw, non-blocking mode at the given baud rate.
+// Return the file descriptor, or -1 on failure.
+int openSerialPort(const std::string &path, int baud = 57600);
+
+// Open a pseudo-terminal in raw mode, for tools that present a serial port to clients.
+// Return the non-blocking master fd and set slavePath. The slave side is also opened (and
+// returned in slaveFd) so that its settings persist when clients close it.
+int openPseudoTerminal(std::string &slavePath, int *slaveFd);
+
+// Return the device path of the first connected micro:bit, or an empty string if none.
+std::string findMicrobitPort();
+
+// Return the device paths of all connected micro:bits, sorted by path.
+std::vector<std::string> findMicrobitPorts();
+
+// Return the USB serial number of the given serial device, or an empty string if unknown
+// (e.g. for a pseudo-terminal).
+std::string usbSerialNumber(const std::string &path);
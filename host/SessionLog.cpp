@@ -0,0 +1,156 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "SessionLog.h"
+
+#include <chrono>
+#include <cstring>
+
+static const char magic[4] = {'M', 'B', 'F', 'S'};
+static const int formatVersion = 1;
+
+// SessionRecorder
+
+SessionRecorder::SessionRecorder()
+	: recordCount(0), bytesRecorded(0), file(NULL), startTime(0), lastTime(0) {
+}
+
+SessionRecorder::~SessionRecorder() {
+	close();
+}
+
+int64_t SessionRecorder::micros() const {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+bool SessionRecorder::open(const std::string &path) {
+	close();
+	file = fopen(path.c_str(), "wb");
+	if (!file) return false;
+	startTime = lastTime = micros();
+	fwrite(magic, 1, sizeof(magic), file);
+	fputc(formatVersion, file);
+	for (int i = 0; i < 8; i++) fputc((startTime >> (8 * i)) & 0xFF, file);
+	recordCount = bytesRecorded = 0;
+	return true;
+}
+
+void SessionRecorder::writeVarint(uint64_t n) {
+	while (n >= 0x80) {
+		fputc((n & 0x7F) | 0x80, file);
+		n >>= 7;
+	}
+	fputc(n, file);
+}
+
+void SessionRecorder::record(int direction, const uint8_t *data, size_t count) {
+	if (!file || (0 == count)) return;
+	int64_t t = micros();
+	int64_t delta = (t > lastTime) ? t - lastTime : 0;
+	lastTime += delta;
+	writeVarint((delta << 1) | (direction & 1));
+	writeVarint(count);
+	fwrite(data, 1, count, file);
+	recordCount++;
+	bytesRecorded += count;
+}
+
+void SessionRecorder::flush() {
+	if (file) fflush(file);
+}
+
+void SessionRecorder::close() {
+	if (!file) return;
+	fclose(file);
+	file = NULL;
+}
+
+// SessionReader
+
+SessionReader::SessionReader() : startTime(0), file(NULL), time(0) {
+}
+
+SessionReader::~SessionReader() {
+	close();
+}
+
+bool SessionReader::open(const std::string &path) {
+	close();
+	file = fopen(path.c_str(), "rb");
+	if (!file) return false;
+	char header[4];
+	if ((fread(header, 1, sizeof(header), file) != sizeof(header)) ||
+		(0 != memcmp(header, magic, sizeof(magic))) ||
+		(fgetc(file) != formatVersion)) {
+			close();
+			return false;
+	}
+	startTime = 0;
+	for (int i = 0; i < 8; i++) {
+		int b = fgetc(file);
+		if (b < 0) {
+			close();
+			return false;
+		}
+		startTime |= (int64_t) b << (8 * i);
+	}
+	time = 0;
+	return true;
+}
+
+bool SessionReader::readVarint(uint64_t &n) {
+	n = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int b = fgetc(file);
+		if (b < 0) return false;
+		n |= (uint64_t) (b & 0x7F) << shift;
+		if (!(b & 0x80)) return true;
+	}
+	return false;
+}
+
+bool SessionReader::next(SessionRecord &record) {
+	uint64_t header, count;
+	if (!file || !readVarint(header) || !readVarint(count)) return false;
+	time += header >> 1;
+	record.time = time;
+	record.direction = header & 1;
+	record.data.resize(count);
+	return fread(record.data.data(), 1, count, file) == count;
+}
+
+void SessionReader::close() {
+	if (!file) return;
+	fclose(file);
+	file = NULL;
+}
+
+bool SessionReader::readAll(const std::string &path, std::vector<SessionRecord> &records) {
+	SessionReader reader;
+	if (!reader.open(path)) return false;
+	SessionRecord record;
+	while (reader.next(record)) records.push_back(record);
+	return true;
+}
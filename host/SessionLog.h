@@ -0,0 +1,94 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// SessionLog: recording and reading both directions of a Firmata session.
+//
+// A recording is a compact binary file:
+//
+//   header:  "MBFS", format version (1 byte), start time (8 bytes, Unix usecs, little-endian)
+//   records: varint ((usecs since the previous record << 1) | direction), varint length, data
+//
+// Varints are unsigned LEB128 (7 bits per byte, least significant first). Direction is
+// SESSION_TO_BOARD (0) or SESSION_FROM_BOARD (1). Each record holds the bytes of one read
+// or write, so a record may contain partial or multiple Firmata messages.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+enum { SESSION_TO_BOARD = 0, SESSION_FROM_BOARD = 1 };
+
+struct SessionRecord {
+	int64_t time; // usecs since the start of the recording
+	int direction;
+	std::vector<uint8_t> data;
+};
+
+class SessionRecorder {
+  public:
+	SessionRecorder();
+	~SessionRecorder();
+
+	bool open(const std::string &path);
+	void record(int direction, const uint8_t *data, size_t count);
+	void flush();
+	void close();
+	bool isOpen() const { return file != NULL; }
+
+	// statistics:
+	uint64_t recordCount;
+	uint64_t bytesRecorded; // data bytes, excluding record headers
+
+  private:
+	void writeVarint(uint64_t n);
+	int64_t micros() const;
+
+	FILE *file;
+	int64_t startTime;
+	int64_t lastTime;
+};
+
+class SessionReader {
+  public:
+	SessionReader();
+	~SessionReader();
+
+	bool open(const std::string &path);
+	bool next(SessionRecord &record); // false at the end of the file or on a bad record
+	void close();
+
+	int64_t startTime; // Unix usecs
+
+	// Read an entire recording into memory.
+	static bool readAll(const std::string &path, std::vector<SessionRecord> &records);
+
+  private:
+	bool readVarint(uint64_t &n);
+
+	FILE *file;
+	int64_t time;
+};
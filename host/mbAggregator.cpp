@@ -0,0 +1,144 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// mbAggregator: stream sensor data from many micro:bits and publish one time-aligned stream.
+//
+// Usage: mbAggregator [options] [device...]
+//
+//   --socket PATH      publish on this Unix domain socket (default /tmp/mbAggregator.sock)
+//   --threads N        number of board I/O threads (default 2)
+//   --channels LIST    comma-separated sensor channels to stream (default 8,9,10)
+//   --interval MSECS   sampling interval (default 10)
+//   --window MSECS     latency window for merging (default 100)
+//   --no-timestamps    estimate sample times from arrival times (for older firmware)
+//   --status SECS      print the status of each board every SECS seconds
+//
+// With no devices, all connected micro:bits are used. Devices can also be the pseudo-terminals
+// of simulated boards (see mbFirmataSim). See BoardAggregator.h for the output format.
+
+#include "BoardAggregator.h"
+#include "SerialPort.h"
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+static volatile bool stopRequested = false;
+
+static void onSignal(int sig) { stopRequested = true; }
+
+static std::vector<int> parseChannels(const char *s) {
+	std::vector<int> result;
+	while (*s) {
+		char *end;
+		long chan = strtol(s, &end, 10);
+		if ((end == s) || (chan < 0) || (chan > 15)) return std::vector<int>();
+		result.push_back(chan);
+		s = (',' == *end) ? end + 1 : end;
+	}
+	return result;
+}
+
+static void usage(const char *cmd) {
+	fprintf(stderr, "usage: %s [--socket PATH] [--threads N] [--channels LIST] [--interval MSECS]\n"
+		"       [--window MSECS] [--no-timestamps] [--status SECS] [device...]\n", cmd);
+}
+
+static void printStatus(BoardAggregator &aggregator) {
+	std::vector<BoardAggregator::BoardStatus> status = aggregator.boardStatus();
+	for (size_t i = 0; i < status.size(); i++) {
+		const BoardAggregator::BoardStatus &s = status[i];
+		fprintf(stderr, "board %d %s: %s, rtt %lld us, offset %lld us, rate %.6f, %llu samples\n",
+			(int) i, s.path.c_str(), s.connected ? "connected" : "disconnected",
+			(long long) s.roundTrip, (long long) s.offset, s.rate, (unsigned long long) s.samples);
+	}
+	fprintf(stderr, "received %llu, published %llu, late %llu\n",
+		(unsigned long long) aggregator.samplesReceived, (unsigned long long) aggregator.samplesPublished,
+		(unsigned long long) aggregator.lateSamples);
+}
+
+int main(int argc, char **argv) {
+	BoardAggregator::Options options;
+	std::string socketPath = "/tmp/mbAggregator.sock";
+	int statusSecs = 0;
+	std::vector<std::string> devices;
+
+	for (int i = 1; i < argc; i++) {
+		bool hasArg = (i + 1 < argc);
+		if ((0 == strcmp(argv[i], "--socket")) && hasArg) {
+			socketPath = argv[++i];
+		} else if ((0 == strcmp(argv[i], "--threads")) && hasArg) {
+			options.threads = atoi(argv[++i]);
+		} else if ((0 == strcmp(argv[i], "--channels")) && hasArg) {
+			options.channels = parseChannels(argv[++i]);
+			if (options.channels.empty()) {
+				usage(argv[0]);
+				return 1;
+			}
+		} else if ((0 == strcmp(argv[i], "--interval")) && hasArg) {
+			options.samplingInterval = atoi(argv[++i]);
+		} else if ((0 == strcmp(argv[i], "--window")) && hasArg) {
+			options.latencyWindow = atoi(argv[++i]);
+		} else if (0 == strcmp(argv[i], "--no-timestamps")) {
+			options.sampleTimestamps = false;
+		} else if ((0 == strcmp(argv[i], "--status")) && hasArg) {
+			statusSecs = atoi(argv[++i]);
+		} else if ('-' == argv[i][0]) {
+			usage(argv[0]);
+			return 1;
+		} else {
+			devices.push_back(argv[i]);
+		}
+	}
+	if (devices.empty()) devices = findMicrobitPorts();
+	if (devices.empty()) {
+		fprintf(stderr, "No micro:bit found; is your board plugged in?\n");
+		return 1;
+	}
+
+	BoardAggregator aggregator(options);
+	for (size_t i = 0; i < devices.size(); i++) {
+		if (aggregator.addBoard(devices[i]) < 0) fprintf(stderr, "Could not open %s\n", devices[i].c_str());
+	}
+	if (!aggregator.listen(socketPath)) {
+		perror(socketPath.c_str());
+		return 1;
+	}
+	fprintf(stderr, "Publishing %d boards on %s\n", (int) aggregator.boardStatus().size(), socketPath.c_str());
+
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+	aggregator.start();
+	int ticks = 0;
+	while (!stopRequested) {
+		usleep(100000);
+		if ((statusSecs > 0) && (0 == (++ticks % (10 * statusSecs)))) printStatus(aggregator);
+	}
+	aggregator.stop();
+	printStatus(aggregator);
+	return 0;
+}
@@ -0,0 +1,337 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// mbBenchmark: measure end-to-end throughput and latency of a Firmata board.
+//
+// Usage: mbBenchmark [--sim] [--baud N] [--duration MSECS] [--output FILE] [device]
+//
+// Runs against the given serial device (a real board, or the pseudo-terminal of mbFirmataSim),
+// the first connected micro:bit if no device is given, or, with --sim, the simulated firmware
+// running in this process at the given baud rate (default 57600; zero means unthrottled).
+// --duration sets the measurement time for each throughput test (default 1000 msecs).
+//
+// Results are written as JSON (to stdout unless --output is given) so they can be compared
+// across firmware versions:
+//
+//   samplesPerSecond        maximum sustained analog samples/sec for several channel counts,
+//                           streaming at a 1 msec sampling interval
+//   pinStateRoundTrip       PIN_STATE_QUERY to PIN_STATE_RESPONSE latency (usecs)
+//   scrollEventUnderLoad    scrolling an empty string to its display event (usecs), while
+//                           streaming three channels
+//   buttonEventUnderLoad    (--sim only) button press to its event (usecs), while streaming
+//   displayUpdatesPerSecond display show and plot commands processed per second
+
+#include "MBFirmataClient.h"
+#include "mbFirmata.h"
+#include "simFirmata.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+static int64_t micros() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void runFor(EventLoop &loop, int msecs) {
+	loop.runUntil([]() { return false; }, msecs);
+}
+
+// JSON Output
+
+static std::string jsonString(const std::string &s) {
+	std::string result = "\"";
+	for (size_t i = 0; i < s.size(); i++) {
+		char c = s[i];
+		if (('"' == c) || ('\\' == c)) result += '\\';
+		if ((unsigned char) c < 0x20) continue;
+		result += c;
+	}
+	return result + "\"";
+}
+
+static std::string latencyStats(std::vector<int64_t> samples, int timeouts) {
+	// Summarize a set of latency measurements (in usecs) as a JSON object.
+
+	char buf[256];
+	if (samples.empty()) {
+		snprintf(buf, sizeof(buf), "{\"count\": 0, \"timeouts\": %d}", timeouts);
+		return buf;
+	}
+	std::sort(samples.begin(), samples.end());
+	int64_t sum = 0;
+	for (size_t i = 0; i < samples.size(); i++) sum += samples[i];
+	size_t n = samples.size();
+	snprintf(buf, sizeof(buf),
+		"{\"count\": %d, \"timeouts\": %d, \"min\": %lld, \"median\": %lld, \"p95\": %lld, \"max\": %lld, \"mean\": %lld}",
+		(int) n, timeouts, (long long) samples[0], (long long) samples[n / 2],
+		(long long) samples[(95 * (n - 1)) / 100], (long long) samples[n - 1], (long long) (sum / n));
+	return buf;
+}
+
+// Benchmarks
+
+static const int sensorChannels[] = {8, 9, 10, 12, 13, 14, 15, 0, 1, 2, 3, 4};
+
+static void startStreaming(MBFirmataClient &mb, int channelCount, int samplingMSecs) {
+	mb.setAnalogSamplingInterval(samplingMSecs);
+	for (int i = 0; i < channelCount; i++) {
+		int chan = sensorChannels[i];
+		if (chan < 6) mb.setPinMode(chan, ANALOG_INPUT);
+		mb.streamAnalogChannel(chan);
+	}
+}
+
+static void stopStreaming(EventLoop &loop, MBFirmataClient &mb) {
+	for (int chan = 0; chan < 16; chan++) mb.stopStreamingAnalogChannel(chan);
+	mb.setAnalogSamplingInterval(100);
+	runFor(loop, 100); // discard samples still in transit
+}
+
+static std::string samplesPerSecond(EventLoop &loop, MBFirmataClient &mb, int durationMSecs) {
+	const int channelCounts[] = {1, 2, 3, 4, 6, 8, 12};
+
+	std::string result = "[";
+	for (size_t i = 0; i < sizeof(channelCounts) / sizeof(int); i++) {
+		int channelCount = channelCounts[i];
+		startStreaming(mb, channelCount, 1);
+		runFor(loop, 200); // reach a steady state
+		mb.analogUpdateCount = 0;
+		int64_t start = micros();
+		runFor(loop, durationMSecs);
+		double secs = (micros() - start) / 1000000.0;
+		double rate = mb.analogUpdateCount / secs;
+		stopStreaming(loop, mb);
+
+		char buf[128];
+		snprintf(buf, sizeof(buf), "%s\n    {\"channels\": %d, \"total\": %.1f, \"perChannel\": %.1f}",
+			(i > 0) ? "," : "", channelCount, rate, rate / channelCount);
+		result += buf;
+		fprintf(stderr, "%2d channels: %7.1f samples/sec\n", channelCount, rate);
+	}
+	return result + "]";
+}
+
+// PIN_STATE_QUERY requests sent and responses received. Counting them (rather than waiting
+// for any response) ensures that a late response isn't mistaken for the current one.
+static int pinStateQueries = 0;
+static int pinStateResponses = 0;
+
+static bool pinStateQuery(EventLoop &loop, MBFirmataClient &mb, int timeoutMSecs = 1000) {
+	int target = ++pinStateQueries;
+	mb.sendBytes({SYSEX_START, PIN_STATE_QUERY, 0, SYSEX_END});
+	return loop.runUntil([&]() { return pinStateResponses >= target; }, timeoutMSecs);
+}
+
+static std::string pinStateRoundTrip(EventLoop &loop, MBFirmataClient &mb) {
+	std::vector<int64_t> latencies;
+	int timeouts = 0;
+	for (int i = 0; i < 200; i++) {
+		int64_t start = micros();
+		if (pinStateQuery(loop, mb)) {
+			latencies.push_back(micros() - start);
+		} else {
+			timeouts++;
+		}
+	}
+	return latencyStats(latencies, timeouts);
+}
+
+static std::string scrollEventUnderLoad(EventLoop &loop, MBFirmataClient &mb) {
+	std::vector<int64_t> latencies;
+	int timeouts = 0;
+	mb.enableDisplay(true);
+	startStreaming(mb, 3, 1);
+	runFor(loop, 100);
+	for (int i = 0; i < 50; i++) {
+		int64_t start = micros();
+		mb.scrollString("", 1);
+		if (loop.runUntil([&]() { return !mb.isScrolling; }, 1000)) {
+			latencies.push_back(micros() - start);
+		} else {
+			timeouts++;
+		}
+	}
+	stopStreaming(loop, mb);
+	return latencyStats(latencies, timeouts);
+}
+
+static std::string buttonEventUnderLoad(EventLoop &loop, MBFirmataClient &mb) {
+	const int MICROBIT_ID_BUTTON_A = 1;
+	const int MICROBIT_BUTTON_EVT_DOWN = 1;
+	const int MICROBIT_BUTTON_EVT_UP = 2;
+
+	std::vector<int64_t> latencies;
+	int timeouts = 0;
+	startStreaming(mb, 3, 1);
+	runFor(loop, 100);
+	for (int i = 0; i < 50; i++) {
+		int64_t start = micros();
+		simInjectEvent(MICROBIT_ID_BUTTON_A, MICROBIT_BUTTON_EVT_DOWN);
+		if (loop.runUntil([&]() { return mb.buttonAPressed; }, 1000)) {
+			latencies.push_back(micros() - start);
+		} else {
+			timeouts++;
+		}
+		simInjectEvent(MICROBIT_ID_BUTTON_A, MICROBIT_BUTTON_EVT_UP);
+		loop.runUntil([&]() { return !mb.buttonAPressed; }, 1000);
+	}
+	stopStreaming(loop, mb);
+	return latencyStats(latencies, timeouts);
+}
+
+static std::string displayUpdatesPerSecond(EventLoop &loop, MBFirmataClient &mb) {
+	// Send a burst of display updates followed by a PIN_STATE_QUERY. The board processes
+	// commands in order, so the response means that all the updates have been processed.
+
+	const int updateCount = 200;
+	mb.enableDisplay(true);
+
+	uint8_t pixels[5][5];
+	int64_t start = micros();
+	for (int i = 0; i < updateCount; i++) {
+		for (int y = 0; y < 5; y++) {
+			for (int x = 0; x < 5; x++) pixels[y][x] = ((x + y + i) & 1) ? 255 : 0;
+		}
+		mb.displayShow(false, pixels);
+	}
+	bool showOK = pinStateQuery(loop, mb, 10000);
+	double showRate = updateCount / ((micros() - start) / 1000000.0);
+
+	start = micros();
+	for (int i = 0; i < updateCount; i++) mb.displayPlot(i % 5, (i / 5) % 5, (i & 1) ? 255 : 0);
+	bool plotOK = pinStateQuery(loop, mb, 10000);
+	double plotRate = updateCount / ((micros() - start) / 1000000.0);
+	mb.displayClear();
+
+	fprintf(stderr, "display: %.1f show/sec, %.1f plot/sec\n", showRate, plotRate);
+	char buf[128];
+	snprintf(buf, sizeof(buf), "{\"show\": %.1f, \"plot\": %.1f}", showOK ? showRate : 0, plotOK ? plotRate : 0);
+	return buf;
+}
+
+// Main
+
+static void usage(const char *cmd) {
+	fprintf(stderr, "usage: %s [--sim] [--baud N] [--duration MSECS] [--output FILE] [device]\n", cmd);
+}
+
+int main(int argc, char **argv) {
+	bool useSim = false;
+	int baud = 57600;
+	int durationMSecs = 1000;
+	const char *outputPath = NULL;
+	std::string device;
+
+	for (int i = 1; i < argc; i++) {
+		bool hasArg = (i + 1 < argc);
+		if (0 == strcmp(argv[i], "--sim")) {
+			useSim = true;
+		} else if ((0 == strcmp(argv[i], "--baud")) && hasArg) {
+			baud = atoi(argv[++i]);
+		} else if ((0 == strcmp(argv[i], "--duration")) && hasArg) {
+			durationMSecs = atoi(argv[++i]);
+		} else if ((0 == strcmp(argv[i], "--output")) && hasArg) {
+			outputPath = argv[++i];
+		} else if (('-' != argv[i][0]) && device.empty()) {
+			device = argv[i];
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	// Start the simulated board, if requested.
+	int simFd = -1, slaveFd = -1;
+	volatile bool stopSim = false;
+	std::thread simThread;
+	if (useSim) {
+		simFd = simOpenPty(device, &slaveFd);
+		if (simFd < 0) {
+			perror("simOpenPty");
+			return 1;
+		}
+		simSetBaud(baud);
+		simThread = std::thread(simRun, simFd, &stopSim);
+	}
+
+	EventLoop loop;
+	MBFirmataClient mb(loop);
+	bool connected = device.empty() ? mb.connect() : mb.connect(device);
+	bool gotVersion = connected && loop.runUntil([&]() {
+		return !mb.firmataVersion.empty() && !mb.firmwareVersion.empty();
+	}, 3000);
+	if (!gotVersion) {
+		fprintf(stderr, "No response from the board\n");
+	} else {
+		mb.addFirmataSysexListener([&](const uint8_t *data, int count) {
+			if (PIN_STATE_RESPONSE == data[0]) pinStateResponses++;
+		});
+
+		char timestamp[32];
+		time_t t = time(NULL);
+		strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+
+		std::string json = "{\n";
+		json += "  \"timestamp\": " + jsonString(timestamp) + ",\n";
+		json += "  \"target\": " + jsonString(useSim ? "simulated" : device.empty() ? "micro:bit" : device) + ",\n";
+		if (useSim) json += "  \"baud\": " + std::to_string(baud) + ",\n";
+		json += "  \"boardVersion\": " + jsonString(mb.boardVersion) + ",\n";
+		json += "  \"firmataVersion\": " + jsonString(mb.firmataVersion) + ",\n";
+		json += "  \"firmwareVersion\": " + jsonString(mb.firmwareVersion) + ",\n";
+		json += "  \"samplesPerSecond\": " + samplesPerSecond(loop, mb, durationMSecs) + ",\n";
+		json += "  \"pinStateRoundTrip\": " + pinStateRoundTrip(loop, mb) + ",\n";
+		json += "  \"scrollEventUnderLoad\": " + scrollEventUnderLoad(loop, mb) + ",\n";
+		if (useSim) json += "  \"buttonEventUnderLoad\": " + buttonEventUnderLoad(loop, mb) + ",\n";
+		json += "  \"displayUpdatesPerSecond\": " + displayUpdatesPerSecond(loop, mb) + "\n";
+		json += "}\n";
+
+		FILE *out = outputPath ? fopen(outputPath, "w") : stdout;
+		if (!out) {
+			perror(outputPath);
+			gotVersion = false;
+		} else {
+			fputs(json.c_str(), out);
+			if (out != stdout) fclose(out);
+		}
+	}
+	mb.disconnect();
+
+	if (useSim) {
+		stopSim = true;
+		simThread.join();
+		close(simFd);
+		close(slaveFd);
+	}
+	return gotVersion ? 0 : 1;
+}
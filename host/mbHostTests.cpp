@@ -0,0 +1,1060 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Tests for the host client library, run against the simulated firmware.
+//
+// The simulated board runs on its own thread, attached to a pseudo-terminal that the
+// client opens just like a real board's serial port.
+
+#include "BoardAggregator.h"
+#include "MBFirmataClient.h"
+#include "SessionLog.h"
+#include "mbFirmata.h"
+#include "simFirmata.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <thread>
+
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("    FAILED: %s (line %d)\n", #cond, __LINE__); \
+		failures++; \
+	} \
+} while (0)
+
+// Parser Tests
+
+class RecordingListener : public FirmataParser::Listener {
+  public:
+	std::vector<std::string> messages;
+
+	void receivedFirmataVersion(int major, int minor) {
+		messages.push_back("version " + std::to_string(major) + "." + std::to_string(minor));
+	}
+	void receivedAnalogUpdate(int chan, int value) {
+		messages.push_back("analog " + std::to_string(chan) + " " + std::to_string(value));
+	}
+	void receivedDigitalUpdate(int port, int pinMask) {
+		messages.push_back("digital " + std::to_string(port) + " " + std::to_string(pinMask));
+	}
+	void receivedSysex(const uint8_t *data, int count) {
+		messages.push_back("sysex " + std::to_string(data[0]) + " " + std::to_string(count));
+	}
+};
+
+static void parserTest() {
+	printf("Parser test (all split points)...\n");
+
+	const uint8_t stream[] = {
+		0x55, // stray data byte; ignored
+		FIRMATA_VERSION, 2, 6,
+		ANALOG_UPDATE | 8, 0x7F, 0x7F,
+		SYSEX_START, MB_REPORT_EVENT, 1, 0, 0, 1, 0, 0, SYSEX_END,
+		DIGITAL_UPDATE | 1, 0x05, 0,
+		SYSEX_START, 1, 2, 3, // truncated sysex; skipped
+		ANALOG_UPDATE | 3, 100, 1,
+	};
+	const char *expected[] = {
+		"version 2.6", "analog 8 16383", "sysex 13 7", "digital 1 5", "analog 3 228",
+	};
+
+	for (size_t split = 0; split <= sizeof(stream); split++) {
+		RecordingListener listener;
+		FirmataParser parser(listener);
+		parser.parse(stream, split);
+		parser.parse(&stream[split], sizeof(stream) - split);
+		CHECK(listener.messages.size() == 5);
+		if (listener.messages.size() != 5) return;
+		for (int i = 0; i < 5; i++) CHECK(listener.messages[i] == expected[i]);
+		CHECK(parser.messagesParsed == 5);
+		CHECK(parser.bytesParsed == sizeof(stream));
+	}
+}
+
+static void largeSysexTest() {
+	printf("Parser test (sysex larger than one read)...\n");
+
+	RecordingListener listener;
+	FirmataParser parser(listener);
+	std::vector<uint8_t> stream;
+	for (int i = 0; i < 3000; i++) stream.push_back(ANALOG_UPDATE | 1), stream.push_back(1), stream.push_back(0);
+	stream.push_back(SYSEX_START);
+	for (int i = 0; i < 2000; i++) stream.push_back(i & 0x7F);
+	stream.push_back(SYSEX_END);
+	for (size_t i = 0; i < stream.size(); i += 100) {
+		size_t n = std::min((size_t) 100, stream.size() - i);
+		parser.parse(&stream[i], n);
+	}
+	CHECK(listener.messages.size() == 3001);
+	CHECK(listener.messages.back() == "sysex 0 2000");
+
+	// A sysex larger than the buffer is dropped, including its SYSEX_END, and parsing
+	// resumes with the next command.
+	stream.clear();
+	stream.push_back(SYSEX_START);
+	for (int i = 0; i < 5000; i++) stream.push_back(i & 0x7F);
+	stream.push_back(SYSEX_END);
+	stream.insert(stream.end(), {ANALOG_UPDATE | 2, 3, 0});
+	RecordingListener listener2;
+	FirmataParser parser2(listener2);
+	parser2.parse(stream.data(), stream.size());
+	CHECK((listener2.messages.size() == 1) && (listener2.messages[0] == "analog 2 3"));
+	CHECK(parser2.messagesParsed == 1);
+	CHECK(parser2.bytesDropped == 5002);
+}
+
+static void eventLoopTest() {
+	printf("Event loop test (fd reused within one batch)...\n");
+
+	// Two pipes are readable in the same batch. Whichever handler runs first closes the other
+	// pipe and opens a new one, which reuses its fd number. The new pipe isn't readable, so
+	// its handler must not get the old pipe's pending event.
+	EventLoop loop;
+	int a[2], b[2], c[2] = {-1, -1};
+	if ((pipe(a) < 0) || (pipe(b) < 0)) return;
+	int readFDs[2] = {a[0], b[0]};
+	int calls = 0;
+	int staleCalls = 0;
+	int first = 0;
+	for (int i = 0; i < 2; i++) {
+		loop.add(readFDs[i], EPOLLIN, [&, i](uint32_t events) {
+			calls++;
+			first = i;
+			int other = readFDs[1 - i];
+			loop.remove(other);
+			close(other);
+			if (pipe(c) < 0) return;
+			CHECK(c[0] == other);
+			loop.add(c[0], EPOLLIN, [&](uint32_t events) { staleCalls++; });
+			loop.remove(readFDs[i]);
+		});
+	}
+	CHECK((1 == write(a[1], "x", 1)) && (1 == write(b[1], "x", 1)));
+	loop.runOnce(100);
+	CHECK(1 == calls);
+	CHECK(0 == staleCalls);
+	loop.remove(c[0]);
+	for (int fd : {readFDs[first], a[1], b[1], c[0], c[1]}) {
+		if (fd >= 0) close(fd);
+	}
+}
+
+static void packingTest() {
+	printf("Packed encoding test...\n");
+
+	for (int count = 0; count < 40; count++) {
+		std::vector<uint8_t> data;
+		for (int i = 0; i < count; i++) data.push_back((i * 37) + 200);
+		std::vector<uint8_t> packed = MBFirmataClient::packData(data.data(), data.size());
+		CHECK(packed.size() == (size_t) ((8 * count) + 6) / 7);
+		for (size_t i = 0; i < packed.size(); i++) CHECK(packed[i] < 0x80);
+		CHECK(MBFirmataClient::unpackData(packed.data(), packed.size()) == data);
+	}
+}
+
+static void boardClockTest() {
+	printf("Board clock estimation test...\n");
+
+	// The board clock runs 50 ppm fast, starts just before wrapping, and is queried every
+	// 250 msecs with round-trip times of 1 to 5 msecs, plus an occasional 20 msec delay.
+	uint32_t seed = 1;
+	BoardClock clock;
+	int64_t host = 0;
+	for (int i = 0; i < 40; i++) {
+		seed = (1103515245 * seed) + 12345;
+		int64_t roundTrip = 1000 + ((seed >> 8) % 4000) + ((0 == (i % 5)) ? 20000 : 0);
+		uint32_t board = 0xFFF00000u + (uint32_t) ((host + (roundTrip / 2)) * 1.00005);
+		clock.addPing(host, host + roundTrip, board);
+		host += 250000;
+	}
+	CHECK(clock.isValid());
+	CHECK(clock.rate() < 1.0);
+	int64_t error = clock.toHostTime(0xFFF00000u + (uint32_t) (host * 1.00005)) - host;
+	printf("    error %lld usecs, best round trip %lld usecs\n", (long long) error, (long long) clock.bestRoundTrip());
+	CHECK((error > -1000) && (error < 1000));
+}
+
+// Simulated Board Tests
+
+static void connectivityTest(EventLoop &loop, MBFirmataClient &mb) {
+	printf("Board connectivity test...\n");
+
+	bool ok = loop.runUntil([&]() {
+		return !mb.firmataVersion.empty() && !mb.firmwareVersion.empty();
+	}, 2000);
+	CHECK(ok);
+	CHECK(mb.firmataVersion == "Firmata Protocol 2.6");
+	printf("    %s\n", mb.firmataVersion.c_str());
+	printf("    %s\n", mb.firmwareVersion.c_str());
+}
+
+static void packedFirmwareVersionTest(EventLoop &loop, MBFirmataClient &mb) {
+	printf("Packed firmware version test...\n");
+
+	std::string unpackedVersion = mb.firmwareVersion;
+	mb.firmwareVersion = "";
+	mb.usePackedStrings = true;
+	mb.requestFirmwareVersion();
+	loop.runUntil([&]() { return !mb.firmwareVersion.empty(); }, 1000);
+	mb.usePackedStrings = false;
+	CHECK(mb.firmwareVersion == unpackedVersion);
+}
+
+static void capabilityTest(EventLoop &loop, MBFirmataClient &mb) {
+	printf("Capability and analog mapping test...\n");
+
+	std::vector<uint8_t> caps, mapping;
+	mb.addFirmataSysexListener([&](const uint8_t *data, int count) {
+		if (CAPABILITY_RESPONSE == data[0]) caps.assign(data + 1, data + count);
+		if (ANALOG_MAPPING_RESPONSE == data[0]) mapping.assign(data + 1, data + count);
+	});
+	mb.sendBytes({SYSEX_START, CAPABILITY_QUERY, SYSEX_END, SYSEX_START, ANALOG_MAPPING_QUERY, SYSEX_END});
+	CHECK(loop.runUntil([&]() { return !caps.empty() && !mapping.empty(); }, 500));
+	mb.removeAllFirmataListeners();
+
+	// Split the capabilities into pins; P17-P18 have none; P0-P4 are analog; the rest can be servos.
+	std::vector<std::vector<uint8_t> > pins(1);
+	for (size_t i = 0; i < caps.size(); i++) {
+		if (0x7F == caps[i]) {
+			pins.push_back(std::vector<uint8_t>());
+		} else {
+			pins.back().push_back(caps[i]);
+		}
+	}
+	CHECK(21 == pins.size());
+	if (21 != pins.size()) return;
+	for (int p = 0; p < 21; p++) {
+		bool hasAnalog = false;
+		bool hasServo = false;
+		for (size_t i = 0; i < pins[p].size(); i += 2) {
+			if (ANALOG_INPUT == pins[p][i]) hasAnalog = true;
+			if (SERVO == pins[p][i]) hasServo = true;
+		}
+		if (p < 5) CHECK(hasAnalog);
+		CHECK(hasServo == !pins[p].empty());
+		CHECK(pins[p].empty() == ((17 == p) || (18 == p)));
+	}
+	CHECK(16 == mapping.size());
+	for (size_t i = 0; i < mapping.size(); i++) CHECK(i == mapping[i]);
+}
+
+static void streamingTest(EventLoop &loop, MBFirmataClient &mb) {
+	printf("Analog streaming test...\n");
+
+	mb.setAnalogSamplingInterval(10);
+	mb.clearChannelData();
+	mb.streamAnalogChannel(8);
+	mb.streamAnalogChannel(12);
+	loop.runUntil([&]() { return false; }, 500);
+	mb.stopStreamingAnalogChannel(8);
+	mb.stopStreamingAnalogChannel(12);
+	loop.runUntil([&]() { return false; }, 50);
+	printf("    received %d samples\n", mb.analogUpdateCount);
+	CHECK(mb.channelUpdateCounts[8] > 20);
+	CHECK(mb.channelUpdateCounts[12] > 20);
+	CHECK(mb.analogChannel[12] == 21); // simulated temperature
+	CHECK(mb.analogUpdateCount == mb.channelUpdateCounts[8] + mb.channelUpdateCounts[12]);
+}
+
+static void orientationTest(EventLoop &loop, MBFirmataClient &mb) {
+	printf("Orientation channel test...\n");
+
+	// With the simulated board held still, the orientation channels must agree with values
+	// computed from the raw channels in floating point.
+	const int channels[] = {6, 7, 8, 9, 10, 13, 14, 15};
+	simHoldMotion(true);
+	mb.setAnalogSamplingInterval(10);
+	for (int chan : channels) mb.streamAnalogChannel(chan);
+	loop.runUntil([&]() { return false; }, 100);
+	mb.clearChannelData();
+	CHECK(loop.runUntil([&]() { return mb.channelUpdateCounts[15] > 2; }, 500));
+
+	// north-east-down axes
+	double ax = -mb.analogChannel[9], ay = mb.analogChannel[8], az = -mb.analogChannel[10];
+	double mx = -mb.analogChannel[14], my = mb.analogChannel[13], mz = -mb.analogChannel[15];
+	double roll = atan2(ay, az);
+	double pitch = atan(-ax / ((ay * sin(roll)) + (az * cos(roll))));
+	double heading = atan2(
+		(mx * cos(pitch)) + (my * sin(pitch) * sin(roll)) + (mz * sin(pitch) * cos(roll)),
+		(mz * sin(roll)) - (my * cos(roll))) * 180 / M_PI;
+	if (heading < 0) heading += 360;
+	printf("    pitch %d roll %d\n", mb.analogChannel[6], mb.analogChannel[7]);
+	CHECK(fabs(mb.analogChannel[6] - (pitch * 180 / M_PI)) <= 1);
+	CHECK(fabs(mb.analogChannel[7] - (roll * 180 / M_PI)) <= 1);
+
+	mb.setHeadingMode(true);
+	loop.runUntil([&]() { return false; }, 50);
+	mb.clearChannelData();
+	CHECK(loop.runUntil([&]() { return mb.channelUpdateCounts[13] > 2; }, 500));
+	double error = fabs(mb.analogChannel[13] - heading);
+	if (error > 180) error = 360 - error;
+	printf("    heading %d (expected %.1f)\n", mb.analogChannel[13], heading);
+	CHECK(error <= 2);
+
+	mb.setHeadingMode(false);
+	for (int chan : channels) mb.stopStreamingAnalogChannel(chan);
+	simHoldMotion(false);
+	loop.runUntil([&]() { return false; }, 50);
+}
+
+static void accelerometerBurstTest(EventLoop &loop, MBFirmataClient &mb) {
+	printf("Accelerometer burst test...\n");
+
+	// The board picks the nearest range and rate the sensor supports.
+	mb.setAccelerometerConfig(3, 12);
+	CHECK(loop.runUntil([&]() { return mb.accelerometerRange > 0; }, 500));
+	CHECK(4 == mb.accelerometerRange);
+	CHECK(10 == mb.accelerometerPeriod);
+
+	// Every sample arrives, evenly spaced, and matches the simulated motion at its time.
+	std::vector<uint32_t> times;
+	int badSamples = 0;
+	mb.addFirmataAccelerometerListener([&](uint32_t boardMicros, int x, int y, int z) {
+		times.push_back(boardMicros);
+		int expectedX = (int) (500 * sin(2 * M_PI * (boardMicros / 1000000.0) / 5.0));
+		if ((abs(x - expectedX) > 10) || (-850 != z)) badSamples++; // within one sample period
+	});
+	mb.streamAccelerometerBursts(8);
+	CHECK(loop.runUntil([&]() { return times.size() >= 48; }, 1500));
+	mb.stopAccelerometerBursts();
+	int unevenGaps = 0;
+	for (size_t i = 1; i < times.size(); i++) {
+		if ((times[i] - times[i - 1]) != 10000) unevenGaps++;
+	}
+	printf("    %d samples, %d missed\n", (int) times.size(), (int) mb.accelerometerSamplesMissed);
+	CHECK(0 == badSamples);
+	CHECK(unevenGaps <= (int) mb.accelerometerSamplesMissed);
+	CHECK(mb.accelerometerSamplesMissed < 5);
+	mb.setAccelerometerConfig(2, 20);
+	loop.runUntil([&]() { return 2 == mb.accelerometerRange; }, 500);
+	mb.removeAllFirmataListeners();
+}
+
+static void boardTimeTest(EventLoop &loop, MBFirmataClient &mb) {
+	printf("Board time and sample timestamp test...\n");
+
+	int lastSeq = -2;
+	bool sawTimestamp = false;
+	bool sampleBeforeTimestamp = false;
+	mb.addFirmataTimeListener([&](int seq, uint32_t boardMicros) {
+		lastSeq = seq;
+		if (seq < 0) sawTimestamp = true;
+	});
+	mb.addFirmataChannelListener([&](int chan, int value) {
+		if (!sawTimestamp) sampleBeforeTimestamp = true;
+	});
+	mb.requestBoardTime(5);
+	CHECK(loop.runUntil([&]() { return 5 == lastSeq; }, 500));
+
+	mb.enableSampleTimestamps(true);
+	mb.streamAnalogChannel(8);
+	CHECK(loop.runUntil([&]() { return sawTimestamp; }, 500));
+	mb.stopStreamingAnalogChannel(8);
+	mb.enableSampleTimestamps(false);
+	loop.runUntil([&]() { return false; }, 50);
+	CHECK(!sampleBeforeTimestamp);
+	mb.removeAllFirmataListeners();
+}
+
+static void loopStatsTest(EventLoop &loop, MBFirmataClient &mb) {
+	printf("Main loop sleep test...\n");
+
+	// With nothing streaming, the board sleeps most of the time.
+	mb.requestLoopStats();
+	CHECK(loop.runUntil([&]() { return mb.loopMicrosElapsed > 0; }, 500));
+	loop.runUntil([&]() { return false; }, 300);
+	mb.loopMicrosElapsed = 0;
+	mb.requestLoopStats();
+	CHECK(loop.runUntil([&]() { return mb.loopMicrosElapsed > 0; }, 500));
+	double asleep = (double) mb.loopMicrosAsleep / mb.loopMicrosElapsed;
+	printf("    idle: asleep %.0f%% of %d usecs (%d sleeps)\n",
+		100 * asleep, (int) mb.loopMicrosElapsed, (int) mb.loopSleeps);
+	CHECK(asleep > 0.5);
+
+	// While streaming, it still sleeps between samples and wakes in time for each one.
+	mb.setAnalogSamplingInterval(20);
+	mb.streamAnalogChannel(8);
+	loop.runUntil([&]() { return false; }, 300);
+	mb.loopMicrosElapsed = 0;
+	mb.requestLoopStats();
+	CHECK(loop.runUntil([&]() { return mb.loopMicrosElapsed > 0; }, 500));
+	asleep = (double) mb.loopMicrosAsleep / mb.loopMicrosElapsed;
+	printf("    streaming: asleep %.0f%%, wake-up latency max %d usecs, mean %d usecs\n",
+		100 * asleep, (int) mb.loopLatencyMax, (int) mb.loopLatencyMean);
+	CHECK(mb.loopSleeps > 0);
+	CHECK(mb.loopLatencyMean < 3000);
+	CHECK(mb.loopLatencyMax < 20000); // the host may delay a wake-up, but not miss a sample
+	mb.stopStreamingAnalogChannel(8);
+	mb.setAnalogSamplingInterval(10);
+}
+
+static void schedulerTest(EventLoop &loop, MBFirmataClient &mb) {
+	printf("Scheduler test...\n");
+
+	// A task that reports the board time, then repeats every 20 msecs.
+	std::vector<uint8_t> commands = {SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_BOARD_TIME, 9, SYSEX_END};
+	std::vector<uint8_t> delay = MBFirmataClient::delayTaskCommand(20);
+	commands.insert(commands.end(), delay.begin(), delay.end());
+
+	std::vector<uint32_t> times;
+	mb.addFirmataTimeListener([&](int seq, uint32_t boardMicros) {
+		if (9 == seq) times.push_back(boardMicros);
+	});
+	mb.createTask(3, commands);
+	mb.queryAllTasks();
+	CHECK(loop.runUntil([&]() { return 1 == mb.taskIDs.size(); }, 500));
+	CHECK((1 == mb.taskIDs.size()) && (3 == mb.taskIDs[0]));
+	mb.queryTask(3);
+	CHECK(loop.runUntil([&]() { return 3 == mb.taskInfo.id; }, 500));
+	CHECK(mb.taskInfo.exists && (mb.taskInfo.length == (int) commands.size()));
+	CHECK(mb.taskInfo.commands == commands);
+
+	// The board keeps the task's timing without any further messages from the client.
+	mb.scheduleTask(3, 0);
+	loop.runUntil([&]() { return false; }, 300);
+	CHECK(times.size() >= 10);
+	// Each run is due 20 msecs after the previous one was due, so a late run doesn't
+	// delay the ones after it.
+	int late = 0;
+	for (size_t i = 1; i < times.size(); i++) {
+		int offset = (times[i] - times[0]) - (20000 * i);
+		if ((offset < -1000) || (offset > 5000)) late++;
+	}
+	printf("    %d runs, %d off schedule\n", (int) times.size(), late);
+	CHECK(late <= 1);
+
+	mb.deleteTask(3);
+	loop.runUntil([&]() { return false; }, 50);
+	size_t runs = times.size();
+	loop.runUntil([&]() { return false; }, 100);
+	CHECK(times.size() == runs);
+	mb.queryTask(3);
+	CHECK(loop.runUntil([&]() { return 3 == mb.taskInfo.id; }, 500));
+	CHECK(!mb.taskInfo.exists);
+
+	// Tasks that don't fit are reported.
+	uint32_t errors = mb.taskErrors;
+	mb.createTask(4, std::vector<uint8_t>(1000, 0));
+	CHECK(loop.runUntil([&]() { return mb.taskErrors > errors; }, 500));
+	mb.resetTasks();
+	mb.removeAllFirmataListeners();
+}
+
+static void waveformTest(EventLoop &loop, MBFirmataClient &mb) {
+	printf("Waveform playback test...\n");
+
+	// A sawtooth of 8 values, played 20 times at 1000 samples/sec.
+	std::vector<uint16_t> table;
+	for (int i = 0; i < 8; i++) table.push_back(128 * i);
+	mb.setAnalogOutput(1, 0);
+	mb.uploadWaveform(table);
+	loop.runUntil([&]() { return false; }, 20);
+	simRecordAnalogOutput(1 << 1);
+	mb.playWaveform(1, 1000, 20);
+	CHECK(loop.runUntil([&]() { return !mb.waveformPlaying; }, 1000));
+	std::vector<SimAnalogWrite> writes = simAnalogOutput();
+	simRecordAnalogOutput(0);
+	CHECK(160 == writes.size());
+
+	// The timer interrupt writes sample k k msecs after sample 0, in order, none skipped.
+	// (The simulation runs the interrupt at its due time on the board's clock.)
+	int wrong = 0;
+	int late = 0;
+	for (size_t i = 0; i < writes.size(); i++) {
+		if ((writes[i].value != 128 * (i % 8)) || (writes[i].period != 1000)) wrong++;
+		int lateness = (writes[i].time - writes[0].time) - (1000 * i);
+		if ((lateness < 0) || (lateness > 100)) late++;
+	}
+	printf("    %d values, %d late\n", (int) writes.size(), late);
+	CHECK(0 == wrong);
+	CHECK(0 == late);
+
+	// With a loop count of zero, it plays until stopped.
+	mb.playWaveform(1, 2000, 0);
+	loop.runUntil([&]() { return false; }, 100);
+	simRecordAnalogOutput(1 << 1);
+	loop.runUntil([&]() { return false; }, 100);
+	CHECK(simAnalogOutput().size() >= 100);
+	mb.stopWaveform();
+	loop.runUntil([&]() { return false; }, 20);
+	simAnalogOutput();
+	loop.runUntil([&]() { return false; }, 50);
+	CHECK(simAnalogOutput().empty());
+
+	// Uploading a table stops playback, and an out-of-range pin is ignored.
+	mb.playWaveform(1, 2000, 0);
+	loop.runUntil([&]() { return false; }, 20);
+	mb.uploadWaveform(table);
+	loop.runUntil([&]() { return false; }, 20);
+	simAnalogOutput();
+	mb.sendBytes({SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_WAVEFORM_PLAY, 100, 0x50, 0x0F, 0, 0, 0, SYSEX_END});
+	loop.runUntil([&]() { return false; }, 50);
+	CHECK(simAnalogOutput().empty());
+	CHECK(!mb.waveformPlaying);
+	simRecordAnalogOutput(0);
+	mb.turnOffOutput(1);
+}
+
+static void outputTest(EventLoop &loop, MBFirmataClient &mb) {
+	printf("Servo and batched output test...\n");
+
+	// Servo angles map to pulse widths; larger values are pulse widths.
+	simRecordAnalogOutput((1 << 0) | (1 << 1) | (1 << 2));
+	mb.configureServo(0, 1000, 2000);
+	mb.setServoOutput(0, 90);
+	mb.setServoOutput(1, 1200);
+	loop.runUntil([&]() { return false; }, 50);
+	std::vector<SimAnalogWrite> writes = simAnalogOutput();
+	CHECK(2 == writes.size());
+	if (2 == writes.size()) {
+		CHECK((0 == writes[0].pin) && (1500 == writes[0].value) && (20000 == writes[0].period));
+		CHECK((1 == writes[1].pin) && (1200 == writes[1].value));
+	}
+
+	// An empty or reversed range is ignored.
+	mb.configureServo(0, 2000, 1000);
+	mb.configureServo(0, 1500, 1500);
+	mb.setServoOutput(0, 90);
+	loop.runUntil([&]() { return false; }, 50);
+	writes = simAnalogOutput();
+	CHECK((1 == writes.size()) && (1500 == writes[0].value));
+
+	// Pulse widths are limited to the pin's range, even large ones.
+	mb.setServoOutput(0, 600);
+	mb.sendBytes({SYSEX_START, EXTENDED_ANALOG_WRITE, 0, 0x20, 0x0D, 0x06, SYSEX_END}); // 100000
+	loop.runUntil([&]() { return false; }, 50);
+	writes = simAnalogOutput();
+	CHECK((2 == writes.size()) && (1000 == writes[0].value) && (2000 == writes[1].value));
+
+	// A batch sets PWM and servo outputs together.
+	mb.setAnalogOutput(2, 0);
+	loop.runUntil([&]() { return false; }, 50);
+	simAnalogOutput();
+	mb.setAnalogOutputs({{0, 0}, {1, 180}, {2, 700}});
+	loop.runUntil([&]() { return false; }, 50);
+	writes = simAnalogOutput();
+	simRecordAnalogOutput(0);
+	CHECK(3 == writes.size());
+	if (3 == writes.size()) {
+		CHECK((0 == writes[0].pin) && (1000 == writes[0].value));
+		CHECK((1 == writes[1].pin) && (2400 == writes[1].value));
+		CHECK((2 == writes[2].pin) && (700 == writes[2].value));
+	}
+
+	// A port write changes only the digital outputs in the port.
+	mb.setDigitalOutput(0, false);
+	mb.setDigitalOutput(2, true);
+	mb.turnOffOutput(1);
+	simSetDigitalInput(1, 0);
+	mb.sendBytes({DIGITAL_UPDATE | 0, 0x07, 0}); // pins 0-2 high
+	loop.runUntil([&]() { return false; }, 50);
+	CHECK(simDigitalOutput(0) && !simDigitalOutput(1) && simDigitalOutput(2));
+	mb.sendBytes({DIGITAL_UPDATE | 0, 0x02, 0}); // pin 1 high, others low
+	loop.runUntil([&]() { return false; }, 50);
+	CHECK(!simDigitalOutput(0) && !simDigitalOutput(1) && !simDigitalOutput(2));
+	for (int pin = 0; pin < 3; pin++) mb.turnOffOutput(pin);
+}
+
+static void bulkTransferTest(EventLoop &loop, MBFirmataClient &mb) {
+	printf("Bulk transfer test...\n");
+
+	// A stream of analog writes, sent over a line that drops and corrupts bytes at the
+	// real baud rate, must run on the board exactly once each, in order.
+	mb.setAnalogOutput(1, 0);
+	loop.runUntil([&]() { return false; }, 50);
+	simRecordAnalogOutput(1 << 1);
+	std::vector<uint8_t> commands;
+	std::vector<int> expected;
+	for (int i = 0; i < 1500; i++) {
+		int value = (i * 7) % 1024;
+		commands.insert(commands.end(), {(uint8_t) (ANALOG_UPDATE | 1), (uint8_t) (value & 0x7F), (uint8_t) (value >> 7)});
+		expected.push_back(value);
+	}
+	simSetBaud(57600);
+	simInputErrors(1499, 2003);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	mb.sendBulkTransfer(commands);
+	loop.runUntil([&]() { return MBFirmataClient::BULK_SENDING != mb.bulkState; }, 10000);
+	int msecs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	simInputErrors(0, 0);
+	simSetBaud(0);
+	loop.runUntil([&]() { return false; }, 50);
+	std::vector<SimAnalogWrite> writes = simAnalogOutput();
+	simRecordAnalogOutput(0);
+	CHECK(MBFirmataClient::BULK_DONE == mb.bulkState);
+	CHECK(mb.bulkChunksResent > 0);
+	bool inOrder = (writes.size() == expected.size());
+	for (size_t i = 0; inOrder && (i < writes.size()); i++) inOrder = (writes[i].value == expected[i]);
+	CHECK(inOrder);
+	printf("    %d bytes in %d msecs, %d chunks resent, %d writes run\n",
+		(int) commands.size(), msecs, mb.bulkChunksResent, (int) writes.size());
+
+	// An empty transfer completes at once.
+	mb.sendBulkTransfer({});
+	loop.runUntil([&]() { return MBFirmataClient::BULK_SENDING != mb.bulkState; }, 1000);
+	CHECK(MBFirmataClient::BULK_DONE == mb.bulkState);
+	mb.turnOffOutput(1);
+}
+
+static void sessionRecordingTest(EventLoop &loop, MBFirmataClient &mb) {
+	printf("Session recording and replay test...\n");
+
+	std::string path = "/tmp/mbHostTests-" + std::to_string(getpid()) + ".mbfs";
+	SessionRecorder recorder;
+	CHECK(recorder.open(path));
+	mb.setRecorder(&recorder);
+	uint64_t bytesBefore = mb.parser.bytesParsed;
+	uint64_t messagesBefore = mb.parser.messagesParsed;
+	mb.requestFirmataVersion();
+	mb.streamAnalogChannel(8);
+	loop.runUntil([&]() { return false; }, 100);
+	mb.stopStreamingAnalogChannel(8);
+	loop.runUntil([&]() { return false; }, 50);
+	mb.setRecorder(NULL);
+	recorder.close();
+
+	// Replaying the data received from the board must produce the same messages.
+	std::vector<SessionRecord> records;
+	CHECK(SessionReader::readAll(path, records));
+	FirmataParser::Listener listener;
+	FirmataParser parser(listener);
+	int sentBytes = 0;
+	int64_t lastTime = 0;
+	bool timesOrdered = true;
+	for (size_t i = 0; i < records.size(); i++) {
+		if (SESSION_FROM_BOARD == records[i].direction) {
+			parser.parse(records[i].data.data(), records[i].data.size());
+		} else {
+			sentBytes += records[i].data.size();
+		}
+		if (records[i].time < lastTime) timesOrdered = false;
+		lastTime = records[i].time;
+	}
+	unlink(path.c_str());
+	CHECK(timesOrdered);
+	CHECK(sentBytes == 3 + 2 + 2); // version request and two stream commands
+	CHECK(parser.bytesParsed == mb.parser.bytesParsed - bytesBefore);
+	CHECK(parser.messagesParsed == mb.parser.messagesParsed - messagesBefore);
+	CHECK(parser.messagesParsed > 5);
+}
+
+static void radioTest(EventLoop &loop, MBFirmataClient &mb) {
+	printf("Radio test...\n");
+
+	// The simulated board's radio loops sent packets back to it.
+	std::vector<RadioPacket> packets;
+	mb.addFirmataRadioListener([&](const RadioPacket &packet) { packets.push_back(packet); });
+	mb.radioSetGroup(42);
+	mb.radioSetBatchInterval(5);
+	mb.radioEnable(true);
+	mb.radioSendString("hello");
+	mb.radioSendInteger(-123456);
+	mb.radioSendFloat(2.5);
+	mb.radioSendPair("x", 17);
+	mb.radioSendPair("temp", 21.75);
+	const uint8_t raw[] = {0x80, 0xFF, 0x00, 0x7F, 0x01};
+	mb.radioSendPacket(raw, sizeof(raw));
+	CHECK(loop.runUntil([&]() { return packets.size() >= 6; }, 500));
+	if (packets.size() >= 6) {
+		CHECK((2 == packets[0].type) && ("hello" == packets[0].stringValue));
+		CHECK((0 == packets[1].type) && (-123456 == packets[1].intValue));
+		CHECK((4 == packets[2].type) && (2.5 == packets[2].floatValue));
+		CHECK((1 == packets[3].type) && (17 == packets[3].intValue) && ("x" == packets[3].stringValue));
+		CHECK((5 == packets[4].type) && (21.75 == packets[4].floatValue) && ("temp" == packets[4].stringValue));
+		CHECK(0x5EED0001 == packets[0].senderSerial);
+		CHECK(-30 == packets[0].rssi);
+		CHECK(std::vector<uint8_t>(raw, raw + sizeof(raw)) == packets[5].data);
+	}
+
+	// Relay traffic from many simulated nodes.
+	packets.clear();
+	simRadioTraffic(1000, 20);
+	loop.runUntil([&]() { return false; }, 500);
+	simRadioTraffic(0, 1);
+	loop.runUntil([&]() { return false; }, 50);
+	mb.requestRadioStats();
+	loop.runUntil([&]() { return false; }, 50);
+	uint64_t injected = simRadioPacketsInjected();
+	printf("    relayed %d of %d packets (%d lost)\n",
+		(int) packets.size(), (int) injected, (int) mb.radioPacketsLost);
+	CHECK(injected > 300);
+	CHECK(packets.size() + mb.radioPacketsLost == injected);
+	CHECK(mb.radioPacketsSent == 6);
+	mb.radioEnable(false);
+	mb.removeAllFirmataListeners();
+}
+
+static void savedConfigurationTest(EventLoop &loop, MBFirmataClient &mb, std::function<void()> reboot) {
+	printf("Saved configuration test...\n");
+
+	mb.setAnalogSamplingInterval(20);
+	mb.streamAnalogChannel(8);
+	mb.trackDigitalPin(1);
+	mb.saveConfiguration();
+	CHECK(loop.runUntil([&]() { return 1 == mb.configurationSaved; }, 500));
+
+	// After a reboot, streaming resumes without any commands from the client.
+	reboot();
+	mb.clearChannelData();
+	CHECK(loop.runUntil([&]() { return mb.channelUpdateCounts[8] > 5; }, 1000));
+	simSetDigitalInput(1, 1);
+	CHECK(loop.runUntil([&]() { return mb.digitalInput[1]; }, 500));
+	simSetDigitalInput(1, 0);
+	loop.runUntil([&]() { return !mb.digitalInput[1]; }, 500);
+
+	mb.eraseConfiguration();
+	CHECK(loop.runUntil([&]() { return 1 == mb.configurationSaved; }, 500));
+	reboot();
+	loop.runUntil([&]() { return false; }, 50);
+	mb.clearChannelData();
+	loop.runUntil([&]() { return false; }, 200);
+	CHECK(0 == mb.analogUpdateCount);
+}
+
+static void clockWrapTest(EventLoop &loop, MBFirmataClient &mb, std::function<void()> reboot) {
+	printf("Clock wrap test...\n");
+
+	// Start the board 300 msecs before its usec clock (and the V1 msec clock) wraps.
+	simSetBoardClock(0xFFFFFFFF - 300000);
+	reboot();
+	loop.runUntil([&]() { return false; }, 50);
+
+	// A repeating task keeps running across the wrap.
+	std::vector<uint8_t> commands = {SYSEX_START, MB_EXTENDED_SYSEX, MB_EXT_BOARD_TIME, 9, SYSEX_END};
+	std::vector<uint8_t> delay = MBFirmataClient::delayTaskCommand(20);
+	commands.insert(commands.end(), delay.begin(), delay.end());
+	int runsBefore = 0;
+	int runsAfter = 0;
+	mb.addFirmataTimeListener([&](int seq, uint32_t boardMicros) {
+		if (9 == seq) (boardMicros > 0x80000000 ? runsBefore : runsAfter)++;
+	});
+	mb.createTask(3, commands);
+	mb.scheduleTask(3, 0);
+	loop.runUntil([&]() { return false; }, 600);
+	mb.resetTasks();
+	loop.runUntil([&]() { return false; }, 50);
+	mb.removeAllFirmataListeners();
+	printf("    %d task runs before the wrap, %d after\n", runsBefore, runsAfter);
+	CHECK(runsBefore >= 5);
+	CHECK(runsAfter >= 10);
+
+	// A batch of received radio packets started before the wrap is still sent when the
+	// batch interval ends.
+	simSetBoardClock(0xFFFFFFFF - 150000);
+	reboot();
+	int received = 0;
+	int maxLatency = 0; // msecs
+	std::vector<std::chrono::steady_clock::time_point> sent(15);
+	mb.addFirmataRadioListener([&](const RadioPacket &packet) {
+		if ((packet.intValue < 0) || (packet.intValue >= 15)) return;
+		int msecs = std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - sent[packet.intValue]).count();
+		maxLatency = std::max(maxLatency, msecs);
+		received++;
+	});
+	mb.radioSetBatchInterval(20);
+	mb.radioEnable(true);
+	for (int i = 0; i < 15; i++) {
+		sent[i] = std::chrono::steady_clock::now();
+		mb.radioSendInteger(i);
+		loop.runUntil([&]() { return received > i; }, 300);
+	}
+	mb.radioEnable(false);
+	mb.removeAllFirmataListeners();
+	printf("    radio batch latency max %d msecs\n", maxLatency);
+	CHECK(15 == received);
+	CHECK(maxLatency < 150);
+}
+
+static void microphoneTest(EventLoop &loop, MBFirmataClient &mb) {
+	printf("Microphone test...\n");
+
+	// The simulated microphone hears a 440 Hz tone. The decoded audio should cross zero
+	// 880 times per second.
+	std::vector<int16_t> audio;
+	mb.addFirmataAudioListener([&](const int16_t *samples, int count) {
+		audio.insert(audio.end(), samples, samples + count);
+	});
+	mb.startMicrophone(8000);
+	CHECK(loop.runUntil([&]() { return MIC_AUDIO == mb.microphoneMode; }, 500));
+	CHECK(loop.runUntil([&]() { return audio.size() >= 4000; }, 1500));
+	mb.stopMicrophone();
+	CHECK(loop.runUntil([&]() { return MIC_OFF == mb.microphoneMode; }, 500));
+	int crossings = 0;
+	for (size_t i = 256; i < audio.size(); i++) { // skip while the encoder adapts
+		if ((audio[i - 1] < 0) != (audio[i] < 0)) crossings++;
+	}
+	double perSecond = crossings * 8000.0 / (audio.size() - 256);
+	printf("    %d samples, %.0f zero crossings/sec, %d blocks lost\n",
+		(int) audio.size(), perSecond, (int) mb.audioBlocksLost);
+	CHECK(fabs(perSecond - 880) < 30);
+	CHECK(0 == mb.audioBlocksLost);
+
+	// Sound level only: the RMS level of a sine wave is its amplitude / sqrt(2).
+	mb.startSoundLevel(8000, 50);
+	CHECK(loop.runUntil([&]() { return MIC_LEVEL == mb.microphoneMode; }, 500));
+	mb.soundLevel = 0;
+	loop.runUntil([&]() { return false; }, 200);
+	printf("    sound level %d\n", mb.soundLevel);
+	CHECK(fabs(mb.soundLevel - (SIM_MIC_AMPLITUDE / sqrt(2))) < (0.05 * SIM_MIC_AMPLITUDE));
+	mb.stopMicrophone();
+	mb.removeAllFirmataListeners();
+}
+
+static void digitalInputTest(EventLoop &loop, MBFirmataClient &mb) {
+	printf("Digital input test...\n");
+
+	mb.trackDigitalPin(1);
+	simSetDigitalInput(1, 1);
+	CHECK(loop.runUntil([&]() { return mb.digitalInput[1]; }, 500));
+	simSetDigitalInput(1, 0);
+	CHECK(loop.runUntil([&]() { return !mb.digitalInput[1]; }, 500));
+	mb.stopTrackingDigitalPins();
+}
+
+static void eventTest(EventLoop &loop, MBFirmataClient &mb) {
+	const int MICROBIT_ID_BUTTON_A = 1;
+	const int MICROBIT_BUTTON_EVT_DOWN = 1;
+	const int MICROBIT_BUTTON_EVT_UP = 2;
+
+	printf("Button event test...\n");
+
+	int eventCount = 0;
+	mb.addFirmataEventListener([&](int sourceID, int eventID) { eventCount++; });
+	simInjectEvent(MICROBIT_ID_BUTTON_A, MICROBIT_BUTTON_EVT_DOWN);
+	CHECK(loop.runUntil([&]() { return mb.buttonAPressed; }, 500));
+	simInjectEvent(MICROBIT_ID_BUTTON_A, MICROBIT_BUTTON_EVT_UP);
+	CHECK(loop.runUntil([&]() { return !mb.buttonAPressed; }, 500));
+	CHECK(2 == eventCount);
+	mb.removeAllFirmataListeners();
+}
+
+static void scrollTest(EventLoop &loop, MBFirmataClient &mb) {
+	printf("String scroll test...\n");
+
+	mb.enableDisplay(true);
+	mb.scrollString("abc", 5);
+	CHECK(mb.isScrolling);
+	CHECK(loop.runUntil([&]() { return !mb.isScrolling; }, 1000));
+
+	mb.usePackedStrings = true;
+	mb.scrollString("packed", 5);
+	mb.usePackedStrings = false;
+	CHECK(loop.runUntil([&]() { return !mb.isScrolling; }, 1000));
+}
+
+// Aggregation Test
+
+static pid_t forkSimulatedBoard(std::string &path) {
+	// Run a simulated board (at the default baud rate) in a child process and return its pid.
+	// The child reports the path of its pseudo-terminal through a pipe.
+
+	int pipeFDs[2];
+	if (pipe(pipeFDs) < 0) return -1;
+	pid_t pid = fork();
+	if (0 == pid) {
+		close(pipeFDs[0]);
+		std::string slavePath;
+		int slaveFd;
+		int fd = simOpenPty(slavePath, &slaveFd);
+		if (fd >= 0) write(pipeFDs[1], slavePath.c_str(), slavePath.size());
+		close(pipeFDs[1]);
+		static volatile bool neverStop = false;
+		if (fd >= 0) simRun(fd, &neverStop);
+		_exit(0);
+	}
+	close(pipeFDs[1]);
+	char buf[256];
+	ssize_t n = (pid > 0) ? read(pipeFDs[0], buf, sizeof(buf)) : 0;
+	close(pipeFDs[0]);
+	path = (n > 0) ? std::string(buf, n) : "";
+	return pid;
+}
+
+static void aggregatorTest() {
+	// Must be run before any other threads are started, since it forks.
+
+	const int boardCount = 8;
+	const int runMSecs = 1500;
+	printf("Aggregation test (%d boards)...\n", boardCount);
+
+	std::vector<pid_t> pids;
+	BoardAggregator::Options options;
+	BoardAggregator aggregator(options);
+	for (int i = 0; i < boardCount; i++) {
+		std::string path;
+		pid_t pid = forkSimulatedBoard(path);
+		if (pid > 0) pids.push_back(pid);
+		CHECK(!path.empty() && (aggregator.addBoard(path) == i));
+	}
+	std::string socketPath = "/tmp/mbHostTests-" + std::to_string(getpid()) + ".sock";
+	CHECK(aggregator.listen(socketPath));
+
+	std::vector<int> samplesPerBoard(boardCount, 0);
+	aggregator.setSampleSink([&](const AlignedSample &sample) { samplesPerBoard[sample.board]++; });
+	aggregator.start();
+
+	// Read the published stream until the aggregator is stopped and the socket is closed.
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socketPath.c_str());
+	CHECK(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+	struct timeval timeout = {0, 100000};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	std::string received;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	bool stopped = false;
+	while (true) {
+		char buf[4096];
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n > 0) received.append(buf, n);
+		if (stopped && (n <= 0)) break;
+		if (!stopped && (std::chrono::steady_clock::now() - start > std::chrono::milliseconds(runMSecs))) {
+			aggregator.stop();
+			stopped = true;
+		}
+	}
+	close(fd);
+
+	for (size_t i = 0; i < pids.size(); i++) {
+		kill(pids[i], SIGKILL);
+		waitpid(pids[i], NULL, 0);
+	}
+
+	int headers = 0, samples = 0, outOfOrder = 0;
+	long long lastTime = 0;
+	std::istringstream lines(received);
+	std::string line;
+	while (std::getline(lines, line)) {
+		if ('#' == line[0]) {
+			headers++;
+			continue;
+		}
+		long long t;
+		int board, chan, value;
+		if (4 != sscanf(line.c_str(), "%lld %d %d %d", &t, &board, &chan, &value)) continue;
+		if (t < lastTime) outOfOrder++;
+		lastTime = t;
+		samples++;
+	}
+	printf("    published %d samples (%.0f samples/sec), %d out of order\n",
+		samples, samples / (runMSecs / 1000.0), outOfOrder);
+	CHECK(headers == boardCount);
+	CHECK((uint64_t) samples == aggregator.samplesPublished);
+	CHECK(aggregator.samplesPublished == aggregator.samplesReceived);
+	CHECK(outOfOrder == (int) aggregator.lateSamples);
+	CHECK(outOfOrder < (samples / 100));
+	for (int i = 0; i < boardCount; i++) CHECK(samplesPerBoard[i] > 100);
+
+	// The simulated boards were forked from this process, so they share one clock and
+	// their estimated offsets should agree to within the round-trip time.
+	std::vector<BoardAggregator::BoardStatus> status = aggregator.boardStatus();
+	int64_t minOffset = status[0].offset, maxOffset = status[0].offset;
+	int64_t maxRoundTrip = 0;
+	for (size_t i = 0; i < status.size(); i++) {
+		CHECK(status[i].clockValid);
+		minOffset = std::min(minOffset, status[i].offset);
+		maxOffset = std::max(maxOffset, status[i].offset);
+		maxRoundTrip = std::max(maxRoundTrip, status[i].roundTrip);
+	}
+	printf("    clock offsets agree within %lld usecs (round trips up to %lld usecs)\n",
+		(long long) (maxOffset - minOffset), (long long) maxRoundTrip);
+	CHECK((maxOffset - minOffset) <= maxRoundTrip);
+}
+
+int main() {
+	parserTest();
+	largeSysexTest();
+	eventLoopTest();
+	packingTest();
+	boardClockTest();
+	aggregatorTest();
+
+	std::string slavePath;
+	int slaveFd;
+	int simFd = simOpenPty(slavePath, &slaveFd);
+	if (simFd < 0) {
+		printf("Could not open a pseudo-terminal; skipping simulated board tests\n");
+		return failures ? 1 : 0;
+	}
+	simSetBaud(0); // unthrottled, so the tests run quickly
+	volatile bool stopSim = false;
+	std::thread board(simRun, simFd, &stopSim);
+	std::function<void()> rebootSim = [&]() {
+		stopSim = true;
+		board.join();
+		stopSim = false;
+		board = std::thread(simRun, simFd, &stopSim);
+	};
+
+	EventLoop loop;
+	MBFirmataClient mb(loop);
+	CHECK(mb.connect(slavePath));
+	connectivityTest(loop, mb);
+	packedFirmwareVersionTest(loop, mb);
+	capabilityTest(loop, mb);
+	streamingTest(loop, mb);
+	orientationTest(loop, mb);
+	accelerometerBurstTest(loop, mb);
+	boardTimeTest(loop, mb);
+	loopStatsTest(loop, mb);
+	schedulerTest(loop, mb);
+	waveformTest(loop, mb);
+	outputTest(loop, mb);
+	bulkTransferTest(loop, mb);
+	sessionRecordingTest(loop, mb);
+	radioTest(loop, mb);
+	savedConfigurationTest(loop, mb, rebootSim);
+	clockWrapTest(loop, mb, rebootSim);
+	microphoneTest(loop, mb);
+	digitalInputTest(loop, mb);
+	eventTest(loop, mb);
+	scrollTest(loop, mb);
+	mb.disconnect();
+
+	stopSim = true;
+	board.join();
+	close(simFd);
+	close(slaveFd);
+
+	printf("%s\n", failures ? "FAILED" : "Testing complete");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,161 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// mbRecord: record a Firmata session between any client and a board.
+//
+// Usage: mbRecord --output FILE [--link PATH] [device]
+//
+// Opens the board's serial port (the first connected micro:bit if no device is given) and a
+// pseudo-terminal, prints the pseudo-terminal's path, and relays data between them, recording
+// both directions with timestamps (see SessionLog.h). Point the client (e.g. the Javascript
+// client) at the pseudo-terminal, or at the symlink created by --link. Stop with Ctrl-C.
+
+#include "EventLoop.h"
+#include "SerialPort.h"
+#include "SessionLog.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+static volatile bool stopRequested = false;
+
+static void onSignal(int sig) { stopRequested = true; }
+
+static bool writeAll(int fd, const uint8_t *data, size_t count) {
+	// Write all the data to a non-blocking fd, waiting for it to become writable as needed.
+
+	while (count > 0) {
+		ssize_t n = write(fd, data, count);
+		if (n < 0) {
+			if (EINTR == errno) continue;
+			if (EAGAIN != errno) return false;
+			struct pollfd pfd = { fd, POLLOUT, 0 };
+			poll(&pfd, 1, 100);
+			continue;
+		}
+		data += n;
+		count -= n;
+	}
+	return true;
+}
+
+static bool relay(int fromFD, int toFD, int direction, SessionRecorder &recorder) {
+	// Relay and record all available data. Return false if fromFD is closed or fails.
+
+	uint8_t buf[4096];
+	while (true) {
+		ssize_t n = read(fromFD, buf, sizeof(buf));
+		if (n > 0) {
+			recorder.record(direction, buf, n);
+			if (!writeAll(toFD, buf, n)) return false;
+			continue;
+		}
+		return (n < 0) && ((EAGAIN == errno) || (EINTR == errno));
+	}
+}
+
+int main(int argc, char **argv) {
+	const char *outputPath = NULL;
+	const char *linkPath = NULL;
+	std::string device;
+	for (int i = 1; i < argc; i++) {
+		if ((0 == strcmp(argv[i], "--output")) && (i + 1 < argc)) {
+			outputPath = argv[++i];
+		} else if ((0 == strcmp(argv[i], "--link")) && (i + 1 < argc)) {
+			linkPath = argv[++i];
+		} else if (('-' != argv[i][0]) && device.empty()) {
+			device = argv[i];
+		} else {
+			outputPath = NULL;
+			break;
+		}
+	}
+	if (!outputPath) {
+		fprintf(stderr, "usage: %s --output FILE [--link PATH] [device]\n", argv[0]);
+		return 1;
+	}
+	if (device.empty()) device = findMicrobitPort();
+	if (device.empty()) {
+		fprintf(stderr, "No micro:bit found; is your board plugged in?\n");
+		return 1;
+	}
+
+	int boardFD = openSerialPort(device, 57600);
+	if (boardFD < 0) {
+		perror(device.c_str());
+		return 1;
+	}
+	std::string slavePath;
+	int slaveFD;
+	int ptyFD = openPseudoTerminal(slavePath, &slaveFD);
+	if (ptyFD < 0) {
+		perror("openPseudoTerminal");
+		return 1;
+	}
+	if (linkPath) {
+		unlink(linkPath);
+		if (symlink(slavePath.c_str(), linkPath) < 0) {
+			perror("symlink");
+			return 1;
+		}
+	}
+	SessionRecorder recorder;
+	if (!recorder.open(outputPath)) {
+		perror(outputPath);
+		return 1;
+	}
+	printf("%s\n", slavePath.c_str());
+	fflush(stdout);
+
+	EventLoop loop;
+	loop.add(boardFD, EPOLLIN, [&](uint32_t events) {
+		if (!relay(boardFD, ptyFD, SESSION_FROM_BOARD, recorder)) {
+			fprintf(stderr, "Board disconnected\n");
+			stopRequested = true;
+		}
+	});
+	loop.add(ptyFD, EPOLLIN, [&](uint32_t events) {
+		relay(ptyFD, boardFD, SESSION_TO_BOARD, recorder);
+	});
+	loop.addTimer(1000, [&]() { recorder.flush(); }, true);
+
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+	while (!stopRequested) loop.runOnce(100);
+
+	recorder.close();
+	fprintf(stderr, "Recorded %llu bytes in %llu records\n",
+		(unsigned long long) recorder.bytesRecorded, (unsigned long long) recorder.recordCount);
+	if (linkPath) unlink(linkPath);
+	close(slaveFD);
+	close(ptyFD);
+	close(boardFD);
+	return 0;
+}
@@ -0,0 +1,150 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// mbReplay: replay a recorded Firmata session (see mbRecord) at full speed.
+//
+// Usage: mbReplay [--client] [--firmware] [--repeat N] [--dump] FILE
+//
+//   --client     feed the data received from the board into the client parser (FirmataParser)
+//   --firmware   feed the data sent to the board into the firmware's command processing,
+//                using the simulated firmware, with its output discarded
+//   --repeat N   replay N times (default 1), to measure throughput on small recordings
+//   --dump       print the records (time, direction, and data in hex)
+//
+// With neither --client nor --firmware, both are replayed. Replays are deterministic: the data
+// is processed in recorded order, without timing, so a recorded problem can be reproduced
+// (e.g. under a debugger) and parse throughput measured on realistic traffic.
+
+#include "FirmataParser.h"
+#include "SessionLog.h"
+#include "mbFirmata.h"
+#include "simFirmata.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static double seconds() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count() / 1000000.0;
+}
+
+static void report(const char *name, uint64_t bytes, uint64_t messages, double secs) {
+	if (secs <= 0) secs = 1e-9;
+	printf("%s: %llu bytes, %llu messages in %.3f secs (%.1f MB/sec, %.0f messages/sec)\n",
+		name, (unsigned long long) bytes, (unsigned long long) messages, secs,
+		bytes / secs / 1000000.0, messages / secs);
+}
+
+static void dump(const std::vector<SessionRecord> &records) {
+	for (size_t i = 0; i < records.size(); i++) {
+		const SessionRecord &r = records[i];
+		printf("%10.6f %s", r.time / 1000000.0, (SESSION_TO_BOARD == r.direction) ? ">" : "<");
+		for (size_t j = 0; j < r.data.size(); j++) printf(" %02X", r.data[j]);
+		printf("\n");
+	}
+}
+
+static void replayClient(const std::vector<SessionRecord> &records, int repeat) {
+	// Parse the data from the board, split as it was originally read.
+
+	FirmataParser::Listener listener;
+	FirmataParser parser(listener);
+	double start = seconds();
+	for (int n = 0; n < repeat; n++) {
+		for (size_t i = 0; i < records.size(); i++) {
+			const SessionRecord &r = records[i];
+			if (SESSION_FROM_BOARD == r.direction) parser.parse(r.data.data(), r.data.size());
+		}
+	}
+	report("client", parser.bytesParsed, parser.messagesParsed, seconds() - start);
+	if (parser.bytesDropped) printf("    %llu bytes dropped\n", (unsigned long long) parser.bytesDropped);
+}
+
+static void replayFirmware(const std::vector<SessionRecord> &records, int repeat) {
+	// Run the data sent to the board through the firmware's command processing.
+
+	std::vector<uint8_t> commands;
+	for (size_t i = 0; i < records.size(); i++) {
+		const SessionRecord &r = records[i];
+		if (SESSION_TO_BOARD == r.direction) commands.insert(commands.end(), r.data.begin(), r.data.end());
+	}
+
+	// Count the commands (bytes with the high bit set, other than SYSEX_END).
+	uint64_t commandCount = 0;
+	for (size_t i = 0; i < commands.size(); i++) {
+		if ((commands[i] & 0x80) && (SYSEX_END != commands[i])) commandCount++;
+	}
+
+	simSetBaud(0);
+	simReplayInput(commands.data(), 0);
+	initFirmata();
+	double start = seconds();
+	for (int n = 0; n < repeat; n++) {
+		simReplayInput(commands.data(), commands.size());
+		while (simReplayRemaining() > 0) simStep();
+	}
+	simStep(); // process any command left in the firmware's input buffer
+	double secs = seconds() - start;
+	simReplayInput(NULL, 0);
+	report("firmware", repeat * (uint64_t) commands.size(), repeat * commandCount, secs);
+}
+
+int main(int argc, char **argv) {
+	bool client = false, firmware = false, showRecords = false;
+	int repeat = 1;
+	const char *path = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (0 == strcmp(argv[i], "--client")) {
+			client = true;
+		} else if (0 == strcmp(argv[i], "--firmware")) {
+			firmware = true;
+		} else if (0 == strcmp(argv[i], "--dump")) {
+			showRecords = true;
+		} else if ((0 == strcmp(argv[i], "--repeat")) && (i + 1 < argc)) {
+			repeat = atoi(argv[++i]);
+		} else if (('-' != argv[i][0]) && !path) {
+			path = argv[i];
+		} else {
+			path = NULL;
+			break;
+		}
+	}
+	if (!path || (repeat < 1)) {
+		fprintf(stderr, "usage: %s [--client] [--firmware] [--repeat N] [--dump] FILE\n", argv[0]);
+		return 1;
+	}
+	if (!client && !firmware) client = firmware = true;
+
+	std::vector<SessionRecord> records;
+	if (!SessionReader::readAll(path, records)) {
+		fprintf(stderr, "Could not read recording %s\n", path);
+		return 1;
+	}
+	if (showRecords) dump(records);
+	if (client) replayClient(records, repeat);
+	if (firmware) replayFirmware(records, repeat);
+	return 0;
+}
@@ -0,0 +1,312 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Host simulation of the subset of the micro:bit DAL used by the Firmata firmware.
+//
+// This allows firmware/source/mbFirmata.cpp to be compiled and run on a host computer
+// (see simFirmata.h), with its serial port connected to a pseudo-terminal or other file
+// descriptor. Sensors return synthetic values that change over time so that streaming
+// clients see realistic traffic.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+// Constants
+
+#define MICROBIT_OK					0
+#define MICROBIT_INVALID_PARAMETER	-1001
+#define MICROBIT_NOT_SUPPORTED		-1002
+#define MICROBIT_NO_RESOURCES		-1005
+#define MICROBIT_NO_DATA			-1030
+
+#define MICROBIT_ID_BUTTON_A		1
+#define MICROBIT_ID_BUTTON_B		2
+#define MICROBIT_ID_DISPLAY			7
+#define MICROBIT_ID_GESTURE			13
+#define MICROBIT_ID_IO_P0			100
+#define MICROBIT_ID_IO_P1			101
+#define MICROBIT_ID_IO_P2			102
+
+#define MICROBIT_EVT_ANY			0
+#define MICROBIT_BUTTON_EVT_DOWN	1
+#define MICROBIT_BUTTON_EVT_UP		2
+#define MICROBIT_BUTTON_EVT_CLICK	3
+#define MICROBIT_DISPLAY_EVT_ANIMATION_COMPLETE 1
+
+#define DISPLAY_MODE_BLACK_AND_WHITE	0
+#define DISPLAY_MODE_GREYSCALE			1
+
+enum MicroBitSerialMode { ASYNC, SYNC_SPINWAIT, SYNC_SLEEP };
+
+enum PinMode { PullNone = 0, PullDown = 1, PullUp = 3 };
+
+// Pin names (the simulation just uses the edge connector pin number)
+
+#define MICROBIT_PIN_P0		0
+#define MICROBIT_PIN_P1		1
+#define MICROBIT_PIN_P2		2
+#define MICROBIT_PIN_P3		3
+#define MICROBIT_PIN_P4		4
+#define MICROBIT_PIN_P5		5
+#define MICROBIT_PIN_P6		6
+#define MICROBIT_PIN_P7		7
+#define MICROBIT_PIN_P8		8
+#define MICROBIT_PIN_P9		9
+#define MICROBIT_PIN_P10	10
+#define MICROBIT_PIN_P11	11
+#define MICROBIT_PIN_P12	12
+#define MICROBIT_PIN_P13	13
+#define MICROBIT_PIN_P14	14
+#define MICROBIT_PIN_P15	15
+#define MICROBIT_PIN_P16	16
+#define MICROBIT_PIN_P19	19
+#define MICROBIT_PIN_P20	20
+
+#define MICROBIT_PIN_BUTTON_A	5
+#define MICROBIT_PIN_BUTTON_B	11
+
+#define USBTX		24
+#define USBRX		25
+#define I2C_SDA0	30
+#define I2C_SCL0	0
+
+// Time and Versions
+
+#define MBED_LIBRARY_VERSION 0
+#define SYSTEM_TICK_PERIOD_MS 6
+
+uint32_t us_ticker_read();
+const char *microbit_dal_version();
+uint32_t microbit_serial_number();
+
+// Sleep until an interrupt. Simulated by waiting (at most 1 msec) for serial I/O, then
+// doing the work of the board's interrupts: delivering events, receiving radio packets,
+// and calling Ticker handlers.
+void __WFE();
+
+// An mbed Ticker calls its handler every period usecs. Simulated by calling it (on the
+// firmware thread, like an interrupt) from __WFE() and simStep() when it is due, and
+// waking __WFE() for it.
+
+class Ticker {
+  public:
+	Ticker() : handler(0), period(0), next(0) {}
+
+	void attach_us(void (*fn)(), uint32_t usecs);
+	void detach();
+
+	void (*handler)();
+	uint32_t period;
+	uint32_t next; // board time (usecs) of the next call
+};
+
+// Events
+
+class MicroBitEvent {
+  public:
+	uint16_t source;
+	uint16_t value;
+
+	MicroBitEvent(uint16_t source, uint16_t value) : source(source), value(value) {}
+};
+
+class MicroBitMessageBus {
+  public:
+	int listen(int id, int value, void (*handler)(MicroBitEvent));
+	void send(MicroBitEvent evt);
+};
+
+// Serial
+
+class MicroBitSerial {
+  public:
+	MicroBitSerial(int tx, int rx);
+	void baud(int baudrate);
+	int read(MicroBitSerialMode mode);
+	int sendChar(char c, MicroBitSerialMode mode);
+	int send(uint8_t *buffer, int bufferLen, MicroBitSerialMode mode);
+	int rxBufferedSize();
+	int txBufferedSize();
+	int setRxBufferSize(uint8_t size);
+	int setTxBufferSize(uint8_t size);
+};
+
+// Pins
+
+class MicroBitPin {
+  public:
+	int name;
+
+	MicroBitPin() : name(0), pull(PullNone), digitalValue(0), analogValue(0), analogPeriod(20000) {}
+
+	int setDigitalValue(int value);
+	int getDigitalValue();
+	int setAnalogValue(int value);
+	int getAnalogValue();
+	int setAnalogPeriodUs(int period);
+	int setServoPulseUs(int pulseWidth);
+	int getAnalogPeriodUs();
+	int setPull(PinMode pull);
+	int isTouched();
+
+	PinMode pull;
+	int digitalValue;
+	int analogValue;
+	int analogPeriod; // usecs
+};
+
+class MicroBitIO {
+  public:
+	MicroBitPin pin[21];
+
+	MicroBitIO(int p0, int p1, int p2, int p3, int p4, int p5, int p6, int p7,
+		int p8, int p9, int p10, int p11, int p12, int p13, int p14, int p15,
+		int p16, int p19, int p20);
+};
+
+class MicroBitButton {
+  public:
+	MicroBitButton(int pin, int id) {}
+};
+
+// Sensors
+
+class MicroBitI2C {
+  public:
+	MicroBitI2C(int sda, int scl) {}
+};
+
+// Storage
+
+#define MICROBIT_STORAGE_VALUE_SIZE 32
+
+struct KeyValuePair {
+	uint8_t key[16];
+	uint8_t value[MICROBIT_STORAGE_VALUE_SIZE];
+};
+
+class MicroBitStorage {
+  public:
+	int put(const char *key, uint8_t *data, int dataSize);
+	KeyValuePair *get(const char *key); // caller deletes the result; NULL if not found
+	int remove(const char *key);
+};
+
+class MicroBitAccelerometer {
+  public:
+	static MicroBitAccelerometer &autoDetect(MicroBitI2C &i2c);
+	int getX();
+	int getY();
+	int getZ();
+	int setRange(int range);
+	int getRange();
+	int setPeriod(int period);
+	int getPeriod();
+
+  private:
+	int range = 2; // g
+	int period = 20; // msecs
+};
+
+class MicroBitCompass {
+  public:
+	static MicroBitCompass &autoDetect(MicroBitI2C &i2c);
+	int getX();
+	int getY();
+	int getZ();
+	int heading();
+	int calibrate();
+};
+
+class MicroBitThermometer {
+  public:
+	MicroBitThermometer(MicroBitStorage &storage) {}
+	int getTemperature();
+};
+
+// Display
+
+class MicroBitImage {
+  public:
+	uint8_t pixels[5][5];
+
+	MicroBitImage() { memset(pixels, 0, sizeof(pixels)); }
+	int setPixelValue(int16_t x, int16_t y, uint8_t value);
+};
+
+class MicroBitDisplay {
+  public:
+	MicroBitImage image;
+
+	void stopAnimation();
+	void clear();
+	void enable();
+	void disable();
+	void setDisplayMode(int mode);
+	int scrollAsync(const char *s, int delay);
+	int readLightLevel();
+};
+
+// nRF51 GPIO set and clear registers (written by setDigitalPort()). In the simulation,
+// pin n uses GPIO n, and writing a mask to either register sets or clears those pins.
+
+void simGpioWrite(uint32_t mask, int value);
+
+template <int value> struct SimGpioRegister {
+	SimGpioRegister &operator=(uint32_t mask) {
+		simGpioWrite(mask, value);
+		return *this;
+	}
+};
+
+struct NRF_GPIO_Type {
+	SimGpioRegister<1> OUTSET;
+	SimGpioRegister<0> OUTCLR;
+};
+
+extern NRF_GPIO_Type *NRF_GPIO;
+
+// nRF51 ADC registers (written by analogDisable())
+
+struct NRF_ADC_Type {
+	uint32_t ENABLE;
+	uint32_t CONFIG;
+};
+
+extern NRF_ADC_Type *NRF_ADC;
+
+#define ADC_ENABLE_ENABLE_Disabled						0
+#define ADC_CONFIG_RES_Pos								0
+#define ADC_CONFIG_RES_8bit								0
+#define ADC_CONFIG_INPSEL_Pos							2
+#define ADC_CONFIG_INPSEL_SupplyTwoThirdsPrescaling		6
+#define ADC_CONFIG_REFSEL_Pos							5
+#define ADC_CONFIG_REFSEL_VBG							0
+#define ADC_CONFIG_PSEL_Pos								8
+#define ADC_CONFIG_PSEL_Disabled						0
+#define ADC_CONFIG_EXTREFSEL_Pos						16
+#define ADC_CONFIG_EXTREFSEL_None						0
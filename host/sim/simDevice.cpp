@@ -0,0 +1,670 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Implementation of the DAL simulation used to run the Firmata firmware on a host computer.
+
+#include "MicroBit.h"
+#include "simFirmata.h"
+#include "../../firmware/source/mbFirmata.h"
+
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Time
+
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+static uint64_t micros() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - startTime).count();
+}
+
+static double seconds() { return micros() / 1000000.0; }
+
+static uint32_t boardClockOffset = 0;
+static bool inTicker = false; // a Ticker handler is running at tickerTime
+static uint32_t tickerTime = 0;
+
+uint32_t us_ticker_read() {
+	if (inTicker) return tickerTime;
+	return (uint32_t) micros() + boardClockOffset;
+}
+
+void simSetBoardClock(uint32_t usecs) { boardClockOffset = usecs - (uint32_t) micros(); }
+
+const char *microbit_dal_version() { return "host-sim"; }
+
+uint32_t microbit_serial_number() { return 0x5EED0001; }
+
+// Tickers
+
+static std::vector<Ticker *> tickers; // attached tickers
+
+void Ticker::attach_us(void (*fn)(), uint32_t usecs) {
+	detach();
+	handler = fn;
+	period = usecs;
+	next = us_ticker_read() + usecs;
+	tickers.push_back(this);
+}
+
+void Ticker::detach() {
+	for (size_t i = 0; i < tickers.size(); i++) {
+		if (tickers[i] == this) tickers.erase(tickers.begin() + i);
+	}
+}
+
+static void runTickers() {
+	// Call the handlers that are due. A handler sees the board clock at the time it was due,
+	// as if it were an interrupt on the board, even if the host delayed the simulation. Like
+	// mbed, a late ticker catches up on the calls it missed, so it keeps its timing.
+
+	for (size_t i = 0; i < tickers.size(); i++) {
+		Ticker *t = tickers[i];
+		while ((i < tickers.size()) && (tickers[i] == t) && ((int32_t) (us_ticker_read() - t->next) >= 0)) {
+			tickerTime = t->next;
+			t->next += t->period;
+			inTicker = true;
+			t->handler();
+			inTicker = false;
+		}
+	}
+}
+
+static int32_t microsUntilTicker() {
+	int32_t result = 1000;
+	for (Ticker *t : tickers) {
+		int32_t usecs = t->next - us_ticker_read();
+		if (usecs < result) result = (usecs > 0) ? usecs : 0;
+	}
+	return result;
+}
+
+static NRF_ADC_Type simADC;
+NRF_ADC_Type *NRF_ADC = &simADC;
+
+// Events
+
+struct Listener {
+	int id;
+	int value;
+	void (*handler)(MicroBitEvent);
+};
+
+static std::vector<Listener> listeners;
+
+static std::mutex pendingEventsLock;
+static std::vector<MicroBitEvent> pendingEvents;
+
+int MicroBitMessageBus::listen(int id, int value, void (*handler)(MicroBitEvent)) {
+	// Like the DAL, ignore a listener that is already registered, so the firmware can be
+	// initialized again (see simRun()).
+
+	for (size_t i = 0; i < listeners.size(); i++) {
+		Listener &l = listeners[i];
+		if ((l.id == id) && (l.value == value) && (l.handler == handler)) return MICROBIT_NOT_SUPPORTED;
+	}
+	Listener l = { id, value, handler };
+	listeners.push_back(l);
+	return MICROBIT_OK;
+}
+
+void MicroBitMessageBus::send(MicroBitEvent evt) {
+	for (size_t i = 0; i < listeners.size(); i++) {
+		Listener &l = listeners[i];
+		if ((l.id != MICROBIT_EVT_ANY) && (l.id != evt.source)) continue;
+		if ((l.value != MICROBIT_EVT_ANY) && (l.value != evt.value)) continue;
+		l.handler(evt);
+	}
+}
+
+static MicroBitMessageBus simBus;
+
+void simInjectEvent(int source, int value) {
+	std::lock_guard<std::mutex> guard(pendingEventsLock);
+	pendingEvents.push_back(MicroBitEvent(source, value));
+}
+
+static void deliverPendingEvents() {
+	std::vector<MicroBitEvent> events;
+	{
+		std::lock_guard<std::mutex> guard(pendingEventsLock);
+		events.swap(pendingEvents);
+	}
+	for (size_t i = 0; i < events.size(); i++) simBus.send(events[i]);
+}
+
+// Serial
+
+#define SIM_BUF_SIZE 256
+
+static int serialFd = -1;
+static int baudRate = 57600;
+static double lineFreeAt = 0; // microseconds
+static double rxLineFreeAt = 0; // microseconds
+
+static uint8_t rxBuf[SIM_BUF_SIZE];
+static int rxCount = 0;
+static int rxIndex = 0;
+
+static int inputDropEvery = 0;
+static int inputCorruptEvery = 0;
+static uint64_t inputByteCount = 0;
+
+static const uint8_t *replayData = NULL; // when set, input comes from here and output is discarded
+static int replayCount = 0;
+static int replayIndex = 0;
+
+static uint8_t txBuf[SIM_BUF_SIZE];
+static int txCount = 0;
+static int txCapacity = SIM_BUF_SIZE;
+
+static void pumpTx() {
+	// Write as many buffered bytes as the simulated baud rate allows.
+
+	if (replayData) {
+		txCount = 0;
+		return;
+	}
+	if ((serialFd < 0) || (0 == txCount)) return;
+	int n = txCount;
+	double usPerByte = 0;
+	if (baudRate > 0) {
+		double t = (double) micros();
+		usPerByte = 10000000.0 / baudRate; // 10 bits per byte (start, 8 data, stop)
+		if (lineFreeAt < t) lineFreeAt = t;
+		n = 0;
+		while ((n < txCount) && ((lineFreeAt + (n * usPerByte)) <= t)) n++;
+		if (0 == n) return;
+	}
+	int written = write(serialFd, txBuf, n);
+	if (written <= 0) return;
+	lineFreeAt += written * usPerByte;
+	txCount -= written;
+	memmove(txBuf, &txBuf[written], txCount);
+}
+
+void simSetSerialFd(int fd) {
+	serialFd = fd;
+	rxCount = rxIndex = txCount = 0;
+}
+
+void simSetBaud(int baud) { baudRate = baud; }
+
+void simInputErrors(int dropEvery, int corruptEvery) {
+	inputDropEvery = dropEvery;
+	inputCorruptEvery = corruptEvery;
+	inputByteCount = 0;
+}
+
+static int injectInputErrors(uint8_t *buf, int count) {
+	// Drop or corrupt every Nth byte received, as set by simInputErrors().
+	// Return the number of bytes left in buf.
+
+	if (!inputDropEvery && !inputCorruptEvery) return count;
+	int kept = 0;
+	for (int i = 0; i < count; i++) {
+		inputByteCount++;
+		if (inputDropEvery && (0 == (inputByteCount % inputDropEvery))) continue;
+		uint8_t b = buf[i];
+		if (inputCorruptEvery && (0 == (inputByteCount % inputCorruptEvery))) b ^= 1;
+		buf[kept++] = b;
+	}
+	return kept;
+}
+
+void simReplayInput(const uint8_t *data, int count) {
+	replayData = data;
+	replayCount = count;
+	replayIndex = 0;
+}
+
+int simReplayRemaining() { return replayCount - replayIndex; }
+
+MicroBitSerial::MicroBitSerial(int tx, int rx) {}
+
+void MicroBitSerial::baud(int baudrate) {}
+
+int MicroBitSerial::read(MicroBitSerialMode mode) {
+	// Received bytes are also paced at the simulated baud rate, so the firmware
+	// can't process commands faster than a real board could receive them.
+
+	pumpTx();
+	if (replayData) return (replayIndex < replayCount) ? replayData[replayIndex++] : MICROBIT_NO_DATA;
+	if (rxIndex >= rxCount) {
+		rxIndex = rxCount = 0;
+		if (serialFd < 0) return MICROBIT_NO_DATA;
+		int n = ::read(serialFd, rxBuf, sizeof(rxBuf));
+		if (n > 0) n = injectInputErrors(rxBuf, n);
+		if (n <= 0) return MICROBIT_NO_DATA;
+		rxCount = n;
+		double t = (double) micros();
+		if (rxLineFreeAt < t) rxLineFreeAt = t;
+	}
+	if (baudRate > 0) {
+		if (micros() < rxLineFreeAt) return MICROBIT_NO_DATA;
+		rxLineFreeAt += 10000000.0 / baudRate;
+	}
+	return rxBuf[rxIndex++];
+}
+
+int MicroBitSerial::sendChar(char c, MicroBitSerialMode mode) {
+	// Like the DAL in ASYNC mode, drop the character if the transmit buffer is full.
+
+	pumpTx();
+	if (txCount >= txCapacity) return 0;
+	txBuf[txCount++] = c;
+	return 1;
+}
+
+int MicroBitSerial::send(uint8_t *buffer, int bufferLen, MicroBitSerialMode mode) {
+	// Like the DAL in ASYNC mode, send as many bytes as fit in the transmit buffer.
+
+	int n = 0;
+	while ((n < bufferLen) && sendChar(buffer[n], mode)) n++;
+	return n;
+}
+
+int MicroBitSerial::rxBufferedSize() {
+	if (replayData) return replayCount - replayIndex;
+	if (rxIndex < rxCount) return rxCount - rxIndex;
+	if (serialFd < 0) return 0;
+	struct pollfd pfd = { serialFd, POLLIN, 0 };
+	return (poll(&pfd, 1, 0) > 0) && (pfd.revents & POLLIN) ? 1 : 0;
+}
+
+int MicroBitSerial::txBufferedSize() {
+	pumpTx();
+	return txCount;
+}
+
+int MicroBitSerial::setRxBufferSize(uint8_t size) { return MICROBIT_OK; }
+
+int MicroBitSerial::setTxBufferSize(uint8_t size) {
+	txCapacity = (size < SIM_BUF_SIZE) ? size : SIM_BUF_SIZE;
+	return MICROBIT_OK;
+}
+
+// Pins
+
+static int digitalInputs[21];
+
+void simSetDigitalInput(int pin, int value) {
+	if ((pin >= 0) && (pin < 21)) digitalInputs[pin] = value ? 1 : 0;
+}
+
+MicroBitIO::MicroBitIO(int p0, int p1, int p2, int p3, int p4, int p5, int p6, int p7,
+	int p8, int p9, int p10, int p11, int p12, int p13, int p14, int p15,
+	int p16, int p19, int p20) {
+
+	for (int i = 0; i < 21; i++) pin[i].name = i;
+}
+
+int MicroBitPin::setDigitalValue(int value) {
+	digitalValue = value ? 1 : 0;
+	digitalInputs[name] = digitalValue;
+	return MICROBIT_OK;
+}
+
+int MicroBitPin::getDigitalValue() { return digitalInputs[name]; }
+
+static NRF_GPIO_Type simGPIO;
+NRF_GPIO_Type *NRF_GPIO = &simGPIO;
+
+void simGpioWrite(uint32_t mask, int value) {
+	for (int i = 0; i < 21; i++) {
+		if (mask & (1 << i)) digitalInputs[i] = value;
+	}
+}
+
+int simDigitalOutput(int pin) { return ((pin >= 0) && (pin < 21)) ? digitalInputs[pin] : 0; }
+
+static std::mutex analogOutputLock;
+static uint32_t recordedPins = 0;
+static std::vector<SimAnalogWrite> analogOutput;
+
+void simRecordAnalogOutput(uint32_t pinMask) {
+	std::lock_guard<std::mutex> guard(analogOutputLock);
+	recordedPins = pinMask;
+	analogOutput.clear();
+}
+
+std::vector<SimAnalogWrite> simAnalogOutput() {
+	std::lock_guard<std::mutex> guard(analogOutputLock);
+	std::vector<SimAnalogWrite> result;
+	result.swap(analogOutput);
+	return result;
+}
+
+int MicroBitPin::setAnalogValue(int value) {
+	analogValue = value;
+	std::lock_guard<std::mutex> guard(analogOutputLock);
+	if (recordedPins & (1 << name)) analogOutput.push_back({us_ticker_read(), name, value, analogPeriod});
+	return MICROBIT_OK;
+}
+
+int MicroBitPin::setServoPulseUs(int pulseWidth) {
+	analogPeriod = 20000;
+	std::lock_guard<std::mutex> guard(analogOutputLock);
+	if (recordedPins & (1 << name)) analogOutput.push_back({us_ticker_read(), name, pulseWidth, analogPeriod});
+	return MICROBIT_OK;
+}
+
+int MicroBitPin::setAnalogPeriodUs(int period) {
+	analogPeriod = period;
+	return MICROBIT_OK;
+}
+
+int MicroBitPin::getAnalogPeriodUs() { return analogPeriod; }
+
+int MicroBitPin::getAnalogValue() {
+	// A slow sine wave with a different frequency on each pin.
+
+	return 512 + (int) (511 * sin(2 * M_PI * seconds() * (name + 1) / 4.0));
+}
+
+int MicroBitPin::setPull(PinMode p) {
+	pull = p;
+	return MICROBIT_OK;
+}
+
+int MicroBitPin::isTouched() { return 0; }
+
+// Sensors
+
+static volatile double heldSensorTime = -1; // seconds; negative when the board is moving
+
+void simHoldMotion(bool hold) { heldSensorTime = hold ? seconds() : -1; }
+
+static double motionSeconds() { return (heldSensorTime >= 0) ? heldSensorTime : seconds(); }
+
+MicroBitAccelerometer &MicroBitAccelerometer::autoDetect(MicroBitI2C &i2c) {
+	static MicroBitAccelerometer accelerometer;
+	return accelerometer;
+}
+
+// The board slowly rocks about both horizontal axes.
+int MicroBitAccelerometer::getX() { return (int) (500 * sin(2 * M_PI * motionSeconds() / 5.0)); }
+int MicroBitAccelerometer::getY() { return (int) (500 * sin(2 * M_PI * motionSeconds() / 7.0)); }
+int MicroBitAccelerometer::getZ() { return -850; }
+
+// Like the V2 board's accelerometer, the simulated one supports ranges of 2, 4, 8, and
+// 16 g and data rates of 1 to 400 Hz. The driver picks the nearest supported setting.
+
+int MicroBitAccelerometer::setRange(int g) {
+	static const int ranges[] = {2, 4, 8, 16};
+	range = 16;
+	for (int r : ranges) {
+		if (r >= g) {
+			range = r;
+			break;
+		}
+	}
+	return MICROBIT_OK;
+}
+
+int MicroBitAccelerometer::getRange() { return range; }
+
+int MicroBitAccelerometer::setPeriod(int msecs) {
+	static const int periods[] = {1000, 100, 40, 20, 10, 5, 3};
+	period = 3;
+	for (int p : periods) {
+		if (p <= msecs) {
+			period = p;
+			break;
+		}
+	}
+	return MICROBIT_OK;
+}
+
+int MicroBitAccelerometer::getPeriod() { return period; }
+
+MicroBitCompass &MicroBitCompass::autoDetect(MicroBitI2C &i2c) {
+	static MicroBitCompass compass;
+	return compass;
+}
+
+// The board slowly turns about its vertical axis.
+int MicroBitCompass::getX() { return (int) (30000 * cos(2 * M_PI * motionSeconds() / 20.0)); }
+int MicroBitCompass::getY() { return (int) (30000 * sin(2 * M_PI * motionSeconds() / 20.0)); }
+int MicroBitCompass::getZ() { return -40000; }
+
+int MicroBitCompass::heading() {
+	int degrees = (int) (360.0 * motionSeconds() / 20.0);
+	return degrees % 360;
+}
+
+int MicroBitCompass::calibrate() { return MICROBIT_OK; }
+
+int MicroBitThermometer::getTemperature() { return 21; }
+
+// Microphone
+
+// The simulated microphone hears a steady 440 Hz tone. Samples are generated as they fall
+// due; like the board's capture buffer, at most 1024 samples are kept if they are not read.
+
+static int micRate = 0; // samples per second; zero when stopped
+static double micStartTime = 0; // seconds
+static uint64_t micSamplesRead = 0;
+
+void simulatedMicrophoneStart(int sampleRate) {
+	micRate = sampleRate;
+	micStartTime = seconds();
+	micSamplesRead = 0;
+}
+
+int simulatedMicrophoneRead(int16_t *samples, int maxCount) {
+	if (!micRate) return 0;
+	uint64_t due = (uint64_t) ((seconds() - micStartTime) * micRate);
+	if ((due - micSamplesRead) > 1024) micSamplesRead = due - 1024;
+	int count = 0;
+	while ((count < maxCount) && (micSamplesRead < due)) {
+		double t = (double) micSamplesRead / micRate;
+		samples[count++] = (int16_t) (SIM_MIC_AMPLITUDE * sin(2 * M_PI * 440 * t));
+		micSamplesRead++;
+	}
+	return count;
+}
+
+// Display
+
+static uint64_t scrollDoneTime = 0; // microseconds; zero if not scrolling
+
+int MicroBitImage::setPixelValue(int16_t x, int16_t y, uint8_t value) {
+	if ((x < 0) || (x > 4) || (y < 0) || (y > 4)) return MICROBIT_INVALID_PARAMETER;
+	pixels[y][x] = value;
+	return MICROBIT_OK;
+}
+
+void MicroBitDisplay::stopAnimation() {
+	if (scrollDoneTime) {
+		scrollDoneTime = 0;
+		simBus.send(MicroBitEvent(MICROBIT_ID_DISPLAY, MICROBIT_DISPLAY_EVT_ANIMATION_COMPLETE));
+	}
+}
+
+void MicroBitDisplay::clear() { image = MicroBitImage(); }
+void MicroBitDisplay::enable() {}
+void MicroBitDisplay::disable() {}
+void MicroBitDisplay::setDisplayMode(int mode) {}
+
+int MicroBitDisplay::scrollAsync(const char *s, int delay) {
+	// Each character is five columns plus a space; the display is five columns wide.
+
+	int columns = (6 * strlen(s)) + 5;
+	scrollDoneTime = micros() + (1000 * (uint64_t) columns * delay);
+	return MICROBIT_OK;
+}
+
+int MicroBitDisplay::readLightLevel() { return 128; }
+
+static void updateDisplay() {
+	if (scrollDoneTime && (micros() >= scrollDoneTime)) {
+		scrollDoneTime = 0;
+		simBus.send(MicroBitEvent(MICROBIT_ID_DISPLAY, MICROBIT_DISPLAY_EVT_ANIMATION_COMPLETE));
+	}
+}
+
+// Storage
+//
+// Values are kept in memory, so they persist when the firmware is restarted by simRun().
+
+static std::map<std::string, std::vector<uint8_t> > storedValues;
+
+int MicroBitStorage::put(const char *key, uint8_t *data, int dataSize) {
+	if ((strlen(key) >= sizeof(KeyValuePair::key)) || (dataSize > MICROBIT_STORAGE_VALUE_SIZE)) {
+		return MICROBIT_INVALID_PARAMETER;
+	}
+	storedValues[key].assign(data, data + dataSize);
+	return MICROBIT_OK;
+}
+
+KeyValuePair *MicroBitStorage::get(const char *key) {
+	std::map<std::string, std::vector<uint8_t> >::iterator it = storedValues.find(key);
+	if (it == storedValues.end()) return NULL;
+	KeyValuePair *pair = new KeyValuePair();
+	strncpy((char *) pair->key, key, sizeof(pair->key) - 1);
+	memcpy(pair->value, it->second.data(), it->second.size());
+	return pair;
+}
+
+int MicroBitStorage::remove(const char *key) {
+	return storedValues.erase(key) ? MICROBIT_OK : MICROBIT_NO_DATA;
+}
+
+// Radio
+//
+// The simulation is built with the loopback radio (FIRMATA_RADIO_LOOPBACK). simRadioTraffic()
+// adds packets from simulated nodes, each sending MakeCode integer packets with a counter.
+
+static int radioTrafficRate = 0;
+static int radioTrafficNodes = 1;
+static uint64_t radioTrafficStart = 0;
+static uint64_t radioTrafficSent = 0; // since radioTrafficStart
+static uint64_t radioTrafficTotal = 0;
+
+void simRadioTraffic(int packetsPerSecond, int nodeCount) {
+	radioTrafficRate = 0;
+	radioTrafficNodes = (nodeCount > 0) ? nodeCount : 1;
+	radioTrafficStart = micros();
+	radioTrafficSent = 0;
+	radioTrafficRate = packetsPerSecond;
+}
+
+uint64_t simRadioPacketsInjected() { return radioTrafficTotal; }
+
+static void injectRadioTraffic() {
+	if (radioTrafficRate <= 0) return;
+	uint64_t due = ((micros() - radioTrafficStart) * radioTrafficRate) / 1000000;
+	while (radioTrafficSent < due) {
+		int node = radioTrafficTotal % radioTrafficNodes;
+		uint32_t t = (uint32_t) (micros() / 1000);
+		uint32_t serialNumber = 0x1000 + node;
+		uint32_t value = (uint32_t) radioTrafficTotal;
+		uint8_t packet[13];
+		packet[0] = 0; // MakeCode integer packet
+		memcpy(&packet[1], &t, 4);
+		memcpy(&packet[5], &serialNumber, 4);
+		memcpy(&packet[9], &value, 4);
+		radioLoopbackInject(packet, sizeof(packet), -40 - node);
+		radioTrafficSent++;
+		radioTrafficTotal++;
+	}
+}
+
+// Running
+
+int simOpenPty(std::string &slavePath, int *slaveFd) {
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0) return -1;
+	if ((grantpt(master) < 0) || (unlockpt(master) < 0)) {
+		close(master);
+		return -1;
+	}
+	slavePath = ptsname(master);
+	int slave = open(slavePath.c_str(), O_RDWR | O_NOCTTY);
+	if (slave < 0) {
+		close(master);
+		return -1;
+	}
+
+	// Raw mode, so that nothing is echoed or translated.
+	struct termios tio;
+	tcgetattr(slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+
+	fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+	if (slaveFd) *slaveFd = slave;
+	return master;
+}
+
+static void simInterrupts() {
+	runTickers();
+	deliverPendingEvents();
+	injectRadioTraffic();
+	updateDisplay();
+}
+
+void __WFE() {
+	if (!replayData && (serialFd >= 0)) {
+		struct pollfd pfd = { serialFd, (short) (txCount ? (POLLIN | POLLOUT) : POLLIN), 0 };
+		struct timespec timeout = { 0, 1000 * microsUntilTicker() };
+		ppoll(&pfd, 1, &timeout, NULL);
+	}
+	simInterrupts();
+}
+
+void simStep() {
+	simInterrupts();
+	stepFirmata();
+}
+
+void simRun(int fd, const volatile bool *stop) {
+	simSetSerialFd(fd);
+	initFirmata();
+	while (!*stop) {
+		simStep();
+		sleepFirmata();
+
+		// Also sleep briefly when the firmware is polling, to avoid hogging the host CPU.
+		// This limits the loop to several thousand iterations per second, faster than the
+		// real board. A Ticker that falls due sooner ends the sleep.
+		int32_t usecs = microsUntilTicker();
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		struct timespec timeout = { 0, 1000 * ((usecs < 100) ? usecs : 100) };
+		ppoll(&pfd, 1, &timeout, NULL);
+	}
+}
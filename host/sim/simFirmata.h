@@ -0,0 +1,101 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Running the Firmata firmware on a host computer.
+//
+// The firmware (firmware/source/mbFirmata.cpp) is compiled against the DAL simulation in
+// MicroBit.h. Its serial port reads and writes a file descriptor, normally the master side of
+// a pseudo-terminal, so clients can connect to the slave side as if it were a real board.
+// The firmware uses global state, so there can only be one simulated board per process.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Open a pseudo-terminal in raw mode. Return the master fd and set slavePath. The slave
+// side is kept open (its fd is returned in slaveFd) so its settings persist between clients.
+int simOpenPty(std::string &slavePath, int *slaveFd);
+
+// Connect the firmware serial port to the given non-blocking file descriptor.
+void simSetSerialFd(int fd);
+
+// Set the simulated baud rate used to pace outgoing data. Zero means unthrottled.
+void simSetBaud(int baud);
+
+// Read serial input from memory instead of the serial fd, and discard all output, so the
+// firmware processes commands as fast as it can (see mbReplay). The data must remain valid
+// until the replay is finished. Pass NULL to return to the serial fd.
+void simReplayInput(const uint8_t *data, int count);
+int simReplayRemaining();
+
+// Simulate a noisy serial line: drop every dropEvery'th byte received and flip the low bit
+// of every corruptEvery'th byte (so data bytes stay data bytes). Zero turns either off.
+void simInputErrors(int dropEvery, int corruptEvery);
+
+// Set the board's microsecond clock (us_ticker_read()), e.g. to test clock wrap-around.
+// Call it before simRun() (or a simulated reboot); the firmware assumes the clock is steady.
+void simSetBoardClock(uint32_t usecs);
+
+// Queue a MessageBus event; it is delivered on the firmware thread by the next simStep().
+void simInjectEvent(int source, int value);
+
+// Set the value seen by a digital input pin.
+void simSetDigitalInput(int pin, int value);
+
+// Record the PWM and servo outputs written to the pins in pinMask (bit n for pin n), with
+// the board time (usecs) of each write. For servos, the value is the pulse width (usecs).
+// simAnalogOutput() returns and clears the writes recorded. A mask of zero stops recording.
+struct SimAnalogWrite {
+	uint32_t time;
+	int pin;
+	int value;
+	int period; // PWM period (usecs)
+};
+void simRecordAnalogOutput(uint32_t pinMask);
+std::vector<SimAnalogWrite> simAnalogOutput();
+
+// Return the value output by a digital output pin.
+int simDigitalOutput(int pin);
+
+// Stop (or restart) the simulated motion of the board, so the accelerometer and compass
+// report the same values until it is released.
+void simHoldMotion(bool hold);
+
+// Generate radio packets from nodeCount simulated nodes at the given total rate, delivered
+// to the firmware's loopback radio (packets are lost if the firmware doesn't keep up).
+// A rate of zero stops the traffic.
+void simRadioTraffic(int packetsPerSecond, int nodeCount);
+uint64_t simRadioPacketsInjected();
+
+// The simulated microphone hears a 440 Hz tone with this amplitude.
+#define SIM_MIC_AMPLITUDE 4000
+
+// Run one iteration of the firmware main loop and deliver any pending events.
+void simStep();
+
+// Initialize the firmware, then call simStep() until *stop becomes true. Calling simRun()
+// again simulates a reboot: the firmware restarts with the values saved in its storage.
+void simRun(int fd, const volatile bool *stop);
@@ -0,0 +1,84 @@
+/*
+MIT License
+
+Copyright (c) 2019 Micro:bit Educational Foundation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// mbFirmataSim: run the Firmata firmware on the host, attached to a pseudo-terminal.
+//
+// Usage: mbFirmataSim [--baud N] [--link PATH]
+//
+// Prints the path of the pseudo-terminal slave device, which clients open like a real
+// board's serial port. --link also creates a symlink to it at PATH. --baud sets the simulated
+// serial speed (default 57600); zero means unthrottled.
+
+#include "simFirmata.h"
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+static volatile bool stopRequested = false;
+
+static void onSignal(int sig) { stopRequested = true; }
+
+int main(int argc, char **argv) {
+	const char *linkPath = NULL;
+	for (int i = 1; i < argc; i++) {
+		if ((0 == strcmp(argv[i], "--baud")) && (i + 1 < argc)) {
+			simSetBaud(atoi(argv[++i]));
+		} else if ((0 == strcmp(argv[i], "--link")) && (i + 1 < argc)) {
+			linkPath = argv[++i];
+		} else {
+			fprintf(stderr, "usage: %s [--baud N] [--link PATH]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	std::string slavePath;
+	int slaveFd = -1;
+	int fd = simOpenPty(slavePath, &slaveFd);
+	if (fd < 0) {
+		perror("simOpenPty");
+		return 1;
+	}
+	if (linkPath) {
+		unlink(linkPath);
+		if (symlink(slavePath.c_str(), linkPath) < 0) {
+			perror("symlink");
+			return 1;
+		}
+	}
+	printf("%s\n", slavePath.c_str());
+	fflush(stdout);
+
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+	simRun(fd, &stopRequested);
+
+	if (linkPath) unlink(linkPath);
+	close(slaveFd);
+	close(fd);
+	return 0;
+}